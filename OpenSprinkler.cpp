@@ -25,6 +25,7 @@
 #include "server.h"
 #include "gpio.h"
 #include "testmode.h"
+#include "tz.h"
 
 /** Declare static data members */
 OSMqtt OpenSprinkler::mqtt;
@@ -50,6 +51,10 @@ ulong OpenSprinkler::raindelay_on_lasttime;
 
 ulong OpenSprinkler::flowcount_log_start;
 ulong OpenSprinkler::flowcount_rt;
+ulong OpenSprinkler::flowpulse_rt;
+StationFlowData OpenSprinkler::flow_stats[MAX_NUM_STATIONS];
+static byte flowstats_dirty[MAX_NUM_BOARDS];	// bit set for each station whose flow data has changed since saved
+static ulong flowstats_savetime = 0;
 byte OpenSprinkler::button_timeout;
 ulong OpenSprinkler::checkwt_lasttime;
 ulong OpenSprinkler::checkwt_success_lasttime;
@@ -89,6 +94,9 @@ extern char ether_buffer[];
 	#if defined(OSPI)
 		byte OpenSprinkler::pin_sr_data = PIN_SR_DATA;
 	#endif
+	#if defined(OSPI) || defined(OSBO)
+		static GPIOLines *sr_lines = NULL;	// shift register clock and data pins, set together
+	#endif
 	// todo future: LCD define for Linux-based systems
 #endif
 
@@ -423,7 +431,19 @@ static const char days_str[] PROGMEM =
 
 /** Calculate local time (UTC time plus time zone offset) */
 time_t OpenSprinkler::now_tz() {
-	return now()+(int32_t)3600/4*(int32_t)(iopts[IOPT_TIMEZONE]-48);
+	time_t t = now();
+	return t+utc_offset(t);
+}
+
+/** Time zone offset at a UTC time
+ * from the zoneinfo zone if one is set (RPI/BBB), otherwise
+ * the fixed offset of IOPT_TIMEZONE (in quarter hours)
+ */
+long OpenSprinkler::utc_offset(time_t t) {
+#if !defined(ARDUINO)
+	if(tz_active()) return tz_offset(t);
+#endif
+	return (int32_t)3600/4*(int32_t)(iopts[IOPT_TIMEZONE]-48);
 }
 
 #if defined(ARDUINO)	// AVR network init functions
@@ -557,6 +577,7 @@ bool OpenSprinkler::network_connected(void) {
 /** Reboot controller */
 void OpenSprinkler::reboot_dev(uint8_t cause) {
 	lcd_print_line_clear_pgm(PSTR("Rebooting..."), 0);
+	flowstats_save(true);
 	if(cause) {
 		nvdata.reboot_cause = cause;
 		nvdata_save();
@@ -572,6 +593,8 @@ void OpenSprinkler::reboot_dev(uint8_t cause) {
 #else // RPI/BBB/LINUX network init functions
 
 #include "etherport.h"
+#include "httpclient.h"
+#include "dnscache.h"
 #include <sys/reboot.h>
 #include <stdlib.h>
 #include "utils.h"
@@ -595,6 +618,7 @@ bool OpenSprinkler::network_connected(void) {
 
 /** Reboot controller */
 void OpenSprinkler::reboot_dev(uint8_t cause) {
+	flowstats_save(true);
 	nvdata.reboot_cause = cause;
 	nvdata_save();
 #if defined(DEMO)
@@ -768,6 +792,15 @@ void OpenSprinkler::begin() {
 		pinMode(PIN_SR_DATA,	OUTPUT);
 	#endif
 
+	#if defined(OSPI) || defined(OSBO)
+		#if defined(OSPI)
+		byte sr_pins[] = {PIN_SR_CLOCK, pin_sr_data};
+		#else
+		byte sr_pins[] = {PIN_SR_CLOCK, PIN_SR_DATA};
+		#endif
+		sr_lines = gpio_lines_open(sr_pins, 2);
+	#endif
+
 #endif
 
 	// Reset all stations
@@ -1007,10 +1040,10 @@ void OpenSprinkler::latch_apply_all_station_bits() {
 }
 #endif
 
-/** Apply all station bits
- * !!! This will activate/deactivate valves !!!
+/** Write station bits to the outputs
+ * nb: number of boards to write (shift register chains are always written in full)
  */
-void OpenSprinkler::apply_all_station_bits() {
+void OpenSprinkler::write_station_bits(byte nb) {
 
 #if defined(ESP8266)
 	if(hw_type==HW_TYPE_LATCH) {
@@ -1041,7 +1074,7 @@ void OpenSprinkler::apply_all_station_bits() {
 		}
 			
 		// Handle expansion boards
-		for(int i=0;i<MAX_EXT_BOARDS/2;i++) {
+		for(int i=0;i<MAX_EXT_BOARDS/2 && i*2+1<nb;i++) {
 			uint16_t data = station_bits[i*2+2];
 			data = (data<<8) + station_bits[i*2+1];
 			if(expanders[i]->type==IOEXP_TYPE_9555) {
@@ -1051,14 +1084,14 @@ void OpenSprinkler::apply_all_station_bits() {
 			}
 		}
 	}
-		
-	byte bid, s, sbits;  
 #else
 	digitalWrite(PIN_SR_LATCH, LOW);
 	byte bid, s, sbits;
 
 	// Shift out all station bit values
 	// from the highest bit to the lowest
+	// boards beyond nboards are shifted too, otherwise they would
+	// latch the bits shifted out of the configured boards
 	for(bid=0;bid<=MAX_EXT_BOARDS;bid++) {
 		if (status.enabled)
 			sbits = station_bits[MAX_EXT_BOARDS-bid];
@@ -1066,6 +1099,16 @@ void OpenSprinkler::apply_all_station_bits() {
 			sbits = 0;
 
 		for(s=0;s<8;s++) {
+	#if defined(OSPI) || defined(OSBO)
+			if(sr_lines) {
+				// clock low with the data bit, then clock high, one call each
+				byte values[] = {LOW, (byte)((sbits & ((byte)1<<(7-s))) ? HIGH : LOW)};
+				gpio_lines_write(sr_lines, values);
+				values[0] = HIGH;
+				gpio_lines_write(sr_lines, values);
+				continue;
+			}
+	#endif
 			digitalWrite(PIN_SR_CLOCK, LOW);
 	#if defined(OSPI) // if OSPI, use dynamically assigned pin_sr_data
 			digitalWrite(pin_sr_data, (sbits & ((byte)1<<(7-s))) ? HIGH : LOW );
@@ -1094,22 +1137,79 @@ void OpenSprinkler::apply_all_station_bits() {
 	digitalWrite(PIN_SR_LATCH, HIGH);
 	#endif
 #endif
+}
 
+/** Apply all station bits
+ * !!! This will activate/deactivate valves !!!
+ * Outputs are only written if the station bits have changed,
+ * or every STATION_REFRESH_INTERVAL seconds (for noise immunity)
+ */
+void OpenSprinkler::apply_all_station_bits() {
+	static byte applied_bits[MAX_NUM_BOARDS];	// station bits last written to the outputs
+	static byte applied_enabled = 0;
+	static byte applied_nboards = 0;
+	static ulong applied_time = 0;
+	byte bid, s;
+
+	bool changed = (status.enabled!=applied_enabled || nboards!=applied_nboards);
+	if(memcmp(applied_bits, station_bits, MAX_NUM_BOARDS)) {
+		memcpy(applied_bits, station_bits, MAX_NUM_BOARDS);
+		changed = true;
+	}
+	applied_enabled = status.enabled;
+	ulong curr = millis();
+	bool forced = (!applied_nboards);	// first call writes all boards
+#if STATION_REFRESH_INTERVAL > 0
+	if(curr-applied_time >= (ulong)STATION_REFRESH_INTERVAL*1000) forced = true;
+#endif
+	if(changed || forced) {
+		write_station_bits((forced || nboards!=applied_nboards) ? MAX_NUM_BOARDS : nboards);
+		applied_nboards = nboards;
+		applied_time = curr;
+	}
 
 	if(iopts[IOPT_SPE_AUTO_REFRESH]) {
 		// handle refresh of RF and remote stations
-		// we refresh the station whose index is the current time modulo MAX_NUM_STATIONS
-		static byte last_sid = 0;
-		byte sid = now() % MAX_NUM_STATIONS;
-		if (sid != last_sid) {	// avoid refreshing the same station twice in a roll
-			last_sid = sid;
-			bid=sid>>3;
-			s=sid&0x07;
-			switch_special_station(sid, (station_bits[bid]>>s)&0x01);
+		// special stations are refreshed in turn, evenly spread
+		// over the refresh cycle
+		static byte spe_next = 0;
+		static ulong spe_time = 0;
+		if((long)(curr-spe_time)>=0) {
+			byte n = special_station_count();
+			byte sid = spe_next;
+			for(byte i=0;i<nstations && n;i++,sid++) {
+				if(sid>=nstations) sid = 0;
+				bid=sid>>3;
+				s=sid&0x07;
+				if((attrib_spe[bid]>>s)&0x01) {
+					switch_special_station(sid, (station_bits[bid]>>s)&0x01);
+					spe_next = sid+1;
+					break;
+				}
+			}
+			spe_time = curr + (ulong)spe_refresh_cycle()*1000/(n?n:1);
 		}
 	}
 }
 
+/** Number of special stations */
+byte OpenSprinkler::special_station_count() {
+	byte n = 0;
+	for(byte bid=0;bid<nboards;bid++) {
+		for(byte v=attrib_spe[bid];v;v&=v-1) n++;
+	}
+	return n;
+}
+
+/** Auto refresh cycle (in seconds)
+ * each special station is refreshed once per cycle,
+ * and refreshes are at least one second apart
+ */
+uint16_t OpenSprinkler::spe_refresh_cycle() {
+	byte n = special_station_count();
+	return (n>SPE_REFRESH_INTERVAL) ? n : SPE_REFRESH_INTERVAL;
+}
+
 /** Read rain sensor status */
 void OpenSprinkler::detect_binarysensor_status(ulong curr_time) {
 	// sensor_type: 0 if normally closed, 1 if normally open
@@ -1347,6 +1447,17 @@ byte OpenSprinkler::get_station_type(byte sid) {
 	return file_read_byte(STATIONS_FILENAME, (uint32_t)sid*sizeof(StationData)+offsetof(StationData, type));
 }
 
+/** Get station crop coefficient (in %) */
+byte OpenSprinkler::get_station_kc(byte sid) {
+	byte kc = file_read_byte(STATIONS_FILENAME, (uint32_t)sid*sizeof(StationData)+offsetof(StationData, attrib)+offsetof(StationAttrib, kc));
+	return kc ? kc : 100;
+}
+
+/** Set station crop coefficient (in %) */
+void OpenSprinkler::set_station_kc(byte sid, byte kc) {
+	file_write_byte(STATIONS_FILENAME, (uint32_t)sid*sizeof(StationData)+offsetof(StationData, attrib)+offsetof(StationAttrib, kc), kc);
+}
+
 /** Get station attribute */
 /*void OpenSprinkler::get_station_attrib(byte sid, StationAttrib *attrib); {
 	file_read_block(STATIONS_FILENAME, attrib, (uint32_t)sid*sizeof(StationData)+offsetof(StationData, attrib), sizeof(StationAttrib));
@@ -1421,14 +1532,7 @@ byte OpenSprinkler::password_verify(char *pw) {
 
 /** Index of today's weekday (Monday is 0) */
 byte OpenSprinkler::weekday_today() {
-	//return ((byte)weekday()+5)%7; // Time::weekday() assumes Sunday is 1
-#if defined(ARDUINO)
-	ulong wd = now_tz() / 86400L;
-	return (wd+3) % 7;	// Jan 1, 1970 is a Thursday
-#else
-	return 0;
-	// todo future: is this function needed for RPI/BBB?
-#endif
+	return weekday_from_days(now_tz() / 86400L);
 }
 
 /** Switch special station */
@@ -1562,9 +1666,21 @@ void OpenSprinkler::switch_rfstation(RFStationData *data, bool turnon) {
 	send_rfsignal(turnon ? on : off, length);
 	#endif
 #else
+	// queue the waveform for the pulse thread: 24 code bits and sync, sent 15 times
+	ulong code = turnon ? on : off;
+	ulong pulses[50];
+	byte n = 0;
+	for(int i=23;i>=0;i--) {
+		pulses[n++] = ((code>>i)&1) ? length*3 : length;
+		pulses[n++] = ((code>>i)&1) ? length : length*3;
+	}
+	pulses[n++] = length;
+	pulses[n++] = length*31;
+	if(gpio_pulses_queue(PIN_RFTX, pulses, n, 15)) return;
+
 	// pre-open gpio file to minimize overhead
 	rf_gpio_fd = gpio_fd_open(PIN_RFTX);
-	send_rfsignal(turnon ? on : off, length);
+	send_rfsignal(code, length);
 	gpio_fd_close(rf_gpio_fd);
 	rf_gpio_fd = -1;
 #endif
@@ -1635,7 +1751,7 @@ int8_t OpenSprinkler::send_http_request(uint32_t ip4, uint16_t port, char* p, vo
 	if(len > ETHER_BUFFER_SIZE) len = ETHER_BUFFER_SIZE;
 	client->write((uint8_t *)p, len);
 	memset(ether_buffer, 0, ETHER_BUFFER_SIZE);
-	uint32_t stoptime = millis()+timeout;
+	ulong stoptime = millis()+timeout;
 
 #if defined(ARDUINO)
 	while(client->connected() || client->available()) {
@@ -1643,13 +1759,13 @@ int8_t OpenSprinkler::send_http_request(uint32_t ip4, uint16_t port, char* p, vo
 			client->read((uint8_t*)ether_buffer, ETHER_BUFFER_SIZE);
 		}
 		delay(0);
-		if(millis()>stoptime) {
+		if((long)(millis()-stoptime)>0) {
 			client->stop();
 			return HTTP_RQT_TIMEOUT;			
 		}
 	}
 #else
-	while(millis() < stoptime) {
+	while((long)(millis()-stoptime)<0) {
 		int len=client->read((uint8_t *)ether_buffer, ETHER_BUFFER_SIZE);
 		if (len<=0) {
 			if(!client->connected())	break;
@@ -1689,14 +1805,25 @@ int8_t OpenSprinkler::send_http_request(const char* server, uint16_t port, char*
 
 	EthernetClient etherClient;
 	EthernetClient *client = &etherClient;
-	struct hostent *host;
-	host = gethostbyname(server);
-	if (!host) {
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	// wait for the resolver (at most timeout) if the server is not cached
+	ulong resolvetime = millis()+timeout;
+	byte ret;
+	while((ret=dnscache_lookup(server, port, &addr, &addrlen))==DNSCACHE_PENDING) {
+		if((long)(millis()-resolvetime)>0) break;
+		delay(10);
+	}
+	if (ret!=DNSCACHE_FOUND) {
 		DEBUG_PRINT("can't resolve http station - ");
 		DEBUG_PRINTLN(server);
 		return HTTP_RQT_CONNECT_ERR;
-	}	
-	if(!client->connect((uint8_t*)host->h_addr, port)) { client->stop(); return HTTP_RQT_CONNECT_ERR; }	
+	}
+	if(!client->connect((struct sockaddr*)&addr, addrlen)) {
+		client->stop();
+		dnscache_expire(server);
+		return HTTP_RQT_CONNECT_ERR;
+	}
 
 #endif
 
@@ -1704,7 +1831,7 @@ int8_t OpenSprinkler::send_http_request(const char* server, uint16_t port, char*
 	if(len > ETHER_BUFFER_SIZE) len = ETHER_BUFFER_SIZE;
 	client->write((uint8_t *)p, len);
 	memset(ether_buffer, 0, ETHER_BUFFER_SIZE);
-	uint32_t stoptime = millis()+timeout;
+	ulong stoptime = millis()+timeout;
 
 #if defined(ARDUINO)
 	while(client->connected() || client->available()) {
@@ -1712,13 +1839,13 @@ int8_t OpenSprinkler::send_http_request(const char* server, uint16_t port, char*
 			client->read((uint8_t*)ether_buffer, ETHER_BUFFER_SIZE);
 		}
 		delay(0);
-		if(millis()>stoptime) {
+		if((long)(millis()-stoptime)>0) {
 			client->stop();
 			return HTTP_RQT_TIMEOUT;			
 		}
 	}
 #else
-	while(millis() < stoptime) {
+	while((long)(millis()-stoptime)<0) {
 		int len=client->read((uint8_t *)ether_buffer, ETHER_BUFFER_SIZE);
 		if (len<=0) {
 			if(!client->connected())	break;
@@ -1738,6 +1865,171 @@ int8_t OpenSprinkler::send_http_request(char* server_with_port, char* p, void(*c
 	return send_http_request(server, (port==NULL)?80:atoi(port), p, callback, timeout);
 }
 
+/** Queue a HTTP request
+ * On RPI/BBB, the request is sent by the asynchronous http client,
+ * and callback is called later from the main loop. If the queue is
+ * full, the request is not sent (HTTP_RQT_NOT_RECEIVED): this never
+ * waits for pending requests.
+ * Otherwise the request is sent right away.
+ */
+int8_t OpenSprinkler::queue_http_request(uint32_t ip4, uint16_t port, char* p, void(*callback)(char*), uint16_t timeout) {
+#if defined(ARDUINO)
+	return send_http_request(ip4, port, p, callback, timeout);
+#else
+	char server[16];
+	snprintf(server, sizeof(server), "%d.%d.%d.%d", (int)(ip4>>24), (int)((ip4>>16)&0xff), (int)((ip4>>8)&0xff), (int)(ip4&0xff));
+	return queue_http_request(server, port, p, callback, timeout);
+#endif
+}
+
+int8_t OpenSprinkler::queue_http_request(const char* server, uint16_t port, char* p, void(*callback)(char*), uint16_t timeout) {
+#if defined(ARDUINO)
+	return send_http_request(server, port, p, callback, timeout);
+#else
+	if(httpclient_queue(server, port, p, callback, timeout)) return HTTP_RQT_QUEUED;
+	// completed requests may free a slot, without waiting for others
+	httpclient_poll();
+	if(httpclient_queue(server, port, p, callback, timeout)) return HTTP_RQT_QUEUED;
+	DEBUG_PRINT("http request queue full - ");
+	DEBUG_PRINTLN(server);
+	return HTTP_RQT_NOT_RECEIVED;
+#endif
+}
+
+#if !defined(ARDUINO)
+/** Remote station command waiting to be sent */
+struct RemoteCommand {
+	uint32_t ip4;
+	uint16_t port;
+	byte sid;		// station index on the remote controller
+	byte en;
+};
+
+/** Remote controller address */
+struct RemoteController {
+	uint32_t ip4;
+	uint16_t port;
+};
+
+static RemoteCommand remote_cmds[MANUAL_BATCH_MAX];
+static byte remote_ncmds = 0;
+static RemoteController remote_legacy[REMOTE_LEGACY_MAX];	// remote controllers without /cb
+static byte remote_nlegacy = 0;
+static int remote_resync_sid = -1;	// next station to resend to legacy remote controllers (-1: none)
+
+static bool remote_is_legacy(uint32_t ip4, uint16_t port) {
+	for(byte i=0;i<remote_nlegacy && i<REMOTE_LEGACY_MAX;i++) {
+		if(remote_legacy[i].ip4==ip4 && remote_legacy[i].port==port) return true;
+	}
+	return false;
+}
+
+/** Callback function for batched remote station commands
+ * Remote controllers with older firmwares do not have /cb and reply
+ * page not found: such controllers are remembered, and their stations
+ * are resent one by one with /cm.
+ */
+static void remote_batch_callback(char* buffer) {
+	char *s = strstr(buffer, "\"result\":");
+	if(!s || atoi(s+9)!=0x20) return;	// 0x20: page not found
+	uint16_t port;
+	const char *server = httpclient_server(&port);
+	int ip[4];
+	if(sscanf(server, "%d.%d.%d.%d", ip, ip+1, ip+2, ip+3)!=4) return;
+	uint32_t ip4 = ((uint32_t)ip[0]<<24) | ((uint32_t)ip[1]<<16) | ((uint32_t)ip[2]<<8) | (uint32_t)ip[3];
+	if(remote_is_legacy(ip4, port)) return;
+	DEBUG_PRINT("remote controller does not support /cb: ");
+	DEBUG_PRINTLN(server);
+	RemoteController *r = remote_legacy + (remote_nlegacy++ % REMOTE_LEGACY_MAX);
+	r->ip4 = ip4;
+	r->port = port;
+	remote_resync_sid = 0;
+}
+
+/** Queue a remote station command
+ * (replaces a queued command for the same station)
+ */
+static void remote_queue(uint32_t ip4, uint16_t port, byte rsid, byte en) {
+	byte i;
+	for(i=0;i<remote_ncmds;i++) {
+		if(remote_cmds[i].ip4==ip4 && remote_cmds[i].port==port && remote_cmds[i].sid==rsid) break;
+	}
+	if(i==remote_ncmds) {
+		if(remote_ncmds==MANUAL_BATCH_MAX) OpenSprinkler::flush_remote_commands();
+		if(remote_ncmds==MANUAL_BATCH_MAX) {
+			// cannot be sent yet: drop the oldest command (with auto
+			// refresh on, the current state of its station is sent again)
+			DEBUG_PRINTLN("remote command queue full");
+			memmove(remote_cmds, remote_cmds+1, (MANUAL_BATCH_MAX-1)*sizeof(RemoteCommand));
+			remote_ncmds--;
+		}
+		i = remote_ncmds++;
+	}
+	remote_cmds[i].ip4 = ip4;
+	remote_cmds[i].port = port;
+	remote_cmds[i].sid = rsid;
+	remote_cmds[i].en = en;
+}
+
+/** Send queued remote station commands
+ * Commands to the same remote controller are sent
+ * in one /cb request (/cm if there is only one, or
+ * the remote controller does not have /cb).
+ * While the http request queue is full, commands stay
+ * queued until the next call.
+ */
+void OpenSprinkler::flush_remote_commands() {
+	// the commands of a failed batch are lost: resend the state of every
+	// station on legacy remote controllers, as far as the queue has room
+	StationData *pdata = (StationData*) tmp_buffer;
+	while(remote_resync_sid>=0 && remote_ncmds<MANUAL_BATCH_MAX) {
+		if(remote_resync_sid>=nstations) {
+			remote_resync_sid = -1;
+			break;
+		}
+		byte sid = remote_resync_sid++;
+		if(get_station_type(sid)!=STN_TYPE_REMOTE) continue;
+		get_station_data(sid, pdata);
+		RemoteStationData *data = (RemoteStationData*) pdata->sped;
+		uint32_t ip4 = hex2ulong(data->ip, sizeof(data->ip));
+		uint16_t port = (uint16_t)hex2ulong(data->port, sizeof(data->port));
+		if(remote_is_legacy(ip4, port))
+			remote_queue(ip4, port, (byte)hex2ulong(data->sid, sizeof(data->sid)), (station_bits[sid>>3]>>(sid&0x07))&0x01);
+	}
+
+	char p[TMP_BUFFER_SIZE*2];
+	char sids[MANUAL_BATCH_MAX*4];
+	char ens[MANUAL_BATCH_MAX*2];
+	uint16_t timer = iopts[IOPT_SPE_AUTO_REFRESH]?SPE_REFRESH_MISSES*spe_refresh_cycle():64800;
+	while(remote_ncmds && httpclient_pending()<HTTPCLIENT_QUEUE_SIZE) {
+		uint32_t ip4 = remote_cmds[0].ip4;
+		uint16_t port = remote_cmds[0].port;
+		bool legacy = remote_is_legacy(ip4, port);
+		// take all the commands to this remote controller off the queue
+		// (only the first one for a legacy remote controller)
+		byte i, j=0, n=0;
+		int ls=0, le=0;
+		for(i=0;i<remote_ncmds;i++) {
+			RemoteCommand *c = remote_cmds+i;
+			if(c->ip4==ip4 && c->port==port && !(legacy && n)) {
+				ls += sprintf(sids+ls, n?",%d":"%d", (int)c->sid);
+				le += sprintf(ens+le, n?",%d":"%d", (int)c->en);
+				n++;
+			} else {
+				remote_cmds[j++] = *c;
+			}
+		}
+		remote_ncmds = j;
+
+		BufferFiller bf = p;
+		bf.emit_p(PSTR("GET /$S?pw=$O&sid=$S&en=$S&t=$D HTTP/1.1\r\nHOST: $D.$D.$D.$D\r\nConnection: keep-alive\r\n\r\n"),
+							(n>1)?"cb":"cm", SOPT_PASSWORD, sids, ens, timer,
+							(int)(ip4>>24), (int)((ip4>>16)&0xff), (int)((ip4>>8)&0xff), (int)(ip4&0xff));
+		queue_http_request(ip4, port, p, (n>1)?remote_batch_callback:remote_http_callback);
+	}
+}
+#endif
+
 /** Switch remote station
  * This function takes a remote station code,
  * parses it into remote IP, port, station index,
@@ -1752,6 +2044,13 @@ void OpenSprinkler::switch_remotestation(RemoteStationData *data, bool turnon) {
 	uint32_t ip4 = hex2ulong(copy.ip, sizeof(copy.ip));
 	uint16_t port = (uint16_t)hex2ulong(copy.port, sizeof(copy.port));
 
+#if !defined(ARDUINO)
+	// coalesce commands to the same remote controller,
+	// they are sent by flush_remote_commands() from the main loop
+	remote_queue(ip4, port, (byte)hex2ulong(copy.sid, sizeof(copy.sid)), turnon);
+	return;
+#endif
+
 	byte ip[4];
 	ip[0] = ip4>>24;
 	ip[1] = (ip4>>16)&0xff;
@@ -1762,16 +2061,23 @@ void OpenSprinkler::switch_remotestation(RemoteStationData *data, bool turnon) {
 	// because remote station data is loaded at the beginning
 	char *p = tmp_buffer;
 	BufferFiller bf = p;
-	// MAX_NUM_STATIONS is the refresh cycle
-	uint16_t timer = iopts[IOPT_SPE_AUTO_REFRESH]?2*MAX_NUM_STATIONS:64800;  
+	// with auto refresh on, the remote station turns off
+	// if it misses SPE_REFRESH_MISSES refreshes
+	uint16_t timer = iopts[IOPT_SPE_AUTO_REFRESH]?SPE_REFRESH_MISSES*spe_refresh_cycle():64800;
 	bf.emit_p(PSTR("GET /cm?pw=$O&sid=$D&en=$D&t=$D"),
 						SOPT_PASSWORD,
 						(int)hex2ulong(copy.sid, sizeof(copy.sid)),
 						turnon, timer);
+#if defined(ARDUINO)
 	bf.emit_p(PSTR(" HTTP/1.0\r\nHOST: $D.$D.$D.$D\r\n\r\n"),
 						ip[0],ip[1],ip[2],ip[3]);
+#else
+	// keep the connection to the remote controller open for the next command
+	bf.emit_p(PSTR(" HTTP/1.1\r\nHOST: $D.$D.$D.$D\r\nConnection: keep-alive\r\n\r\n"),
+						ip[0],ip[1],ip[2],ip[3]);
+#endif
 
-	send_http_request(ip4, port, p, remote_http_callback);
+	queue_http_request(ip4, port, p, remote_http_callback);
 
 }
 
@@ -1794,7 +2100,7 @@ void OpenSprinkler::switch_httpstation(HTTPStationData *data, bool turnon) {
 	BufferFiller bf = p;
 	bf.emit_p(PSTR("GET /$S HTTP/1.0\r\nHOST: $S\r\n\r\n"), cmd, server);
 
-	send_http_request(server, atoi(port), p, remote_http_callback);
+	queue_http_request(server, atoi(port), p, remote_http_callback);
 }
 
 /** Setup function for options */
@@ -1876,6 +2182,10 @@ void OpenSprinkler::options_setup() {
 		
 		// 4. write program data: just need to write a program counter: 0
 		file_write_byte(PROG_FILENAME, 0, 0);
+
+		// clear per-station flow data
+		memset(flow_stats, 0, sizeof(flow_stats));
+		file_write_block(FLOWSTATS_FILENAME, flow_stats, 0, sizeof(flow_stats));
 		
 		// 5. write 'done' file
 		file_write_byte(DONE_FILENAME, 0, 1);
@@ -1892,6 +2202,7 @@ void OpenSprinkler::options_setup() {
 		wifi_pass = sopt_load(SOPT_STA_PASS);
 		#endif
 		attribs_load();
+		flowstats_load();
 	}
 
 #if defined(ARDUINO)	// handle AVR buttons
@@ -2005,6 +2316,35 @@ void OpenSprinkler::nvdata_save() {
 	file_write_block(NVCON_FILENAME, &nvdata, 0, sizeof(NVConData));
 }
 
+/** Load per-station flow data from file */
+void OpenSprinkler::flowstats_load() {
+	memset(flow_stats, 0, sizeof(flow_stats));
+	if (file_exists(FLOWSTATS_FILENAME))
+		file_read_block(FLOWSTATS_FILENAME, flow_stats, 0, sizeof(flow_stats));
+}
+
+/** Mark the flow data of a station as changed */
+void OpenSprinkler::flowstats_changed(byte sid) {
+	flowstats_dirty[sid>>3] |= 1<<(sid&0x07);
+}
+
+/** Save the flow data of the stations that have changed
+ * at most every FLOWSTATS_SAVE_INTERVAL seconds, unless forced
+ */
+void OpenSprinkler::flowstats_save(bool force) {
+	if (!force && millis()-flowstats_savetime < FLOWSTATS_SAVE_INTERVAL*1000UL) return;
+	flowstats_savetime = millis();
+	for (byte bid=0; bid<MAX_NUM_BOARDS; bid++) {
+		if (!flowstats_dirty[bid]) continue;
+		for (byte s=0; s<8; s++) {
+			if (!((flowstats_dirty[bid]>>s)&1)) continue;
+			byte sid = bid*8+s;
+			file_write_block(FLOWSTATS_FILENAME, flow_stats+sid, sizeof(StationFlowData)*sid, sizeof(StationFlowData));
+		}
+		flowstats_dirty[bid] = 0;
+	}
+}
+
 /** Load integer options from file */
 void OpenSprinkler::iopts_load() {
 	file_read_block(IOPTS_FILENAME, iopts, 0, NUM_IOPTS);
@@ -2139,9 +2479,11 @@ void OpenSprinkler::lcd_print_time(time_t t)
 	// each weekday string has 3 characters + ending 0
 	lcd_print_pgm(days_str+4*weekday_today());
 	lcd_print_pgm(PSTR(" "));
-	lcd_print_2digit(month(t));
+	CivilDate cd;
+	civil_from_days(t / 86400L, &cd);
+	lcd_print_2digit(cd.month);
 	lcd_print_pgm(PSTR("-"));
-	lcd_print_2digit(day(t));
+	lcd_print_2digit(cd.day);
 }
 
 /** print ip address */
@@ -78,7 +78,8 @@ struct StationAttrib {	// station attributes
 	
 	byte gid:4; // group id: reserved for the future
 	byte dummy:4;
-	byte reserved[2]; // reserved bytes for the future
+	byte kc;	// crop coefficient in % (0: 100%)
+	byte reserved[1]; // reserved bytes for the future
 }; // total is 4 bytes so far
 
 /** Station data structure */
@@ -114,6 +115,17 @@ struct HTTPStationData {
 	byte data[STATION_SPECIAL_DATA_SIZE];
 };
 
+/** Per-station flow data (persisted)
+ * Changes are saved in batches, at most every FLOWSTATS_SAVE_INTERVAL
+ */
+#ifndef FLOWSTATS_SAVE_INTERVAL
+#define FLOWSTATS_SAVE_INTERVAL	600	// seconds between saves of the changed flow data
+#endif
+struct StationFlowData {
+	float nominal;	// learned nominal flow rate (pulses per minute)
+	float volume;		// total flow attributed to the station (pulses)
+};
+
 /** Volatile controller status bits */
 struct ConStatus {
 	byte enabled:1;						// operation enable (when set, controller operation is enabled)
@@ -186,7 +198,9 @@ public:
 	static ulong sensor2_active_lasttime; // most recent time sensor1 is activated	
 	static ulong raindelay_on_lasttime;  // time when the most recent rain delay started
 	static ulong flowcount_rt;		 // flow count (for computing real-time flow rate)
+	static ulong flowpulse_rt;		 // mean interval between flow pulses in microseconds (for computing real-time flow rate)
 	static ulong flowcount_log_start; // starting flow count (for logging)
+	static StationFlowData flow_stats[]; // per-station flow data
 
 	static byte  button_timeout;				// button timeout
 	static ulong checkwt_lasttime;			// time when weather was checked
@@ -207,12 +221,15 @@ public:
 	static bool load_hardware_mac(byte* buffer, bool wired=false);	// read hardware mac address
 #endif
 	static time_t now_tz();
+	static long utc_offset(time_t t);	// offset (seconds) of local time from UTC
 	// -- station names and attributes
 	static void get_station_data(byte sid, StationData* data); // get station data
 	static void set_station_data(byte sid, StationData* data); // set station data
 	static void get_station_name(byte sid, char buf[]); // get station name
 	static void set_station_name(byte sid, char buf[]); // set station name
 	static byte get_station_type(byte sid); // get station type
+	static byte get_station_kc(byte sid); // get station crop coefficient (in %)
+	static void set_station_kc(byte sid, byte kc); // set station crop coefficient (in %)
 	//static StationAttrib get_station_attrib(byte sid); // get station attribute
 	static void attribs_save(); // repackage attrib bits and save (backward compatibility)
 	static void attribs_load(); // load and repackage attrib bits (backward compatibility)
@@ -225,6 +242,9 @@ public:
 	// -- options and data storeage
 	static void nvdata_load();
 	static void nvdata_save();
+	static void flowstats_load();
+	static void flowstats_changed(byte sid);
+	static void flowstats_save(bool force=false);
 
 	static void options_setup();
 	static void iopts_load();
@@ -258,6 +278,11 @@ public:
 	static int8_t send_http_request(uint32_t ip4, uint16_t port, char* p, void(*callback)(char*)=NULL, uint16_t timeout=3000);
 	static int8_t send_http_request(const char* server, uint16_t port, char* p, void(*callback)(char*)=NULL, uint16_t timeout=3000);
 	static int8_t send_http_request(char* server_with_port, char* p, void(*callback)(char*)=NULL, uint16_t timeout=3000);  
+	static int8_t queue_http_request(uint32_t ip4, uint16_t port, char* p, void(*callback)(char*)=NULL, uint16_t timeout=3000);
+	static int8_t queue_http_request(const char* server, uint16_t port, char* p, void(*callback)(char*)=NULL, uint16_t timeout=3000);
+#if !defined(ARDUINO)
+	static void flush_remote_commands(); // send coalesced remote station commands
+#endif
 	// -- LCD functions
 #if defined(ARDUINO) // LCD functions for Arduino
 	#if defined(ESP8266)
@@ -318,6 +343,9 @@ private:
 	#endif
 #endif // LCD functions
 	static byte engage_booster;
+	static void write_station_bits(byte nb);
+	static byte special_station_count();
+	static uint16_t spe_refresh_cycle();
 };
 
 // todo
@@ -8,16 +8,34 @@ while getopts ":s" opt; do
       ;;
   esac
 done
+if [ "$1" == "test" ]; then
+	# build and run the unit tests and benchmarks in test/
+	echo "Building and running tests..."
+	mkdir -p test/bin
+	CXX="g++ -std=gnu++14 -I. -Itest"
+	status=0
+	$CXX -o test/bin/gpio_test -DOSPI -DGPIOMEM_DISABLE test/gpio_test.cpp test/stubs.cpp gpio.cpp utils.cpp -lpthread -Wl,--wrap=open,--wrap=close,--wrap=dup,--wrap=ioctl && test/bin/gpio_test || status=1
+	$CXX -o test/bin/gpiomem_test -DOSPI test/gpiomem_test.cpp test/stubs.cpp gpio.cpp utils.cpp -lpthread && test/bin/gpiomem_test || status=1
+	$CXX -o test/bin/dnscache_test -DOSPI -DDNSCACHE_TTL=1 -DDNSCACHE_NEG_TTL=1 test/dnscache_test.cpp test/stubs.cpp dnscache.cpp utils.cpp -lpthread -Wl,--wrap=getaddrinfo && test/bin/dnscache_test || status=1
+	$CXX -o test/bin/dnscache_test_direct -DOSPI -DDNSCACHE_TTL=1 -DDNSCACHE_NEG_TTL=1 -DSTUB_NO_THREAD test/dnscache_test.cpp test/stubs.cpp dnscache.cpp utils.cpp -lpthread -Wl,--wrap=getaddrinfo,--wrap=pthread_create && test/bin/dnscache_test_direct || status=1
+	$CXX -o test/bin/webhook_test -DOSPI test/webhook_test.cpp test/stubs.cpp httpclient.cpp dnscache.cpp utils.cpp -lpthread && test/bin/webhook_test || status=1
+	$CXX -o test/bin/clock_bench -DOSPI test/clock_bench.cpp test/stubs.cpp utils.cpp -lpthread && test/bin/clock_bench || status=1
+	$CXX -o test/bin/clock_bench_coarse -DOSPI -DMILLIS_CLOCK=CLOCK_MONOTONIC_COARSE test/clock_bench.cpp test/stubs.cpp utils.cpp -lpthread && test/bin/clock_bench_coarse || status=1
+	$CXX -o test/bin/calendar_test -DOSPI test/calendar_test.cpp test/stubs.cpp utils.cpp -lpthread && test/bin/calendar_test || status=1
+	test/mqtt_test.sh || status=1
+	exit $status
+fi
+
 echo "Building OpenSprinkler..."
 
 if [ "$1" == "demo" ]; then
 	apt-get install -y libmosquitto-dev
-	g++ -o OpenSprinkler -DDEMO -m32 main.cpp OpenSprinkler.cpp program.cpp server.cpp utils.cpp weather.cpp gpio.cpp etherport.cpp mqtt.cpp -lpthread -lmosquitto
+	g++ -o OpenSprinkler -DDEMO -m32 main.cpp OpenSprinkler.cpp program.cpp server.cpp utils.cpp weather.cpp gpio.cpp etherport.cpp mqtt.cpp logstore.cpp httpclient.cpp dnscache.cpp et.cpp notify.cpp webhook.cpp tz.cpp -lpthread -lmosquitto
 elif [ "$1" == "osbo" ]; then
-	g++ -o OpenSprinkler -DOSBO main.cpp OpenSprinkler.cpp program.cpp server.cpp utils.cpp weather.cpp gpio.cpp etherport.cpp mqtt.cpp -lpthread
+	g++ -o OpenSprinkler -DOSBO main.cpp OpenSprinkler.cpp program.cpp server.cpp utils.cpp weather.cpp gpio.cpp etherport.cpp mqtt.cpp logstore.cpp httpclient.cpp dnscache.cpp et.cpp notify.cpp webhook.cpp tz.cpp -lpthread
 else
 	apt-get install -y libmosquitto-dev
-	g++ -o OpenSprinkler -DOSPI main.cpp OpenSprinkler.cpp program.cpp server.cpp utils.cpp weather.cpp gpio.cpp etherport.cpp mqtt.cpp -lpthread -lmosquitto
+	g++ -o OpenSprinkler -DOSPI main.cpp OpenSprinkler.cpp program.cpp server.cpp utils.cpp weather.cpp gpio.cpp etherport.cpp mqtt.cpp logstore.cpp httpclient.cpp dnscache.cpp et.cpp notify.cpp webhook.cpp tz.cpp -lpthread -lmosquitto
 fi
 
 if [ ! "$SILENT" = true ] && [ -f OpenSprinkler.launch ] && [ ! -f /etc/init.d/OpenSprinkler.sh ]; then
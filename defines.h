@@ -56,6 +56,7 @@ typedef unsigned long ulong;
 #define STATIONS_FILENAME     "stns.dat"    // stations data file
 #define NVCON_FILENAME        "nvcon.dat"   // non-volatile controller data file, see OpenSprinkler.h --> struct NVConData
 #define PROG_FILENAME         "prog.dat"    // program data file
+#define FLOWSTATS_FILENAME    "flowst.dat"  // per-station flow data file, see OpenSprinkler.h --> struct StationFlowData
 #define DONE_FILENAME         "done.dat"    // used to indicate the completion of all files
 
 /** Station macro defines */
@@ -83,6 +84,7 @@ typedef unsigned long ulong;
 #define HTTP_RQT_CONNECT_ERR	-2
 #define HTTP_RQT_TIMEOUT			-3
 #define HTTP_RQT_EMPTY_RETURN	-4
+#define HTTP_RQT_QUEUED				 1	// request queued, sent asynchronously
 
 /** Sensor macro defines */
 #define SENSOR_TYPE_NONE    0x00
@@ -94,6 +96,14 @@ typedef unsigned long ulong;
 
 #define FLOWCOUNT_RT_WINDOW   30    // flow count window (for computing real-time flow rate), 30 seconds
 
+#ifndef STATION_REFRESH_INTERVAL
+#define STATION_REFRESH_INTERVAL 60 // seconds between forced writes of unchanged station outputs (0: only write on change)
+#endif
+#ifndef SPE_REFRESH_INTERVAL
+#define SPE_REFRESH_INTERVAL 120 // with auto refresh on, seconds between refreshes of each special station
+#endif
+#define SPE_REFRESH_MISSES  3   // remote stations turn off after missing this many refreshes
+
 /** Reboot cause */
 #define REBOOT_CAUSE_NONE   0
 #define REBOOT_CAUSE_RESET  1
@@ -135,6 +145,9 @@ typedef unsigned long ulong;
 
 #define STATION_SPECIAL_DATA_SIZE  (TMP_BUFFER_SIZE - STATION_NAME_SIZE - 12)
 
+#define MANUAL_BATCH_MAX  32    // maximum number of stations changed by one /cb command
+#define REMOTE_LEGACY_MAX 8     // number of remote controllers remembered as not supporting /cb
+
 /** Default string option values */
 #define DEFAULT_PASSWORD          "a6d82bced638de3def1e9bbb4983225c"  // md5 of 'opendoor'
 #define DEFAULT_LOCATION          "42.36,-71.06"	// Boston,MA
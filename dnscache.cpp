@@ -0,0 +1,258 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * DNS resolver cache
+ * Feb 2015 @ OpenSprinkler.com
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(ARDUINO)
+
+#include <string.h>
+#include <stdio.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/types.h>
+#include "utils.h"
+#include "dnscache.h"
+
+#define DNSCACHE_EMPTY		0
+#define DNSCACHE_NEW			1		// not resolved yet
+#define DNSCACHE_VALID		2
+#define DNSCACHE_INVALID	3		// lookup failed
+
+/** Cached host name */
+struct DNSCacheEntry {
+	byte state;
+	bool resolving;		// resolver thread is working on this entry
+	bool refresh;			// entry is queued to be resolved again
+	char host[DNSCACHE_HOST_SIZE];
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	ulong expire;			// millis() when the entry expires
+	ulong used;				// millis() of the last lookup
+};
+
+static DNSCacheEntry dns_cache[DNSCACHE_SIZE];
+static pthread_mutex_t dns_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dns_cond = PTHREAD_COND_INITIALIZER;	// an entry needs resolving
+static pthread_once_t dns_once = PTHREAD_ONCE_INIT;
+static bool dns_direct = false;	// resolver thread failed to start: hosts are resolved by the lookup
+
+static bool dnscache_expired(const DNSCacheEntry *e, ulong curr) {
+	return (long)(curr-e->expire)>=0;
+}
+
+static bool dnscache_queued(const DNSCacheEntry *e) {
+	return !e->resolving && (e->state==DNSCACHE_NEW || e->refresh);
+}
+
+/** Resolve the host of an entry
+ * (call with dns_lock held, it is released during the lookup)
+ */
+static void dnscache_resolve(DNSCacheEntry *e) {
+	char host[DNSCACHE_HOST_SIZE];
+	e->resolving = true;
+	e->refresh = false;
+	strcpy(host, e->host);
+	pthread_mutex_unlock(&dns_lock);
+
+	struct addrinfo hints, *res = NULL;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_ADDRCONFIG;
+	int ret = getaddrinfo(host, NULL, &hints, &res);
+
+	pthread_mutex_lock(&dns_lock);
+	ulong curr = millis();
+	e->resolving = false;
+	// the entry may have been reused for another host in the meantime
+	if(!strcmp(e->host, host)) {
+		if(!ret && res && res->ai_addrlen<=sizeof(e->addr)) {
+			memcpy(&e->addr, res->ai_addr, res->ai_addrlen);
+			e->addrlen = res->ai_addrlen;
+			e->state = DNSCACHE_VALID;
+			e->expire = curr+(ulong)DNSCACHE_TTL*1000;
+		} else {
+			DEBUG_PRINT("can't resolve ");
+			DEBUG_PRINTLN(host);
+			// keep using the last address if the host was resolved before
+			if(e->state!=DNSCACHE_VALID) e->state = DNSCACHE_INVALID;
+			e->expire = curr+(ulong)DNSCACHE_NEG_TTL*1000;
+		}
+	}
+	if(res) freeaddrinfo(res);
+}
+
+/** Resolver thread */
+static void *dnscache_resolver(void *) {
+	while(true) {
+		DNSCacheEntry *e = NULL;
+		pthread_mutex_lock(&dns_lock);
+		while(!e) {
+			for(byte i=0;i<DNSCACHE_SIZE;i++) {
+				if(dnscache_queued(&dns_cache[i])) { e = &dns_cache[i]; break; }
+			}
+			if(!e) pthread_cond_wait(&dns_cond, &dns_lock);
+		}
+		dnscache_resolve(e);
+		pthread_mutex_unlock(&dns_lock);
+	}
+	return NULL;
+}
+
+static void dnscache_start_resolver() {
+	pthread_t tid;
+	if(pthread_create(&tid, NULL, dnscache_resolver, NULL)!=0) {
+		DEBUG_PRINTLN("failed to start dns resolver");
+		dns_direct = true;
+		return;
+	}
+	pthread_detach(tid);
+}
+
+/** Find the entry of a host, or allocate one
+ * (call with dns_lock held)
+ */
+static DNSCacheEntry *dnscache_entry(const char *host, ulong curr) {
+	DNSCacheEntry *e, *victim = NULL;
+	for(byte i=0;i<DNSCACHE_SIZE;i++) {
+		e = &dns_cache[i];
+		if(e->state!=DNSCACHE_EMPTY && !strcmp(e->host, host)) return e;
+		if(e->resolving) continue;
+		// reuse an empty entry, or the least recently used one
+		if(!victim || (victim->state!=DNSCACHE_EMPTY &&
+			 (e->state==DNSCACHE_EMPTY || (long)(e->used-victim->used)<0))) victim = e;
+	}
+	if(!victim) return NULL;
+	e = victim;
+	strncpy(e->host, host, DNSCACHE_HOST_SIZE-1);
+	e->host[DNSCACHE_HOST_SIZE-1] = 0;
+	e->state = DNSCACHE_NEW;
+	e->refresh = false;
+	e->used = curr;
+	pthread_once(&dns_once, dnscache_start_resolver);
+	pthread_cond_signal(&dns_cond);
+	return e;
+}
+
+/** Queue an entry to be resolved again (call with dns_lock held) */
+static void dnscache_refresh(DNSCacheEntry *e) {
+	if(e->resolving || e->refresh) return;
+	if(e->state==DNSCACHE_INVALID) e->state = DNSCACHE_NEW;
+	else e->refresh = true;
+	pthread_cond_signal(&dns_cond);
+}
+
+/** Look up the address of a host
+ * Never blocks (unless there is no resolver thread): returns
+ * DNSCACHE_PENDING while the host is being resolved, the caller
+ * should try again later.
+ * On DNSCACHE_FOUND, addr holds the address with the given port.
+ */
+byte dnscache_lookup(const char *host, uint16_t port, struct sockaddr_storage *addr, socklen_t *addrlen) {
+	struct addrinfo hints, *res = NULL;
+	byte ret = DNSCACHE_FAILED;
+
+	// numeric addresses need no lookup
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_NUMERICHOST;
+	if(!getaddrinfo(host, NULL, &hints, &res) && res) {
+		if(res->ai_addrlen<=sizeof(*addr)) {
+			memcpy(addr, res->ai_addr, res->ai_addrlen);
+			*addrlen = res->ai_addrlen;
+			ret = DNSCACHE_FOUND;
+		}
+		freeaddrinfo(res);
+	} else {
+		if(res) freeaddrinfo(res);
+		if(strlen(host)>=DNSCACHE_HOST_SIZE) return DNSCACHE_FAILED;
+		pthread_mutex_lock(&dns_lock);
+		ulong curr = millis();
+		DNSCacheEntry *e = dnscache_entry(host, curr);
+		if(e && dns_direct) {
+			// no resolver thread: resolve synchronously
+			if(e->state!=DNSCACHE_NEW && dnscache_expired(e, curr)) dnscache_refresh(e);
+			if(dnscache_queued(e)) {
+				dnscache_resolve(e);
+				curr = millis();
+			}
+		}
+		if(!e) {
+			ret = DNSCACHE_PENDING;	// every entry is being resolved
+		} else {
+			e->used = curr;
+			if(e->state==DNSCACHE_VALID) {
+				memcpy(addr, &e->addr, e->addrlen);
+				*addrlen = e->addrlen;
+				ret = DNSCACHE_FOUND;
+				if(dnscache_expired(e, curr)) dnscache_refresh(e);
+			} else if(e->state==DNSCACHE_INVALID) {
+				if(dnscache_expired(e, curr)) {
+					dnscache_refresh(e);
+					ret = DNSCACHE_PENDING;
+				}
+			} else {
+				ret = DNSCACHE_PENDING;
+			}
+		}
+		pthread_mutex_unlock(&dns_lock);
+	}
+
+	if(ret==DNSCACHE_FOUND) {
+		if(addr->ss_family==AF_INET6) ((struct sockaddr_in6*)addr)->sin6_port = htons(port);
+		else ((struct sockaddr_in*)addr)->sin_port = htons(port);
+	}
+	return ret;
+}
+
+/** Resolve a host ahead of time
+ * if it is not cached, or its entry expires soon
+ */
+void dnscache_prefetch(const char *host) {
+	if(!host[0] || strlen(host)>=DNSCACHE_HOST_SIZE) return;
+	pthread_mutex_lock(&dns_lock);
+	ulong curr = millis();
+	DNSCacheEntry *e = dnscache_entry(host, curr);
+	if(e && e->state!=DNSCACHE_NEW &&
+		 dnscache_expired(e, curr+(ulong)DNSCACHE_PREFETCH_TIME*1000)) {
+		dnscache_refresh(e);
+	}
+	pthread_mutex_unlock(&dns_lock);
+}
+
+/** Resolve a host again on its next lookup
+ * e.g. when its cached address no longer accepts connections
+ */
+void dnscache_expire(const char *host) {
+	pthread_mutex_lock(&dns_lock);
+	for(byte i=0;i<DNSCACHE_SIZE;i++) {
+		DNSCacheEntry *e = &dns_cache[i];
+		if(e->state!=DNSCACHE_EMPTY && !strcmp(e->host, host)) {
+			e->expire = millis();
+			break;
+		}
+	}
+	pthread_mutex_unlock(&dns_lock);
+}
+
+#endif // !ARDUINO
@@ -0,0 +1,62 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * DNS resolver cache header file
+ * Feb 2015 @ OpenSprinkler.com
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _DNSCACHE_H
+#define _DNSCACHE_H
+
+#if !defined(ARDUINO)
+
+#include <stdint.h>
+#include <sys/socket.h>
+#include "defines.h"
+
+/* On RPI/BBB, host names are resolved by a resolver thread, so a slow
+ * DNS server never blocks the main loop. Results are cached (IPv4 or
+ * IPv6, whichever getaddrinfo prefers) for DNSCACHE_TTL seconds, and
+ * failures for DNSCACHE_NEG_TTL seconds. An expired entry is still
+ * returned while it is being resolved again. If the thread cannot be
+ * started, lookups resolve synchronously instead.
+ */
+#ifndef DNSCACHE_SIZE
+#define DNSCACHE_SIZE						16		// number of cached host names
+#endif
+#ifndef DNSCACHE_TTL
+#define DNSCACHE_TTL						300		// seconds a resolved address is used before it is refreshed
+#endif
+#ifndef DNSCACHE_NEG_TTL
+#define DNSCACHE_NEG_TTL				30		// seconds a failed lookup is remembered
+#endif
+#define DNSCACHE_PREFETCH_TIME	60		// prefetch refreshes entries expiring within this many seconds
+#define DNSCACHE_HOST_SIZE			128
+
+#define DNSCACHE_FOUND					0
+#define DNSCACHE_PENDING				1
+#define DNSCACHE_FAILED					2
+
+byte dnscache_lookup(const char *host, uint16_t port, struct sockaddr_storage *addr, socklen_t *addrlen);
+void dnscache_prefetch(const char *host);
+void dnscache_expire(const char *host);
+
+#endif // !ARDUINO
+
+#endif // _DNSCACHE_H
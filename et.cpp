@@ -0,0 +1,298 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Local evapotranspiration (ET0) engine
+ * Feb 2015 @ OpenSprinkler.com
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(ARDUINO)
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <sys/stat.h>
+#include "utils.h"
+#include "et.h"
+
+#define ET_SOLAR_CONSTANT	0.0820		// MJ/m2/min
+#define ET_STEFAN_BOLTZMANN	4.903e-9	// MJ/K4/m2/day
+
+/** Water balance of all zones, as stored in ET_BALANCE_FILENAME */
+struct ETBalance {
+	uint32_t day;			// last day included in the balance
+	float depletion[MAX_NUM_STATIONS];	// soil water depletion of each zone (mm)
+};
+
+static ETObservation et_obs[ET_OBS_DAYS];	// most recent observations, sorted by day
+static byte et_nobs = 0;
+static ETBalance et_balance;
+static time_t et_obs_mtime = 0;	// modification time and size of ET_OBS_FILENAME when last read
+static off_t et_obs_size = -1;
+
+/** Parse an observation value ('-' is unknown) */
+static float et_parse_value(const char *s) {
+	if(!s || !*s || (*s=='-' && !s[1])) return NAN;
+	return (float)atof(s);
+}
+
+static void et_print_value(FILE *fp, float v) {
+	if(isnan(v)) fprintf(fp, " -");
+	else fprintf(fp, " %.2f", v);
+}
+
+/** Put an observation in the in-memory list
+ * (replaces the observation of the same day)
+ */
+static void et_insert(const ETObservation *obs) {
+	byte i;
+	for(i=0;i<et_nobs;i++) {
+		if(et_obs[i].day==obs->day) { et_obs[i] = *obs; return; }
+		if(et_obs[i].day>obs->day) break;
+	}
+	if(et_nobs==ET_OBS_DAYS) {
+		if(i==0) return;	// older than every kept observation
+		// drop the oldest observation
+		memmove(et_obs, et_obs+1, (i-1)*sizeof(ETObservation));
+		i--;
+	} else {
+		memmove(et_obs+i+1, et_obs+i, (et_nobs-i)*sizeof(ETObservation));
+		et_nobs++;
+	}
+	et_obs[i] = *obs;
+}
+
+static const ETObservation *et_find(ulong day) {
+	for(byte i=0;i<et_nobs;i++) {
+		if(et_obs[i].day==day) return &et_obs[i];
+	}
+	return NULL;
+}
+
+static void et_balance_save() {
+	FILE *fp = fopen(get_filename_fullpath(ET_BALANCE_FILENAME), "wb");
+	if(!fp) return;
+	fwrite(&et_balance, sizeof(et_balance), 1, fp);
+	fclose(fp);
+}
+
+/** Load the observations of ET_OBS_FILENAME */
+static void et_obs_load() {
+	et_nobs = 0;
+	FILE *fp = fopen(get_filename_fullpath(ET_OBS_FILENAME), "r");
+	if(!fp) return;
+	char line[160];
+	while(fgets(line, sizeof(line), fp)) {
+		char *v[8];
+		byte n = 0;
+		for(char *t=strtok(line, " \t\r\n"); t && n<8; t=strtok(NULL, " \t\r\n")) v[n++] = t;
+		if(n<3 || line[0]=='#') continue;
+		ETObservation obs;
+		obs.day = strtoul(v[0], NULL, 10);
+		obs.tmin = et_parse_value(v[1]);
+		obs.tmax = et_parse_value(v[2]);
+		obs.rhmin = (n>3) ? et_parse_value(v[3]) : NAN;
+		obs.rhmax = (n>4) ? et_parse_value(v[4]) : NAN;
+		obs.wind = (n>5) ? et_parse_value(v[5]) : NAN;
+		obs.solar = (n>6) ? et_parse_value(v[6]) : NAN;
+		obs.rain = (n>7) ? et_parse_value(v[7]) : NAN;
+		if(obs.day) et_insert(&obs);
+	}
+	fclose(fp);
+}
+
+/** Whether ET_OBS_FILENAME has changed since it was last read or
+ * written (e.g. a script has appended observations to it)
+ */
+static bool et_obs_changed() {
+	struct stat st;
+	if(stat(get_filename_fullpath(ET_OBS_FILENAME), &st)) return false;
+	bool changed = (st.st_mtime!=et_obs_mtime || st.st_size!=et_obs_size);
+	et_obs_mtime = st.st_mtime;
+	et_obs_size = st.st_size;
+	return changed;
+}
+
+/** Re-read the observations if ET_OBS_FILENAME has changed
+ * Returns true if they have been re-read
+ */
+bool et_refresh() {
+	if(!et_obs_changed()) return false;
+	et_obs_load();
+	return true;
+}
+
+/** Load observations and the water balance */
+void et_begin() {
+	et_obs_changed();
+	et_obs_load();
+
+	memset(&et_balance, 0, sizeof(et_balance));
+	FILE *fp = fopen(get_filename_fullpath(ET_BALANCE_FILENAME), "rb");
+	if(fp) {
+		if(fread(&et_balance, sizeof(et_balance), 1, fp)!=1) memset(&et_balance, 0, sizeof(et_balance));
+		fclose(fp);
+	}
+}
+
+/** Add the observation of a day
+ * ET_OBS_FILENAME is rewritten with the observations kept in memory
+ * (the last ET_OBS_DAYS days), so it does not grow.
+ */
+bool et_observe(const ETObservation *obs) {
+	if(!obs->day || isnan(obs->tmin) || isnan(obs->tmax) || obs->tmin>obs->tmax) return false;
+	et_refresh();	// keep what a script has appended since
+	et_insert(obs);
+	char path[PATH_MAX], tmp[PATH_MAX+4];
+	strncpy(path, get_filename_fullpath(ET_OBS_FILENAME), PATH_MAX-1);
+	path[PATH_MAX-1] = 0;
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	FILE *fp = fopen(tmp, "w");
+	if(fp) {
+		for(byte i=0;i<et_nobs;i++) {
+			const ETObservation *o = et_obs+i;
+			fprintf(fp, "%lu", o->day);
+			et_print_value(fp, o->tmin);
+			et_print_value(fp, o->tmax);
+			et_print_value(fp, o->rhmin);
+			et_print_value(fp, o->rhmax);
+			et_print_value(fp, o->wind);
+			et_print_value(fp, o->solar);
+			et_print_value(fp, o->rain);
+			fprintf(fp, "\n");
+		}
+		fclose(fp);
+		rename(tmp, path);
+		et_obs_changed();	// written from memory, nothing to re-read
+	}
+	return true;
+}
+
+/** Saturation vapour pressure (kPa) at temperature t (Celsius) */
+static float et_svp(float t) {
+	return 0.6108f*expf(17.27f*t/(t+237.3f));
+}
+
+/** Reference evapotranspiration ET0 (mm/day) of one day
+ * FAO-56 Penman-Monteith if humidity and wind are known,
+ * otherwise Hargreaves. Solar radiation is estimated from the
+ * temperature range if unknown.
+ */
+float et_compute(const ETObservation *obs, float latitude) {
+	// extraterrestrial radiation Ra (MJ/m2/day)
+	CivilDate cd;
+	civil_from_days(obs->day, &cd);
+	int j = obs->day-days_from_civil(cd.year, 1, 1)+1;	// day of the year (1-366)
+	float phi = latitude*(float)M_PI/180;
+	float dr = 1+0.033f*cosf(2*(float)M_PI*j/365);
+	float delta = 0.409f*sinf(2*(float)M_PI*j/365-1.39f);
+	float x = -tanf(phi)*tanf(delta);
+	float ws = acosf(x<-1 ? -1 : (x>1 ? 1 : x));
+	float ra = 24*60/(float)M_PI*ET_SOLAR_CONSTANT*dr*(ws*sinf(phi)*sinf(delta)+cosf(phi)*cosf(delta)*sinf(ws));
+
+	float tmean = (obs->tmin+obs->tmax)/2;
+	float trange = obs->tmax-obs->tmin;
+	if(trange<0) trange = 0;
+	float et0;
+
+	if(isnan(obs->rhmin) || isnan(obs->rhmax) || isnan(obs->wind)) {
+		// Hargreaves
+		et0 = 0.0023f*(tmean+17.8f)*sqrtf(trange)*0.408f*ra;
+	} else {
+		// FAO-56 Penman-Monteith
+		float rs = isnan(obs->solar) ? 0.16f*sqrtf(trange)*ra : obs->solar;
+		float p = 101.3f*powf((293-0.0065f*ET_ELEVATION)/293, 5.26f);
+		float gamma = 0.000665f*p;
+		float d = 4098*et_svp(tmean)/((tmean+237.3f)*(tmean+237.3f));
+		float es = (et_svp(obs->tmax)+et_svp(obs->tmin))/2;
+		float ea = (et_svp(obs->tmin)*obs->rhmax/100+et_svp(obs->tmax)*obs->rhmin/100)/2;
+		float rso = (0.75f+2e-5f*ET_ELEVATION)*ra;
+		float rnl = ET_STEFAN_BOLTZMANN*(powf(obs->tmax+273.16f,4)+powf(obs->tmin+273.16f,4))/2
+							*(0.34f-0.14f*sqrtf(ea>0?ea:0))*(rso>0 ? 1.35f*(rs>rso?rso:rs)/rso-0.35f : 0.3f);
+		float rn = 0.77f*rs-rnl;
+		et0 = (0.408f*d*rn+gamma*900/(tmean+273)*obs->wind*(es-ea))/(d+gamma*(1+0.34f*obs->wind));
+	}
+	return (et0>0) ? et0 : 0;
+}
+
+/** Water percentage from the observations of the last ET_SCALE_DAYS days
+ * Returns -1 if there are no recent observations
+ */
+int et_scale(ulong today, float latitude) {
+	float et = 0, rain = 0;
+	byte n = 0;
+	for(byte i=0;i<et_nobs;i++) {
+		const ETObservation *obs = &et_obs[i];
+		if(obs->day>today || obs->day+ET_SCALE_DAYS<=today) continue;
+		et += et_compute(obs, latitude);
+		if(!isnan(obs->rain)) rain += obs->rain;
+		n++;
+	}
+	if(!n) return -1;
+	float scale = (et-rain)*100/(n*(float)ET_BASE);
+	if(scale<0) scale = 0;
+	if(scale>250) scale = 250;
+	return (int)(scale+0.5f);
+}
+
+/** Add the days completed since the last update to the water balance
+ * Each zone loses ET0 times its crop coefficient kc (in %) and gains
+ * rain, and the depletion stays between 0 (field capacity) and
+ * ET_ZONE_CAPACITY.
+ */
+void et_balance_update(ulong today, float latitude, const byte *kc) {
+	if(et_balance.day+1>=today) return;
+	if(!et_balance.day || et_balance.day+ET_OBS_DAYS<today) {
+		// no balance yet, or too old to catch up with: start from here
+		et_balance.day = today-1;
+		et_balance_save();
+		return;
+	}
+	for(ulong day=et_balance.day+1;day<today;day++) {
+		const ETObservation *obs = et_find(day);
+		if(!obs) continue;
+		float et0 = et_compute(obs, latitude);
+		float rain = isnan(obs->rain) ? 0 : obs->rain;
+		for(byte sid=0;sid<MAX_NUM_STATIONS;sid++) {
+			float v = et_balance.depletion[sid] + et0*kc[sid]/100 - rain;
+			et_balance.depletion[sid] = (v<0) ? 0 : ((v>ET_ZONE_CAPACITY) ? ET_ZONE_CAPACITY : v);
+		}
+	}
+	et_balance.day = today-1;
+	et_balance_save();
+}
+
+/** Add the water applied by a zone run to the water balance */
+void et_watered(byte sid, ulong seconds) {
+	if(sid>=MAX_NUM_STATIONS || !seconds) return;
+	float v = et_balance.depletion[sid] - seconds*(float)ET_PRECIP_RATE/3600;
+	et_balance.depletion[sid] = (v<0) ? 0 : v;
+	et_balance_save();
+}
+
+float et_depletion(byte sid) {
+	return (sid<MAX_NUM_STATIONS) ? et_balance.depletion[sid] : 0;
+}
+
+/** Most recent observation (NULL if none) */
+const ETObservation *et_latest() {
+	return et_nobs ? &et_obs[et_nobs-1] : NULL;
+}
+
+#endif // !ARDUINO
@@ -0,0 +1,87 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Local evapotranspiration (ET0) engine header file
+ * Feb 2015 @ OpenSprinkler.com
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _ET_H
+#define _ET_H
+
+#if !defined(ARDUINO)
+
+#include <math.h>
+#include "defines.h"
+
+/* On RPI/BBB, the water percentage can be computed on the controller
+ * from daily weather observations (weather method WEATHER_METHOD_LOCAL_ET),
+ * instead of by the remote weather script. Observations are supplied
+ * locally, through /eo or by appending lines to et_obs.txt (re-read
+ * when it changes):
+ *   day tmin tmax rhmin rhmax wind solar rain
+ * day is epoch time / 86400, temperatures in Celsius, relative humidity
+ * in %, wind speed (at 2m) in m/s, solar radiation in MJ/m2/day, rain
+ * in mm; unknown values are written as '-'. ET0 is computed with FAO-56
+ * Penman-Monteith if humidity and wind are known, otherwise with Hargreaves.
+ * A soil-moisture water balance is kept per zone in et_balance.dat:
+ * each zone loses its crop coefficient times ET0 every day.
+ */
+#define ET_OBS_FILENAME				"et_obs.txt"
+#define ET_BALANCE_FILENAME		"et_balance.dat"
+#define ET_OBS_DAYS						7			// number of days of observations kept in memory
+
+#ifndef ET_BASE
+#define ET_BASE								6.35	// baseline ET0 (mm/day) that corresponds to 100%
+#endif
+#ifndef ET_SCALE_DAYS
+#define ET_SCALE_DAYS					3			// water percentage is based on the last this many days
+#endif
+#ifndef ET_ELEVATION
+#define ET_ELEVATION					0			// elevation (m) for the psychrometric constant
+#endif
+#ifndef ET_ZONE_CAPACITY
+#define ET_ZONE_CAPACITY			50.0	// soil water capacity of a zone (mm)
+#endif
+#ifndef ET_PRECIP_RATE
+#define ET_PRECIP_RATE				25.0	// water applied by a zone (mm/hour)
+#endif
+
+/** Daily weather observation (NAN: unknown) */
+struct ETObservation {
+	ulong day;
+	float tmin, tmax;		// Celsius
+	float rhmin, rhmax;	// %
+	float wind;					// m/s at 2m
+	float solar;				// MJ/m2/day
+	float rain;					// mm
+};
+
+void  et_begin();
+bool  et_refresh();
+bool  et_observe(const ETObservation *obs);
+float et_compute(const ETObservation *obs, float latitude);
+int   et_scale(ulong today, float latitude);
+void  et_balance_update(ulong today, float latitude, const byte *kc);
+void  et_watered(byte sid, ulong seconds);
+float et_depletion(byte sid);
+const ETObservation *et_latest();
+
+#endif // !ARDUINO
+
+#endif // _ET_H
@@ -35,16 +35,26 @@
 #include <sys/ioctl.h>
 #include <netinet/in.h>
 #include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <time.h>
 #include <errno.h>
 #include "defines.h"
 
+#ifndef MSG_MORE
+#define MSG_MORE 0
+#endif
+
 EthernetServer::EthernetServer(uint16_t port)
 		: m_port(port), m_sock(0)
 {
+	memset(m_idle, 0, sizeof(m_idle));
 }
 
 EthernetServer::~EthernetServer()
 {
+	for (int i = 0; i < ETHER_KEEPALIVE_MAX; i++)
+		if (m_idle[i]) close(m_idle[i]);
 	close(m_sock);
 }
 
@@ -90,7 +100,8 @@ bool EthernetServer::begin()
 	return true;
 }
 
-//	This function blocks until we get a client connected.
+//	This function blocks until we get a client connected,
+//	 or an idle keep-alive connection sends a new request.
 //	 It will timeout after 50ms and return a blank client.
 //	 If it succeeds it will return an EthernetClient.
 EthernetClient EthernetServer::available()
@@ -98,11 +109,35 @@ EthernetClient EthernetServer::available()
 	fd_set sock_set;
 	FD_ZERO(&sock_set);
 	FD_SET(m_sock, &sock_set);
+	int maxfd = m_sock;
+	time_t now = time(NULL);
+	for (int i = 0; i < ETHER_KEEPALIVE_MAX; i++)
+	{
+		if (!m_idle[i]) continue;
+		if (now - m_idle_time[i] > ETHER_KEEPALIVE_TIMEOUT)
+		{
+			close(m_idle[i]);
+			m_idle[i] = 0;
+			continue;
+		}
+		FD_SET(m_idle[i], &sock_set);
+		if (m_idle[i] > maxfd) maxfd = m_idle[i];
+	}
 	struct timeval timeout;
 	timeout.tv_sec = 0;
 	timeout.tv_usec = 50 * 1000; // 50ms
 
-	select(m_sock + 1, &sock_set, NULL, NULL, &timeout);
+	select(maxfd + 1, &sock_set, NULL, NULL, &timeout);
+	for (int i = 0; i < ETHER_KEEPALIVE_MAX; i++)
+	{
+		if (m_idle[i] && FD_ISSET(m_idle[i], &sock_set))
+		{
+			// new request (or close) on a keep-alive connection
+			int client_sock = m_idle[i];
+			m_idle[i] = 0;
+			return EthernetClient(client_sock);
+		}
+	}
 	if (FD_ISSET(m_sock, &sock_set))
 	{
 		int client_sock = 0;
@@ -115,19 +150,80 @@ EthernetClient EthernetServer::available()
 	return EthernetClient(0);
 }
 
+//	Keep a client connection open after its response is sent,
+//	 to wait for its next request
+void EthernetServer::keep(EthernetClient &client)
+{
+	if (!client.m_sock || !client.m_kept) return;
+	int oldest = 0;
+	for (int i = 0; i < ETHER_KEEPALIVE_MAX; i++)
+	{
+		if (!m_idle[i]) { oldest = i; break; }
+		if (m_idle_time[i] < m_idle_time[oldest]) oldest = i;
+	}
+	if (m_idle[oldest]) close(m_idle[oldest]);
+	m_idle[oldest] = client.m_sock;
+	m_idle_time[oldest] = time(NULL);
+	client.m_sock = 0;
+	client.m_connected = false;
+}
+
 EthernetClient::EthernetClient()
-		: m_sock(0), m_connected(false)
+		: m_sock(0), m_connected(false), m_keepalive(false), m_kept(false),
+			m_out(NULL), m_outlen(0), m_outsize(0)
 {
 }
 
 EthernetClient::EthernetClient(int sock)
-		: m_sock(sock), m_connected(true)
+		: m_sock(sock), m_connected(true), m_keepalive(false), m_kept(false),
+			m_out(NULL), m_outlen(0), m_outsize(0)
 {
 }
 
 EthernetClient::~EthernetClient()
 {
+	if (m_keepalive && !m_kept) send_response();
+	m_keepalive = false;
 	stop();
+	free(m_out);
+}
+
+//	Buffer the response, so it can be sent with a content length
+//	 and the connection can stay open for the next request
+//	 (up to ETHER_KEEPALIVE_BUFFER bytes, see write())
+void EthernetClient::keepalive()
+{
+	m_keepalive = true;
+	m_kept = false;
+	m_outlen = 0;
+}
+
+//	Send the buffered response, with a content length header
+//	 instead of "Connection: close"
+void EthernetClient::send_response()
+{
+	static const char close_hdr[] = "Connection: close\r\n";
+	char *body = m_out ? (char*)memmem(m_out, m_outlen, "\r\n\r\n", 4) : NULL;
+	if (!body)
+	{
+		// no header: send as is, and close
+		if (m_outlen) ::send(m_sock, m_out, m_outlen, MSG_NOSIGNAL);
+		return;
+	}
+	body += 2;	// keep the end of the last header line
+	char *close_line = (char*)memmem(m_out, body-m_out, close_hdr, strlen(close_hdr));
+	char hdr[64];
+	int hlen = snprintf(hdr, sizeof(hdr), "Connection: keep-alive\r\nContent-Length: %u\r\n", (unsigned)(m_out+m_outlen-body-2));
+	if (close_line)
+	{
+		::send(m_sock, m_out, close_line-m_out, MSG_NOSIGNAL|MSG_MORE);
+		::send(m_sock, close_line+strlen(close_hdr), body-close_line-strlen(close_hdr), MSG_NOSIGNAL|MSG_MORE);
+	}
+	else
+		::send(m_sock, m_out, body-m_out, MSG_NOSIGNAL|MSG_MORE);
+	::send(m_sock, hdr, hlen, MSG_NOSIGNAL|MSG_MORE);
+	::send(m_sock, body, m_out+m_outlen-body, MSG_NOSIGNAL);
+	m_kept = true;
 }
 
 int EthernetClient::connect(uint8_t ip[4], uint16_t port)
@@ -138,8 +234,15 @@ int EthernetClient::connect(uint8_t ip[4], uint16_t port)
 	sin.sin_family = AF_INET;
 	sin.sin_port = htons(port);
 	sin.sin_addr.s_addr = *(uint32_t*) (ip);
-	m_sock = socket(AF_INET, SOCK_STREAM, 0);
-	if (::connect(m_sock, (struct sockaddr *) &sin, sizeof(sin)) < 0)
+	return connect((struct sockaddr *) &sin, sizeof(sin));
+}
+
+int EthernetClient::connect(const struct sockaddr *addr, socklen_t addrlen)
+{
+	if (m_sock)
+		return 0;
+	m_sock = socket(addr->sa_family, SOCK_STREAM, 0);
+	if (::connect(m_sock, addr, addrlen) < 0)
 	{
 		DEBUG_PRINTLN("error connecting to server");
 		return 0;
@@ -160,6 +263,11 @@ bool EthernetClient::connected()
 
 void EthernetClient::stop()
 {
+	if (m_keepalive && !m_kept)
+	{
+		send_response();
+		if (m_kept) return;
+	}
 	if (m_sock)
 	{
 		close(m_sock);
@@ -200,6 +308,29 @@ int EthernetClient::read(uint8_t *buf, size_t size)
 
 size_t EthernetClient::write(const uint8_t *buf, size_t size)
 {
+	if (m_keepalive && !m_kept && m_outlen + size > ETHER_KEEPALIVE_BUFFER)
+	{
+		// too large to buffer (e.g. a log export): send what is buffered
+		// as is, with its "Connection: close", and the rest directly
+		m_keepalive = false;
+		if (m_outlen) ::send(m_sock, m_out, m_outlen, MSG_NOSIGNAL|MSG_MORE);
+		m_outlen = 0;
+	}
+	if (m_keepalive && !m_kept)
+	{
+		if (m_outlen + size > m_outsize)
+		{
+			size_t n = (m_outlen + size) * 2;
+			if (n > ETHER_KEEPALIVE_BUFFER) n = ETHER_KEEPALIVE_BUFFER;
+			char *p = (char*)realloc(m_out, n);
+			if (!p) return 0;
+			m_out = p;
+			m_outsize = n;
+		}
+		memcpy(m_out + m_outlen, buf, size);
+		m_outlen += size;
+		return size;
+	}
 	return ::send(m_sock, buf, size, MSG_NOSIGNAL);
 }
 
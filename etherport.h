@@ -32,11 +32,19 @@
 #include <stdio.h>
 #include <inttypes.h>
 #include <ctype.h>
+#include <time.h>
+#include <sys/socket.h>
 
 #ifdef __APPLE__
 #define MSG_NOSIGNAL SO_NOSIGPIPE
 #endif
 
+#define ETHER_KEEPALIVE_MAX			4			// maximum number of idle keep-alive connections
+#define ETHER_KEEPALIVE_TIMEOUT	10		// idle keep-alive connections are closed after this many seconds
+#ifndef ETHER_KEEPALIVE_BUFFER
+#define ETHER_KEEPALIVE_BUFFER	4096	// larger responses are sent as they are written, and the connection is closed
+#endif
+
 class EthernetServer;
 
 class EthernetClient {
@@ -45,18 +53,27 @@ public:
 	EthernetClient(int sock);
 	~EthernetClient();
 	int connect(uint8_t ip[4], uint16_t port);
+	int connect(const struct sockaddr *addr, socklen_t addrlen);
 	bool connected();
 	void stop();
 	int read(uint8_t *buf, size_t size);
 	size_t write(const uint8_t *buf, size_t size);
+	void keepalive();
+	bool kept() { return m_kept; }
 	operator bool();
 	int GetSocket()
 	{
 		return m_sock;
 	}
 private:
+	void send_response();
 	int m_sock;
 	bool m_connected;
+	bool m_keepalive;	// response is buffered, and sent with a content length
+	bool m_kept;			// response is sent, connection stays open
+	char *m_out;
+	size_t m_outlen;
+	size_t m_outsize;
 	friend class EthernetServer;
 };
 
@@ -67,9 +84,12 @@ public:
 
 	bool begin();
 	EthernetClient available();
+	void keep(EthernetClient &client);
 private:
 	uint16_t m_port;
 	int m_sock;
+	int m_idle[ETHER_KEEPALIVE_MAX];				// idle keep-alive connections
+	time_t m_idle_time[ETHER_KEEPALIVE_MAX];
 };
 #endif
 
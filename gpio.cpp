@@ -165,6 +165,14 @@ byte digitalReadExt(byte pin) {
 #include <string.h>
 #include <poll.h>
 #include <pthread.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <errno.h>
+#if defined(__has_include)
+	#if __has_include(<linux/gpio.h>)
+		#include <linux/gpio.h>
+	#endif
+#endif
 
 #define BUFFER_MAX 64
 #define GPIO_MAX	 64
@@ -177,6 +185,9 @@ static int sysFds[GPIO_MAX] = {
 	-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
 } ;
 
+// GPIO character device line event file descriptors
+static int edgeFds[GPIO_MAX];
+
 // Interrupt service routine functions
 static void (*isrFunctions [GPIO_MAX])(void);
 
@@ -234,8 +245,170 @@ static byte GPIOSetEdge(int pin, const char *edge) {
 	return 1;
 }
 
-/** Set pin mode, in or out */
-void pinMode(int pin, byte mode) {
+/** Get the gpio chip and line offset of a pin
+ * On RPI, pins are BCM numbers, i.e. lines of the first chip
+ * On BBB, pins are numbered 32 per chip
+ */
+static void gpio_chip_line(int pin, int *chip, int *line) {
+#if defined(OSBO)
+	*chip = pin/32;
+	*line = pin%32;
+#else
+	*chip = 0;
+	*line = pin;
+#endif
+}
+
+/** Unexport gpio pin if it is exported */
+static void gpio_sysfs_release(int pin) {
+	char path[BUFFER_MAX];
+	struct stat st;
+	if(sysFds[pin]!=-1) {
+		close(sysFds[pin]);
+		sysFds[pin] = -1;
+	}
+	snprintf(path, BUFFER_MAX, "/sys/class/gpio/gpio%d", pin);
+	if(!stat(path, &st)) GPIOUnexport(pin);
+}
+
+/* GPIO character device backend
+ * If /dev/gpiochipN is available, pins are requested as line handles
+ * which are kept open, so reading or writing a pin takes a single
+ * ioctl, instead of opening, writing and closing its sysfs value file.
+ * Pins that change together (e.g. the shift register pins) can be
+ * requested as one multi-line handle with gpio_lines_open(), and set
+ * together with gpio_lines_write(). If the character device is not
+ * available, pins are accessed through sysfs.
+ * On RPI, gpio_lines_write() writes the gpio registers directly
+ * through /dev/gpiomem if it is available (see gpiomem_open()).
+ */
+#define GPIO_CHIP_MAX		((GPIO_MAX+31)/32)
+
+#define GPIO_LINES_SYSFS		0
+#define GPIO_LINES_CHARDEV	1
+#define GPIO_LINES_GPIOMEM	2
+
+struct GPIOLines {
+	byte backend;	// GPIO_LINES_xxx
+	int  fd;			// line handle (character device only)
+	byte mode;
+	byte n;
+	byte pins[GPIO_LINES_MAX];
+#if defined(GPIO_GET_LINEHANDLE_IOCTL)
+	struct gpiohandle_data data;	// current values
+#endif
+};
+
+#if defined(GPIO_GET_LINEHANDLE_IOCTL)
+static int chipFds[GPIO_CHIP_MAX];				// 0: not opened yet; -1: not available
+static GPIOLines *pinLines[GPIO_MAX];			// line handle owning each pin
+static byte pinLineIdx[GPIO_MAX];					// index of each pin in its line handle
+static int pinLineFds[GPIO_MAX];					// file descriptor of each pin from gpio_fd_open (0: none)
+
+/** Open gpio chip character device */
+static int gpio_chip_open(int chip) {
+	if(chip<0 || chip>=GPIO_CHIP_MAX) return -1;
+	if(!chipFds[chip]) {
+		char path[BUFFER_MAX];
+		snprintf(path, BUFFER_MAX, "/dev/gpiochip%d", chip);
+		chipFds[chip] = open(path, O_RDWR);
+	}
+	return chipFds[chip];
+}
+
+/** Release the line handle owning a pin */
+static void gpio_line_release(int pin) {
+	GPIOLines *lines = pinLines[pin];
+	if(!lines) return;
+	for(byte i=0;i<lines->n;i++) {
+		byte p = lines->pins[i];
+		pinLines[p] = NULL;
+		if(pinLineFds[p]>0) {
+			close(pinLineFds[p]);
+			pinLineFds[p] = 0;
+		}
+	}
+	close(lines->fd);
+	free(lines);
+}
+
+/** Request a line handle for pins of the same gpio chip
+ * Returns NULL if the character device is not available
+ */
+static GPIOLines *gpio_lines_request(const byte *pins, byte n, byte mode) {
+	struct gpiohandle_request req;
+	int chip = -1, line, c;
+	byte i;
+
+	if(n==0 || n>GPIO_LINES_MAX) return NULL;
+	memset(&req, 0, sizeof(req));
+	for(i=0;i<n;i++) {
+		if(pins[i]>=GPIO_MAX) return NULL;
+		gpio_chip_line(pins[i], &c, &line);
+		if(i && c!=chip) return NULL;
+		chip = c;
+		req.lineoffsets[i] = line;
+		// keep the current value of output pins
+		if(pinLines[pins[i]]) req.default_values[i] = pinLines[pins[i]]->data.values[pinLineIdx[pins[i]]];
+	}
+	int cfd = gpio_chip_open(chip);
+	if(cfd<0) return NULL;
+
+	// a line can only have one owner
+	for(i=0;i<n;i++) {
+		gpio_line_release(pins[i]);
+		gpio_sysfs_release(pins[i]);
+	}
+
+	req.lines = n;
+	req.flags = (mode==OUTPUT) ? GPIOHANDLE_REQUEST_OUTPUT : GPIOHANDLE_REQUEST_INPUT;
+#if defined(OSPI) && defined(GPIOHANDLE_REQUEST_BIAS_PULL_UP)
+	if(mode==INPUT_PULLUP) req.flags |= GPIOHANDLE_REQUEST_BIAS_PULL_UP;
+#elif defined(OSPI)
+	if(mode==INPUT_PULLUP) {
+		char cmd[BUFFER_MAX];
+		snprintf(cmd, BUFFER_MAX, "gpio -g mode %d up", pins[0]);
+		system(cmd);
+	}
+#endif
+	strcpy(req.consumer_label, "OpenSprinkler");
+	if(ioctl(cfd, GPIO_GET_LINEHANDLE_IOCTL, &req) < 0) {
+		DEBUG_PRINTLN("failed to request gpio lines");
+		return NULL;
+	}
+
+	GPIOLines *lines = (GPIOLines*)calloc(1, sizeof(GPIOLines));
+	if(!lines) {
+		close(req.fd);
+		return NULL;
+	}
+	lines->backend = GPIO_LINES_CHARDEV;
+	lines->fd = req.fd;
+	lines->mode = mode;
+	lines->n = n;
+	for(i=0;i<n;i++) {
+		lines->pins[i] = pins[i];
+		lines->data.values[i] = req.default_values[i];
+		pinLines[pins[i]] = lines;
+		pinLineIdx[pins[i]] = i;
+	}
+	return lines;
+}
+
+/** Get the pin of a file descriptor from gpio_fd_open
+ * Returns -1 if the pin is not accessed through the character device
+ */
+static int gpio_fd_pin(int fd) {
+	if(fd<=0) return -1;
+	for(int pin=0;pin<GPIO_MAX;pin++) {
+		if(pinLineFds[pin]==fd && pinLines[pin]) return pin;
+	}
+	return -1;
+}
+#endif
+
+/** Set pin mode through sysfs */
+static void gpio_sysfs_mode(int pin, byte mode) {
 	static const char dir_str[]  = "in\0out";
 
 	char path[BUFFER_MAX];
@@ -270,8 +443,197 @@ void pinMode(int pin, byte mode) {
 	return;
 }
 
-/** Open file for digital pin */
+/** Set pin mode, in or out */
+void pinMode(int pin, byte mode) {
+	if((pin<0)||(pin>=GPIO_MAX)) return;
+	// pins requested for edge events are owned by the character device
+	if(edgeFds[pin]>0) return;
+#if defined(GPIO_GET_LINEHANDLE_IOCTL)
+	if(pinLines[pin] && pinLines[pin]->mode==mode) return;
+	byte p = pin;
+	if(gpio_lines_request(&p, 1, mode)) return;
+#endif
+	gpio_sysfs_mode(pin, mode);
+}
+
+#if defined(OSPI)
+/* Memory-mapped gpio registers
+ * /dev/gpiomem maps the BCM283x gpio registers (bank 0 covers the
+ * header pins), so that pins requested with gpio_lines_open() are set
+ * and cleared with direct register writes instead of system calls.
+ * gpiomem_attach() can substitute any register file, e.g. an
+ * in-memory one for testing. The registers are only used if the
+ * device tree lists a SoC with this register layout: not on RPi 5,
+ * whose gpio registers are on the RP1 chip, nor on other boards. The
+ * character device is used instead.
+ */
+#define GPIOMEM_COMPATIBLE	"/proc/device-tree/compatible"
+#define GPIOMEM_SIZE		0xB4
+#define GPIOMEM_GPFSEL0	0			// function select registers (word offsets)
+#define GPIOMEM_GPSET0	7			// output set register
+#define GPIOMEM_GPCLR0	10		// output clear register
+#define GPIOMEM_GPLEV0	13		// pin level register
+
+static volatile uint32_t *gpioRegs = NULL;
+
+/** Check if the SoC has the BCM283x gpio register layout
+ * path: device tree compatible list (NUL-separated strings)
+ */
+bool gpiomem_compatible(const char *path) {
+	static const char socs[] = "brcm,bcm2835\0brcm,bcm2836\0brcm,bcm2837\0brcm,bcm2711\0";
+	char buf[256];
+	int fd = open(path, O_RDONLY);
+	if(fd<0) return false;
+	int len = read(fd, buf, sizeof(buf)-1);
+	close(fd);
+	if(len<=0) return false;
+	buf[len] = 0;
+	for(int i=0;i<len;i+=strlen(buf+i)+1) {
+		for(const char *soc=socs;*soc;soc+=strlen(soc)+1) {
+			if(!strcmp(buf+i, soc)) return true;
+		}
+	}
+	return false;
+}
+
+/** Map the gpio registers
+ * Returns false if /dev/gpiomem is not available, or is not
+ * known to have the BCM283x register layout
+ */
+bool gpiomem_open() {
+#if defined(GPIOMEM_DISABLE)
+	return false;
+#else
+	static bool tried = false;
+	if(gpioRegs) return true;
+	if(tried) return false;
+	tried = true;
+	if(!gpiomem_compatible(GPIOMEM_COMPATIBLE)) return false;
+	int fd = open("/dev/gpiomem", O_RDWR|O_SYNC);
+	if(fd<0) return false;
+	void *map = mmap(NULL, GPIOMEM_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);	// the mapping stays valid
+	if(map==MAP_FAILED) {
+		DEBUG_PRINTLN("failed to map gpio registers");
+		return false;
+	}
+	gpioRegs = (volatile uint32_t*)map;
+	return true;
+#endif
+}
+
+/** Use the given gpio register file */
+void gpiomem_attach(volatile uint32_t *regs) {
+	gpioRegs = regs;
+}
+
+/** Request pins to be set through the gpio registers
+ * Returns NULL if the registers are not available
+ */
+static GPIOLines *gpiomem_lines_open(const byte *pins, byte n) {
+	if(!gpiomem_open()) return NULL;
+	byte i;
+	for(i=0;i<n;i++) {
+		if(pins[i]>=32) return NULL;	// bank 0 only
+	}
+	GPIOLines *lines = (GPIOLines*)calloc(1, sizeof(GPIOLines));
+	if(!lines) return NULL;
+	lines->backend = GPIO_LINES_GPIOMEM;
+	lines->fd = -1;
+	lines->mode = OUTPUT;
+	lines->n = n;
+	for(i=0;i<n;i++) {
+		byte pin = pins[i];
+		lines->pins[i] = pin;
+		// set function to output (001)
+		volatile uint32_t *fsel = gpioRegs + GPIOMEM_GPFSEL0 + pin/10;
+		*fsel = (*fsel & ~(7<<((pin%10)*3))) | (1<<((pin%10)*3));
+	}
+	return lines;
+}
+
+/** Set pins through the gpio registers */
+static void gpiomem_lines_write(GPIOLines *lines, const byte *values) {
+	uint32_t set = 0, clr = 0;
+	for(byte i=0;i<lines->n;i++) {
+		if(values[i]) set |= (1<<lines->pins[i]);
+		else clr |= (1<<lines->pins[i]);
+	}
+	// clear first, so that clock low and data change happen before clock high
+	if(clr) gpioRegs[GPIOMEM_GPCLR0] = clr;
+	if(set) gpioRegs[GPIOMEM_GPSET0] = set;
+	// read back, so the write has reached the pins before the next one
+	(void)gpioRegs[GPIOMEM_GPLEV0];
+}
+#endif
+
+/** Request pins (of the same gpio chip) to be set together
+ * Pins are set to output mode
+ */
+GPIOLines *gpio_lines_open(const byte *pins, byte n) {
+	if(n==0 || n>GPIO_LINES_MAX) return NULL;
+	GPIOLines *lines = NULL;
+#if defined(OSPI)
+	lines = gpiomem_lines_open(pins, n);
+	if(lines) return lines;
+#endif
+#if defined(GPIO_GET_LINEHANDLE_IOCTL)
+	bool owned = true;	// check if the pins are already requested together
+	for(byte i=0;i<n;i++) {
+		if(!pinLines[pins[i]] || pinLines[pins[i]]!=pinLines[pins[0]] || pinLineIdx[pins[i]]!=i) owned = false;
+	}
+	if(owned && pinLines[pins[0]]->n==n) return pinLines[pins[0]];
+	lines = gpio_lines_request(pins, n, OUTPUT);
+	if(lines) return lines;
+#endif
+	// fall back to sysfs
+	lines = (GPIOLines*)calloc(1, sizeof(GPIOLines));
+	if(!lines) return NULL;
+	lines->backend = GPIO_LINES_SYSFS;
+	lines->fd = -1;
+	lines->mode = OUTPUT;
+	lines->n = n;
+	for(byte i=0;i<n;i++) {
+		lines->pins[i] = pins[i];
+		gpio_sysfs_mode(pins[i], OUTPUT);
+	}
+	return lines;
+}
+
+/** Set the values of pins requested with gpio_lines_open */
+void gpio_lines_write(GPIOLines *lines, const byte *values) {
+	if(!lines) return;
+#if defined(OSPI)
+	if(lines->backend==GPIO_LINES_GPIOMEM) {
+		gpiomem_lines_write(lines, values);
+		return;
+	}
+#endif
+#if defined(GPIO_GET_LINEHANDLE_IOCTL)
+	if(lines->backend==GPIO_LINES_CHARDEV) {
+		memcpy(lines->data.values, values, lines->n);
+		if(ioctl(lines->fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &lines->data) < 0) {
+			DEBUG_PRINTLN("failed to set gpio lines");
+		}
+		return;
+	}
+#endif
+	for(byte i=0;i<lines->n;i++) digitalWrite(lines->pins[i], values[i]);
+}
+
+/** Open file for digital pin
+ * If the pin is accessed through the character device, this is
+ * a duplicate of its line handle, kept open for the pin, so that
+ * gpio_write() knows which line of the handle to set
+ */
 int gpio_fd_open(int pin, int mode) {
+#if defined(GPIO_GET_LINEHANDLE_IOCTL)
+	if(pin>=0 && pin<GPIO_MAX && pinLines[pin]) {
+		if(pinLineFds[pin]<=0) pinLineFds[pin] = dup(pinLines[pin]->fd);
+		if(pinLineFds[pin]>0) return pinLineFds[pin];
+		pinLineFds[pin] = 0;
+	}
+#endif
 	char path[BUFFER_MAX];
 	int fd;
 
@@ -286,11 +648,29 @@ int gpio_fd_open(int pin, int mode) {
 
 /** Close file */
 void gpio_fd_close(int fd) {
+#if defined(GPIO_GET_LINEHANDLE_IOCTL)
+	if(gpio_fd_pin(fd)>=0) return;	// line handles are kept open
+#endif
 	close(fd);
 }
 
 /** Read digital value */
 byte digitalRead(int pin) {
+#if defined(GPIO_GET_LINEHANDLE_IOCTL)
+	if(pin>=0 && pin<GPIO_MAX) {
+		struct gpiohandle_data data;
+		// pins requested for edge events are read through the event line
+		if(edgeFds[pin]>0) {
+			if(ioctl(edgeFds[pin], GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data) < 0) return 0;
+			return data.values[0];
+		}
+		GPIOLines *lines = pinLines[pin];
+		if(lines) {
+			if(ioctl(lines->fd, GPIOHANDLE_GET_LINE_VALUES_IOCTL, &data) < 0) return 0;
+			return data.values[pinLineIdx[pin]];
+		}
+	}
+#endif
 	char value_str[3];
 
 	int fd = gpio_fd_open(pin, O_RDONLY);
@@ -311,6 +691,14 @@ byte digitalRead(int pin) {
 void gpio_write(int fd, byte value) {
 	static const char value_str[] = "01";
 
+#if defined(GPIO_GET_LINEHANDLE_IOCTL)
+	int pin = gpio_fd_pin(fd);
+	if(pin>=0) {
+		digitalWrite(pin, value);
+		return;
+	}
+#endif
+
 	if (1 != write(fd, &value_str[LOW==value?0:1], 1)) {
 		DEBUG_PRINT("failed to write value on pin ");
 	}
@@ -318,6 +706,16 @@ void gpio_write(int fd, byte value) {
 
 /** Write digital value */
 void digitalWrite(int pin, byte value) {
+#if defined(GPIO_GET_LINEHANDLE_IOCTL)
+	if(pin>=0 && pin<GPIO_MAX && pinLines[pin]) {
+		GPIOLines *lines = pinLines[pin];
+		lines->data.values[pinLineIdx[pin]] = value;
+		if(ioctl(lines->fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &lines->data) < 0) {
+			DEBUG_PRINTLN("failed to set gpio line");
+		}
+		return;
+	}
+#endif
 	int fd = gpio_fd_open(pin);
 	if (fd < 0) {
 		return;
@@ -419,12 +817,301 @@ void attachInterrupt(int pin, const char* mode, void (*isr)(void)) {
 			delay(1) ;
 	pthread_mutex_unlock (&pinMutex) ;
 }
+
+/* Edge events
+ * A high priority thread per pin waits for edges, and queues
+ * their timestamps (in microseconds) in a single-producer,
+ * single-consumer lock-free ring buffer, which the main loop drains
+ * with readEdgeEvent(). Edges are taken from the GPIO character
+ * device, where the kernel queues and timestamps them, or from sysfs
+ * edge polling if the character device is not available.
+ */
+#define EDGE_RING_SIZE	256		// must be a power of 2
+
+struct EdgeRing {
+	uint32_t head;	// written by the edge thread only
+	uint32_t tail;	// written by the main loop only
+	uint32_t dropped;	// edges lost because the ring was full, reset by readEdgeDropped()
+	ulong ts[EDGE_RING_SIZE];
+};
+
+static EdgeRing *edgeRings[GPIO_MAX];
+
+static void edge_push(EdgeRing *ring, ulong ts) {
+	uint32_t head = ring->head;
+	if(head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= EDGE_RING_SIZE) {
+		__atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
+	ring->ts[head & (EDGE_RING_SIZE-1)] = ts;
+	__atomic_store_n(&ring->head, head+1, __ATOMIC_RELEASE);
+}
+
+static void *edgeHandler (void *arg) {
+	int pin = (int)(intptr_t)arg;
+	EdgeRing *ring = edgeRings[pin];
+
+	(void) HiPri (55) ;  // Only effective if we run as root
+
+	for (;;) {
+#if defined(GPIO_GET_LINEEVENT_IOCTL)
+		if (edgeFds[pin] > 0) {
+			struct gpioevent_data ev;
+			if (read(edgeFds[pin], &ev, sizeof(ev)) == sizeof(ev))
+				edge_push(ring, (ulong)(ev.timestamp/1000));
+			continue;
+		}
+#endif
+		if (waitForInterrupt (pin, -1) > 0)
+			edge_push(ring, micros());
+	}
+	return NULL;
+}
+
+/** Queue the timestamps of edges on a pin
+ * mode can be any of 'rising', 'falling', 'both'
+ * Returns false if edge events are not available for the pin
+ */
+bool attachEdgeEvents(int pin, const char* mode) {
+	if((pin<0)||(pin>=GPIO_MAX)) return false;
+	if(edgeRings[pin]) return true;
+	EdgeRing *ring = (EdgeRing*)calloc(1, sizeof(EdgeRing));
+	if(!ring) return false;
+
+	char path[BUFFER_MAX];
+#if defined(GPIO_GET_LINEEVENT_IOCTL)
+	int chip, line;
+	gpio_chip_line(pin, &chip, &line);
+	int cfd = gpio_chip_open(chip);
+	if(cfd >= 0) {
+		// a line can only have one owner
+		gpio_line_release(pin);
+		gpio_sysfs_release(pin);
+
+		struct gpioevent_request req;
+		memset(&req, 0, sizeof(req));
+		req.lineoffset = line;
+		req.handleflags = GPIOHANDLE_REQUEST_INPUT;
+#if defined(GPIOHANDLE_REQUEST_BIAS_PULL_UP)
+		req.handleflags |= GPIOHANDLE_REQUEST_BIAS_PULL_UP;
+#endif
+		if(!strcmp(mode, "rising")) req.eventflags = GPIOEVENT_REQUEST_RISING_EDGE;
+		else if(!strcmp(mode, "falling")) req.eventflags = GPIOEVENT_REQUEST_FALLING_EDGE;
+		else req.eventflags = GPIOEVENT_REQUEST_BOTH_EDGES;
+		strcpy(req.consumer_label, "OpenSprinkler");
+		if(ioctl(cfd, GPIO_GET_LINEEVENT_IOCTL, &req) >= 0) {
+			edgeFds[pin] = req.fd;
+		} else {
+			DEBUG_PRINTLN("failed to request gpio line events");
+		}
+	}
+	if(edgeFds[pin] <= 0)
+#endif
+	{
+		// fall back to sysfs edge polling
+#if defined(GPIO_GET_LINEHANDLE_IOCTL)
+		gpio_line_release(pin);
+#endif
+		gpio_sysfs_mode(pin, INPUT);
+		GPIOSetEdge(pin, mode);
+		snprintf(path, BUFFER_MAX, "/sys/class/gpio/gpio%d/value", pin);
+		if(sysFds[pin]==-1 && (sysFds[pin]=open(path, O_RDWR))<0) {
+			DEBUG_PRINTLN("failed to open gpio value for reading");
+			free(ring);
+			return false;
+		}
+		char c;
+		(void)read(sysFds[pin], &c, 1);
+		lseek(sysFds[pin], 0, SEEK_SET);
+	}
+
+	edgeRings[pin] = ring;
+	pthread_t threadId;
+	if(pthread_create(&threadId, NULL, edgeHandler, (void*)(intptr_t)pin)) {
+		edgeRings[pin] = NULL;
+		free(ring);
+		return false;
+	}
+	pthread_detach(threadId);
+	return true;
+}
+
+/** Get the timestamp (in microseconds) of the next queued edge
+ * Returns false if there is none
+ */
+bool readEdgeEvent(int pin, ulong *ts) {
+	if((pin<0)||(pin>=GPIO_MAX)||!edgeRings[pin]) return false;
+	EdgeRing *ring = edgeRings[pin];
+	uint32_t tail = ring->tail;
+	if(tail == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) return false;
+	*ts = ring->ts[tail & (EDGE_RING_SIZE-1)];
+	__atomic_store_n(&ring->tail, tail+1, __ATOMIC_RELEASE);
+	return true;
+}
+
+/** Get the number of edges dropped because the queue was full,
+ * since the last call
+ */
+ulong readEdgeDropped(int pin) {
+	if((pin<0)||(pin>=GPIO_MAX)||!edgeRings[pin]) return 0;
+	return __atomic_exchange_n(&edgeRings[pin]->dropped, 0, __ATOMIC_RELAXED);
+}
+
+/* Pulse trains
+ * Waveforms (e.g. RF codes) are queued as arrays of pulse durations,
+ * and sent out by a high priority thread, so the main loop does not
+ * block while they are transmitted. Each edge has an absolute
+ * deadline, so timing errors do not accumulate: the thread sleeps
+ * until shortly before the deadline, then spins for the rest.
+ */
+#define PULSE_QUEUE_SIZE	16			// number of queued pulse trains
+#define PULSE_SPIN_NS			100000	// spin (instead of sleep) for the last 100us before an edge
+
+struct PulseTrain {
+	int fd;				// opened for the pulse thread by gpio_pulses_queue(), closed after the train
+	bool line;		// fd is a line handle of the pin alone, otherwise a sysfs value file
+	byte repeat;
+	uint16_t n;
+	ulong us[GPIO_PULSES_MAX];
+};
+
+static PulseTrain pulseQueue[PULSE_QUEUE_SIZE];
+static byte pulseHead = 0;
+static byte pulseCount = 0;
+static bool pulseRunning = false;
+static pthread_mutex_t pulseLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pulseCond = PTHREAD_COND_INITIALIZER;		// signaled when a pulse train is queued
+static pthread_cond_t pulseSpace = PTHREAD_COND_INITIALIZER;	// signaled when a pulse train is sent
+static pthread_once_t pulseOnce = PTHREAD_ONCE_INIT;
+
+static int64_t monotonic_ns() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (int64_t)t.tv_sec*1000000000LL + t.tv_nsec;
+}
+
+static void sleep_until_ns(int64_t deadline) {
+	int64_t wake = deadline - PULSE_SPIN_NS;
+	if(wake > monotonic_ns()) {
+		struct timespec t;
+		t.tv_sec = wake/1000000000LL;
+		t.tv_nsec = wake%1000000000LL;
+		while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL)==EINTR);
+	}
+	while(monotonic_ns() < deadline);
+}
+
+static void pulse_write(PulseTrain *p, byte value) {
+#if defined(GPIO_GET_LINEHANDLE_IOCTL)
+	if (p->line) {
+		struct gpiohandle_data data;
+		memset(&data, 0, sizeof(data));
+		data.values[0] = value;
+		ioctl(p->fd, GPIOHANDLE_SET_LINE_VALUES_IOCTL, &data);
+		return;
+	}
+#endif
+	(void)write(p->fd, (value==LOW) ? "0" : "1", 1);
+}
+
+static void *pulseHandler (void *arg) {
+	(void) HiPri (60) ;  // Only effective if we run as root
+
+	for (;;) {
+		pthread_mutex_lock(&pulseLock);
+		while(!pulseCount) pthread_cond_wait(&pulseCond, &pulseLock);
+		PulseTrain *p = &pulseQueue[pulseHead];	// stays reserved until sent
+		pthread_mutex_unlock(&pulseLock);
+
+		// only the train's own file descriptor is used here: the line tables
+		// belong to the main thread
+		int64_t deadline = monotonic_ns();
+		for (byte r=0; r<p->repeat; r++) {
+			for (uint16_t i=0; i<p->n; i++) {
+				pulse_write(p, (i&1) ? LOW : HIGH);
+				deadline += (int64_t)p->us[i]*1000;
+				sleep_until_ns(deadline);
+			}
+		}
+		pulse_write(p, LOW);
+		close(p->fd);
+
+		pthread_mutex_lock(&pulseLock);
+		pulseHead = (pulseHead+1) % PULSE_QUEUE_SIZE;
+		pulseCount--;
+		pthread_cond_signal(&pulseSpace);
+		pthread_mutex_unlock(&pulseLock);
+	}
+	return NULL;
+}
+
+static void pulse_start() {
+	pthread_t threadId;
+	if(pthread_create(&threadId, NULL, pulseHandler, NULL)) {
+		DEBUG_PRINTLN("failed to start pulse thread");
+		return;
+	}
+	pthread_detach(threadId);
+	pulseRunning = true;
+}
+
+/** Queue a pulse train on a pin
+ * us: durations (in microseconds) of alternating high and low pulses,
+ * starting with high; the train is sent repeat times.
+ * Waits if the queue is full.
+ * Returns false if pulse trains cannot be sent
+ */
+bool gpio_pulses_queue(int pin, const ulong *us, uint16_t n, byte repeat) {
+	if(n==0 || n>GPIO_PULSES_MAX || pin<0 || pin>=GPIO_MAX) return false;
+	pthread_once(&pulseOnce, pulse_start);
+	if(!pulseRunning) return false;
+
+	// open the pin for the pulse thread here, on the main thread
+	int fd = -1;
+	bool line = false;
+#if defined(GPIO_GET_LINEHANDLE_IOCTL)
+	if(!pinLines[pin] || pinLines[pin]->n!=1 || pinLines[pin]->mode!=OUTPUT) {
+		byte p = pin;
+		gpio_lines_request(&p, 1, OUTPUT);
+	}
+	if(pinLines[pin]) {
+		fd = dup(pinLines[pin]->fd);
+		line = true;
+	}
+#endif
+	if(fd<0) {
+		char path[BUFFER_MAX];
+		snprintf(path, BUFFER_MAX, "/sys/class/gpio/gpio%d/value", pin);
+		fd = open(path, O_WRONLY);
+		line = false;
+	}
+	if(fd<0) return false;
+
+	pthread_mutex_lock(&pulseLock);
+	while(pulseCount==PULSE_QUEUE_SIZE) pthread_cond_wait(&pulseSpace, &pulseLock);
+	PulseTrain *p = &pulseQueue[(pulseHead+pulseCount) % PULSE_QUEUE_SIZE];
+	p->fd = fd;
+	p->line = line;
+	p->repeat = repeat;
+	p->n = n;
+	memcpy(p->us, us, n*sizeof(ulong));
+	pulseCount++;
+	pthread_cond_signal(&pulseCond);
+	pthread_mutex_unlock(&pulseLock);
+	return true;
+}
 #else
 
 void pinMode(int pin, byte mode) {}
 void digitalWrite(int pin, byte value) {}
 byte digitalRead(int pin) {return 0;}
 void attachInterrupt(int pin, const char* mode, void (*isr)(void)) {}
+bool attachEdgeEvents(int pin, const char* mode) {return false;}
+bool readEdgeEvent(int pin, ulong *ts) {return false;}
+ulong readEdgeDropped(int pin) {return 0;}
+GPIOLines *gpio_lines_open(const byte *pins, byte n) {return NULL;}
+void gpio_lines_write(GPIOLines *lines, const byte *values) {}
+bool gpio_pulses_queue(int pin, const ulong *us, uint16_t n, byte repeat) {return false;}
 int gpio_fd_open(int pin, int mode) {return 0;}
 void gpio_fd_close(int fd) {}
 void gpio_write(int fd, byte value) {}
@@ -134,14 +134,31 @@ byte digitalReadExt(byte pin);
 #define HIGH	 1
 #define LOW		 0
 
+#define GPIO_LINES_MAX	8	// maximum number of pins set together
+
+struct GPIOLines;
+
 void pinMode(int pin, byte mode);
 void digitalWrite(int pin, byte value);
+GPIOLines *gpio_lines_open(const byte *pins, byte n);
+void gpio_lines_write(GPIOLines *lines, const byte *values);
+#if defined(OSPI)
+bool gpiomem_compatible(const char *path);
+bool gpiomem_open();
+void gpiomem_attach(volatile uint32_t *regs);
+#endif
 int gpio_fd_open(int pin, int mode = O_WRONLY);
 void gpio_fd_close(int fd);
 void gpio_write(int fd, byte value);
 byte digitalRead(int pin);
 // mode can be any of 'rising', 'falling', 'both'
 void attachInterrupt(int pin, const char* mode, void (*isr)(void));
+bool attachEdgeEvents(int pin, const char* mode);
+bool readEdgeEvent(int pin, ulong *ts);
+ulong readEdgeDropped(int pin);
+
+#define GPIO_PULSES_MAX	64	// maximum number of pulses in a pulse train
+bool gpio_pulses_queue(int pin, const ulong *us, uint16_t n, byte repeat);
 
 #endif
 
@@ -0,0 +1,383 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Asynchronous HTTP client
+ * Feb 2015 @ OpenSprinkler.com
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(ARDUINO)
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <strings.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include "utils.h"
+#include "httpclient.h"
+#include "dnscache.h"
+
+#define HTTPCLIENT_FREE				0
+#define HTTPCLIENT_QUEUED			1
+#define HTTPCLIENT_RESOLVING	2
+#define HTTPCLIENT_CONNECTING	3
+#define HTTPCLIENT_SENDING		4
+#define HTTPCLIENT_RECEIVING	5
+
+struct HTTPClientRequest {
+	byte state;
+	ulong seq;				// queue order
+	char host[HTTPCLIENT_HOST_SIZE];
+	uint16_t port;
+	char *data;				// request
+	uint16_t len;
+	uint16_t sent;
+	char *resp;				// response (null-terminated)
+	uint16_t rlen;
+	ulong total;			// number of response bytes received
+	long clen;				// total response length (-1: until the connection closes)
+	bool keepalive;		// server keeps the connection open
+	bool reused;			// sent on a pooled connection
+	int fd;
+	uint16_t timeout;	// milliseconds
+	ulong start;			// millis() when the request was started
+	void (*callback)(char*);
+	void (*result)(int8_t);
+};
+
+/** Idle keep-alive connection */
+struct HTTPClientConnection {
+	int fd;						// -1: unused (0 if never used)
+	char host[HTTPCLIENT_HOST_SIZE];
+	uint16_t port;
+	ulong last;				// millis() when the connection became idle
+};
+
+static HTTPClientRequest http_requests[HTTPCLIENT_QUEUE_SIZE];
+static HTTPClientConnection http_pool[HTTPCLIENT_POOL_SIZE];
+static ulong http_seq = 0;
+static char finish_host[HTTPCLIENT_HOST_SIZE];	// server of the request being completed
+static uint16_t finish_port = 0;
+
+/** Put a connection in the pool */
+static void httpclient_pool_put(const char *host, uint16_t port, int fd) {
+	HTTPClientConnection *c = NULL;
+	for(byte i=0;i<HTTPCLIENT_POOL_SIZE;i++) {
+		HTTPClientConnection *p = &http_pool[i];
+		if(p->fd<=0) { c = p; break; }
+		if(!c || (long)(p->last-c->last)<0) c = p;	// replace the oldest one
+	}
+	if(c->fd>0) close(c->fd);
+	c->fd = fd;
+	strcpy(c->host, host);
+	c->port = port;
+	c->last = millis();
+}
+
+/** Take a pooled connection to a server
+ * Returns -1 if there is none
+ */
+static int httpclient_pool_get(const char *host, uint16_t port) {
+	for(byte i=0;i<HTTPCLIENT_POOL_SIZE;i++) {
+		HTTPClientConnection *c = &http_pool[i];
+		if(c->fd<=0 || c->port!=port || strcmp(c->host, host)) continue;
+		int fd = c->fd;
+		c->fd = -1;
+		// the server may have closed the connection in the meantime
+		struct pollfd pfd = {fd, POLLIN, 0};
+		if(poll(&pfd, 1, 0)!=0) {
+			close(fd);
+			continue;
+		}
+		return fd;
+	}
+	return -1;
+}
+
+/** Close idle connections */
+static void httpclient_pool_expire(ulong curr) {
+	for(byte i=0;i<HTTPCLIENT_POOL_SIZE;i++) {
+		HTTPClientConnection *c = &http_pool[i];
+		if(c->fd>0 && curr-c->last > HTTPCLIENT_IDLE_TIMEOUT) {
+			close(c->fd);
+			c->fd = -1;
+		}
+	}
+}
+
+/** Parse the response header once it is complete
+ * sets the expected response length and keep-alive status
+ */
+static void httpclient_parse_header(HTTPClientRequest *r) {
+	char *end = strstr(r->resp, "\r\n\r\n");
+	if(!end) return;
+	*end = 0;	// limit the search to the header
+	char *cl = strcasestr(r->resp, "\r\nContent-Length:");
+	if(cl) r->clen = (end+4-r->resp) + atol(cl+17);
+	r->keepalive = cl && !strcasestr(r->resp, "\r\nConnection: close") &&
+								(strncmp(r->resp, "HTTP/1.0", 8) || strcasestr(r->resp, "\r\nConnection: keep-alive"));
+	*end = '\r';
+}
+
+/** Queue a HTTP request
+ * callback is called with the response if the request succeeds,
+ * result is called with the HTTP_RQT_xxx result in any case.
+ * Returns false if the queue is full
+ */
+bool httpclient_queue(const char *server, uint16_t port, const char *request,
+											void(*callback)(char*), uint16_t timeout, void(*result)(int8_t)) {
+	HTTPClientRequest *r = NULL;
+	for(byte i=0;i<HTTPCLIENT_QUEUE_SIZE;i++) {
+		if(http_requests[i].state==HTTPCLIENT_FREE) { r = &http_requests[i]; break; }
+	}
+	if(!r || strlen(server)>=HTTPCLIENT_HOST_SIZE) return false;
+
+	uint16_t len = strlen(request);
+	if(len > ETHER_BUFFER_SIZE) len = ETHER_BUFFER_SIZE;
+	r->data = (char*)malloc(len);
+	if(!r->data) return false;
+	memcpy(r->data, request, len);
+	strcpy(r->host, server);
+	r->port = port;
+	r->len = len;
+	r->sent = 0;
+	r->resp = NULL;
+	r->rlen = 0;
+	r->total = 0;
+	r->clen = -1;
+	r->keepalive = false;
+	r->reused = false;
+	r->fd = -1;
+	r->timeout = timeout;
+	r->callback = callback;
+	r->result = result;
+	r->seq = http_seq++;
+	r->state = HTTPCLIENT_QUEUED;
+	return true;
+}
+
+/** Number of pending requests */
+byte httpclient_pending() {
+	byte n = 0;
+	for(byte i=0;i<HTTPCLIENT_QUEUE_SIZE;i++) {
+		if(http_requests[i].state!=HTTPCLIENT_FREE) n++;
+	}
+	return n;
+}
+
+/** Complete a request and call its callbacks */
+static void httpclient_finish(HTTPClientRequest *r, int8_t ret) {
+	if(r->fd>=0) {
+		if(ret==HTTP_RQT_SUCCESS && r->keepalive) httpclient_pool_put(r->host, r->port, r->fd);
+		else close(r->fd);
+	}
+	if(ret==HTTP_RQT_SUCCESS && !r->rlen) ret = HTTP_RQT_EMPTY_RETURN;
+	if(ret!=HTTP_RQT_SUCCESS) {
+		DEBUG_PRINT("http request failed - ");
+		DEBUG_PRINT(r->host);
+		DEBUG_PRINT(" ");
+		DEBUG_PRINTLN((int)ret);
+	}
+
+	// free the slot first, callbacks may queue new requests
+	strncpy(finish_host, r->host, sizeof(finish_host)-1);
+	finish_port = r->port;
+	char *resp = r->resp;
+	void (*callback)(char*) = r->callback;
+	void (*result)(int8_t) = r->result;
+	free(r->data);
+	r->data = NULL;
+	r->resp = NULL;
+	r->fd = -1;
+	r->state = HTTPCLIENT_FREE;
+
+	if(ret==HTTP_RQT_SUCCESS && callback) callback(resp);
+	if(result) result(ret);
+	free(resp);
+}
+
+/** Server of the request whose callbacks are being called */
+const char* httpclient_server(uint16_t *port) {
+	if(port) *port = finish_port;
+	return finish_host;
+}
+
+/** Start a non-blocking connection
+ * Returns 1 if connecting, 0 while the server name is being resolved,
+ * -1 on error
+ */
+static int8_t httpclient_connect(HTTPClientRequest *r) {
+	struct sockaddr_storage addr;
+	socklen_t addrlen;
+	byte ret = dnscache_lookup(r->host, r->port, &addr, &addrlen);
+	if(ret==DNSCACHE_PENDING) return 0;
+	if(ret!=DNSCACHE_FOUND) {
+		DEBUG_PRINT("can't resolve http station - ");
+		DEBUG_PRINTLN(r->host);
+		return -1;
+	}
+
+	r->fd = socket(addr.ss_family, SOCK_STREAM, 0);
+	if(r->fd>=0) {
+		fcntl(r->fd, F_SETFL, fcntl(r->fd, F_GETFL, 0) | O_NONBLOCK);
+		if(connect(r->fd, (struct sockaddr*)&addr, addrlen)<0 && errno!=EINPROGRESS) {
+			close(r->fd);
+			r->fd = -1;
+		}
+	}
+	return (r->fd>=0) ? 1 : -1;
+}
+
+/** Resend a request on a new connection
+ * if its pooled connection was closed by the server
+ */
+static bool httpclient_retry(HTTPClientRequest *r) {
+	if(!r->reused || r->total) return false;
+	close(r->fd);
+	r->fd = -1;
+	r->sent = 0;
+	r->state = HTTPCLIENT_QUEUED;	// reused stays set, so a new connection is made
+	return true;
+}
+
+/** Check if a queued request can start
+ * requests to the same server are processed in order
+ */
+static bool httpclient_can_start(HTTPClientRequest *r) {
+	for(byte i=0;i<HTTPCLIENT_QUEUE_SIZE;i++) {
+		HTTPClientRequest *q = &http_requests[i];
+		if(q==r || q->state==HTTPCLIENT_FREE) continue;
+		if(q->port==r->port && !strcmp(q->host, r->host)) {
+			if(q->state!=HTTPCLIENT_QUEUED || (long)(q->seq-r->seq)<0) return false;
+		}
+	}
+	return true;
+}
+
+/** Process pending requests
+ * Call this from the main loop
+ */
+void httpclient_poll() {
+	struct pollfd fds[HTTPCLIENT_QUEUE_SIZE];
+	HTTPClientRequest *reqs[HTTPCLIENT_QUEUE_SIZE];
+	byte i, n = 0;
+	ulong curr = millis();
+
+	httpclient_pool_expire(curr);
+	for(i=0;i<HTTPCLIENT_QUEUE_SIZE;i++) {
+		HTTPClientRequest *r = &http_requests[i];
+		if(r->state==HTTPCLIENT_QUEUED && httpclient_can_start(r)) {
+			r->start = curr;
+			r->fd = r->reused ? -1 : httpclient_pool_get(r->host, r->port);
+			if(r->fd>=0) {
+				r->reused = true;
+				r->state = HTTPCLIENT_SENDING;
+			} else {
+				r->state = HTTPCLIENT_RESOLVING;
+			}
+		}
+		if(r->state==HTTPCLIENT_RESOLVING) {
+			int8_t ret = httpclient_connect(r);
+			if(ret<0 || (!ret && curr-r->start > r->timeout)) {
+				httpclient_finish(r, HTTP_RQT_CONNECT_ERR);
+				continue;
+			}
+			if(!ret) continue;
+			r->state = HTTPCLIENT_CONNECTING;
+		}
+		if(r->state<HTTPCLIENT_CONNECTING) continue;
+		if(curr-r->start > r->timeout) {
+			httpclient_finish(r, (r->state==HTTPCLIENT_RECEIVING) ? HTTP_RQT_TIMEOUT : HTTP_RQT_CONNECT_ERR);
+			continue;
+		}
+		fds[n].fd = r->fd;
+		fds[n].events = (r->state==HTTPCLIENT_RECEIVING) ? POLLIN : POLLOUT;
+		fds[n].revents = 0;
+		reqs[n++] = r;
+	}
+	if(!n || poll(fds, n, 0)<=0) return;
+
+	for(i=0;i<n;i++) {
+		HTTPClientRequest *r = reqs[i];
+		if(!fds[i].revents) continue;
+		if(r->state==HTTPCLIENT_CONNECTING) {
+			int err = 0;
+			socklen_t len = sizeof(err);
+			if(getsockopt(r->fd, SOL_SOCKET, SO_ERROR, &err, &len)<0 || err) {
+				dnscache_expire(r->host);	// the server may have moved
+				httpclient_finish(r, HTTP_RQT_CONNECT_ERR);
+				continue;
+			}
+			r->state = HTTPCLIENT_SENDING;
+		}
+		if(r->state==HTTPCLIENT_SENDING) {
+			ssize_t ret = send(r->fd, r->data+r->sent, r->len-r->sent, MSG_NOSIGNAL);
+			if(ret<0) {
+				if(errno!=EAGAIN && errno!=EWOULDBLOCK) {
+					if(!httpclient_retry(r)) httpclient_finish(r, HTTP_RQT_CONNECT_ERR);
+				}
+				continue;
+			}
+			r->sent += ret;
+			if(r->sent==r->len) r->state = HTTPCLIENT_RECEIVING;
+			continue;
+		}
+		if(r->state==HTTPCLIENT_RECEIVING) {
+			if(!r->resp) {
+				r->resp = (char*)malloc(ETHER_BUFFER_SIZE+1);
+				if(!r->resp) {
+					httpclient_finish(r, HTTP_RQT_NOT_RECEIVED);
+					continue;
+				}
+			}
+			// keep the beginning of the response if it is larger than the buffer
+			char discard[256];
+			ssize_t ret;
+			if(r->rlen<ETHER_BUFFER_SIZE) ret = recv(r->fd, r->resp+r->rlen, ETHER_BUFFER_SIZE-r->rlen, 0);
+			else ret = recv(r->fd, discard, sizeof(discard), 0);
+			if(ret<=0 && !r->total && httpclient_retry(r)) continue;
+			if(ret<0) {
+				if(errno!=EAGAIN && errno!=EWOULDBLOCK) httpclient_finish(r, HTTP_RQT_NOT_RECEIVED);
+				continue;
+			}
+			if(ret==0) {	// server closed the connection: response complete
+				r->keepalive = false;
+				httpclient_finish(r, HTTP_RQT_SUCCESS);
+				continue;
+			}
+			if(r->rlen<ETHER_BUFFER_SIZE) {
+				r->rlen += ret;
+				r->resp[r->rlen] = 0;
+			}
+			r->total += ret;
+			if(r->clen<0) httpclient_parse_header(r);
+			if(r->clen>=0 && r->total>=(ulong)r->clen) {
+				// response complete, the connection can be reused
+				httpclient_finish(r, HTTP_RQT_SUCCESS);
+			}
+		}
+	}
+}
+
+#endif // !ARDUINO
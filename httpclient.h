@@ -0,0 +1,60 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Asynchronous HTTP client header file
+ * Feb 2015 @ OpenSprinkler.com
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _HTTPCLIENT_H
+#define _HTTPCLIENT_H
+
+#if !defined(ARDUINO)
+
+#include <stdint.h>
+#include "defines.h"
+
+/* On RPI/BBB, outgoing HTTP requests (remote / HTTP stations, IFTTT)
+ * are queued and processed by httpclient_poll(), which is called from
+ * the main loop: connections are non-blocking, so a slow or unreachable
+ * server no longer stalls the controller. Requests to the same server
+ * are sent in the order they were queued. Callbacks are called from
+ * httpclient_poll(), i.e. on the main loop.
+ * If a server keeps the connection open (keep-alive, with a content
+ * length), the connection is pooled, and the next request to the same
+ * server is sent on it as soon as the previous response is complete.
+ */
+#ifndef HTTPCLIENT_QUEUE_SIZE
+#define HTTPCLIENT_QUEUE_SIZE		16	// maximum number of pending requests
+#endif
+#ifndef HTTPCLIENT_POOL_SIZE
+#define HTTPCLIENT_POOL_SIZE		8		// maximum number of idle keep-alive connections
+#endif
+#define HTTPCLIENT_IDLE_TIMEOUT	5000	// idle connections are closed after this many milliseconds
+#define HTTPCLIENT_HOST_SIZE		128
+
+bool httpclient_queue(const char *server, uint16_t port, const char *request,
+											void(*callback)(char*)=NULL, uint16_t timeout=3000,
+											void(*result)(int8_t)=NULL);
+void httpclient_poll();
+byte httpclient_pending();
+const char* httpclient_server(uint16_t *port=NULL);
+
+#endif // !ARDUINO
+
+#endif // _HTTPCLIENT_H
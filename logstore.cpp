@@ -0,0 +1,961 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Binary log store
+ * Feb 2015 @ OpenSprinkler.com
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(ARDUINO)
+
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "utils.h"
+#include "logstore.h"
+
+extern char LOG_PREFIX[];
+
+#define LOGSTORE_NUM_TYPES	7	// number of entries in log_type_names
+
+/** Full path of a log store file: logs/<day><ext> */
+static void logstore_filename(char *path, ulong day, const char *ext) {
+	snprintf(path, PATH_MAX, "%s%s%lu%s", get_runtime_path(), LOG_PREFIX, day, ext);
+}
+
+/** Full path of a named log store file: logs/<name> */
+static void logstore_path(char *path, const char *name) {
+	snprintf(path, PATH_MAX, "%s%s%s", get_runtime_path(), LOG_PREFIX, name);
+}
+
+/** Create log folder if it doesn't exist yet */
+static bool logstore_prepare_folder() {
+	char path[PATH_MAX];
+	struct stat st;
+	snprintf(path, PATH_MAX, "%s%s", get_runtime_path(), LOG_PREFIX);
+	if(stat(path, &st)) {
+		if(mkdir(path, S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IWGRP | S_IXGRP | S_IROTH | S_IWOTH | S_IXOTH)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/** Index bit of a log record type
+ * LOGDATA_CURRENT (0x80) maps to the last bit
+ */
+uint16_t logstore_type_bit(byte type) {
+	if(type == LOGDATA_CURRENT) return 1<<(LOGSTORE_NUM_TYPES-1);
+	if(type >= LOGSTORE_NUM_TYPES-1) return 0;
+	return 1<<type;
+}
+
+/** Look up a record type by its two-character name
+ * Returns -1 if the name is not found
+ */
+int logstore_type_from_name(const char *name) {
+	for(byte i=0;i<LOGSTORE_NUM_TYPES;i++) {
+		if(strncmp(name, log_type_names+i*3, 2)==0) {
+			return (i==LOGSTORE_NUM_TYPES-1) ? LOGDATA_CURRENT : i;
+		}
+	}
+	return -1;
+}
+
+/** Month of a day
+ * Returns the month key (yyyymm), and optionally
+ * the first day of the month and the number of days in it
+ */
+static uint32_t logstore_month(ulong day, ulong *first=NULL, ulong *ndays=NULL) {
+	CivilDate cd;
+	civil_from_days(day, &cd);
+	if(first) *first = day-(cd.day-1);
+	if(ndays) *ndays = days_in_month(cd.year, cd.month);
+	return (uint32_t)cd.year*100 + cd.month;
+}
+
+static void logstore_maintain(ulong today);
+
+/* Log writer
+ * write_log() only queues records in a ring buffer. A background
+ * thread drains the queue in order into the day file, which is kept
+ * open until the day rolls over. Files are flushed after every batch
+ * and fsync'ed at most every LOGSTORE_SYNC_INTERVAL seconds. If the
+ * thread cannot be started, records are written directly instead.
+ */
+struct LogQueueItem {
+	ulong day;
+	LogRecord rec;
+};
+
+static LogQueueItem log_queue[LOGSTORE_QUEUE_SIZE];
+static uint16_t log_qhead = 0;	// index of the oldest queued record
+static uint16_t log_qlen = 0;		// number of queued records
+static bool log_busy = false;	// writer is processing a batch
+static bool log_direct = false;	// writer thread failed to start: records are written directly
+static pthread_mutex_t log_qlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_qcond = PTHREAD_COND_INITIALIZER;		// queue is non-empty
+static pthread_cond_t log_qspace = PTHREAD_COND_INITIALIZER;	// queue has space, or is drained
+static pthread_once_t log_once = PTHREAD_ONCE_INIT;
+
+// state of the open day file, only accessed with log_flock held
+static pthread_mutex_t log_flock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *log_dat = NULL;
+static FILE *log_idx = NULL;
+static ulong log_day = 0;
+static ulong log_nrec = 0;			// number of records in the open day file
+static LogIndexEntry log_entry;	// index entry of the last block
+static bool log_dirty = false;	// written since last fsync
+static time_t log_synctime = 0;
+
+/** Flush and close the open day file */
+static void logstore_close_day() {
+	if(log_dat) {
+		fflush(log_dat);
+		fsync(fileno(log_dat));
+		fclose(log_dat);
+		log_dat = NULL;
+	}
+	if(log_idx) {
+		fflush(log_idx);
+		fsync(fileno(log_idx));
+		fclose(log_idx);
+		log_idx = NULL;
+	}
+	log_dirty = false;
+}
+
+/** Open (or create) the day file and load the state of its last index block */
+static bool logstore_open_day(ulong day) {
+	logstore_close_day();
+	if(!logstore_prepare_folder()) return false;
+
+	char path[PATH_MAX];
+	logstore_filename(path, day, ".dat");
+	log_dat = fopen(path, "rb+");
+	if(!log_dat) {
+		log_dat = fopen(path, "wb");
+		if(!log_dat) return false;
+	}
+	fseek(log_dat, 0, SEEK_END);
+	long size = ftell(log_dat);
+	if(size < (long)sizeof(LogFileHeader)) {
+		// new file, write header first
+		LogFileHeader hdr = {LOGSTORE_MAGIC, LOGSTORE_VERSION, sizeof(LogRecord)};
+		fseek(log_dat, 0, SEEK_SET);
+		fwrite(&hdr, sizeof(hdr), 1, log_dat);
+		size = sizeof(hdr);
+	}
+	// drop any partially written record at the tail
+	log_nrec = (size - sizeof(LogFileHeader)) / sizeof(LogRecord);
+	fseek(log_dat, sizeof(LogFileHeader) + log_nrec*sizeof(LogRecord), SEEK_SET);
+
+	logstore_filename(path, day, ".idx");
+	log_idx = fopen(path, "rb+");
+	if(!log_idx) {
+		log_idx = fopen(path, "wb");
+		if(!log_idx) {
+			logstore_close_day();
+			return false;
+		}
+	}
+	memset(&log_entry, 0, sizeof(log_entry));
+	if(log_nrec%LOGSTORE_BLOCK_SIZE) {
+		fseek(log_idx, (log_nrec/LOGSTORE_BLOCK_SIZE)*sizeof(LogIndexEntry), SEEK_SET);
+		if(fread(&log_entry, sizeof(log_entry), 1, log_idx)!=1) memset(&log_entry, 0, sizeof(log_entry));
+	}
+	log_day = day;
+	return true;
+}
+
+/** Write a record to the open day file and update its sparse index */
+static bool logstore_write(ulong day, const LogRecord *rec) {
+	// roll over to a new file when the day changes,
+	// completed days are rolled up and archived first
+	if(!log_dat || day!=log_day) {
+		logstore_close_day();
+		logstore_maintain(day);
+		if(!logstore_open_day(day)) return false;
+	}
+	if(fwrite(rec, sizeof(LogRecord), 1, log_dat)!=1) return false;
+
+	// update the index entry of the block this record falls in
+	ulong block = log_nrec / LOGSTORE_BLOCK_SIZE;
+	if(log_nrec%LOGSTORE_BLOCK_SIZE==0) {
+		memset(&log_entry, 0, sizeof(log_entry));
+		log_entry.first_time = rec->end;
+	}
+	if(rec->end < log_entry.first_time) log_entry.first_time = rec->end;
+	if(rec->end > log_entry.last_time)  log_entry.last_time  = rec->end;
+	log_entry.typemask |= logstore_type_bit(rec->type);
+	if(rec->type == LOGDATA_STATION) log_entry.sidmask[(rec->sid>>5)&1] |= 1UL<<(rec->sid&31);
+	log_nrec++;
+	log_entry.count = (log_nrec-1)%LOGSTORE_BLOCK_SIZE + 1;
+	fseek(log_idx, block*sizeof(LogIndexEntry), SEEK_SET);
+	fwrite(&log_entry, sizeof(log_entry), 1, log_idx);
+	log_dirty = true;
+	return true;
+}
+
+/** fsync the open day file if the sync interval has elapsed */
+static void logstore_sync(bool force) {
+	time_t t = time(NULL);
+	if(!log_dirty || !log_dat) return;
+	if(!force && t-log_synctime < LOGSTORE_SYNC_INTERVAL) return;
+	fsync(fileno(log_dat));
+	fsync(fileno(log_idx));
+	log_dirty = false;
+	log_synctime = t;
+}
+
+/** Log writer thread */
+static void *logstore_writer(void *) {
+	LogQueueItem batch[LOGSTORE_QUEUE_SIZE];
+	uint16_t n;
+	while(true) {
+		pthread_mutex_lock(&log_qlock);
+		while(log_qlen==0) {
+			// wake up when the next fsync is due
+			struct timespec ts;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec += LOGSTORE_SYNC_INTERVAL;
+			if(pthread_cond_timedwait(&log_qcond, &log_qlock, &ts)==ETIMEDOUT) break;
+		}
+		// take all queued records as one batch, in order
+		for(n=0;n<log_qlen;n++) {
+			batch[n] = log_queue[(log_qhead+n)%LOGSTORE_QUEUE_SIZE];
+		}
+		log_qhead = (log_qhead+n)%LOGSTORE_QUEUE_SIZE;
+		log_qlen = 0;
+		log_busy = true;
+		pthread_mutex_unlock(&log_qlock);
+
+		pthread_mutex_lock(&log_flock);
+		for(uint16_t i=0;i<n;i++) {
+			logstore_write(batch[i].day, &batch[i].rec);
+		}
+		if(log_dat) {
+			fflush(log_dat);
+			fflush(log_idx);
+		}
+		logstore_sync(false);
+		pthread_mutex_unlock(&log_flock);
+
+		pthread_mutex_lock(&log_qlock);
+		log_busy = false;
+		pthread_cond_broadcast(&log_qspace);
+		pthread_mutex_unlock(&log_qlock);
+	}
+	return NULL;
+}
+
+static void logstore_start_writer() {
+	pthread_t tid;
+	if(pthread_create(&tid, NULL, logstore_writer, NULL)!=0) {
+		DEBUG_PRINTLN("failed to start log writer");
+		log_direct = true;
+		return;
+	}
+	pthread_detach(tid);
+}
+
+/** Queue a record for the log writer
+ * Blocks only if the queue is full
+ */
+bool logstore_append(ulong day, const LogRecord *rec) {
+	pthread_once(&log_once, logstore_start_writer);
+	if(log_direct) {
+		// no writer thread: write synchronously
+		pthread_mutex_lock(&log_flock);
+		logstore_write(day, rec);
+		if(log_dat) {
+			fflush(log_dat);
+			fflush(log_idx);
+		}
+		logstore_sync(false);
+		pthread_mutex_unlock(&log_flock);
+		return true;
+	}
+	pthread_mutex_lock(&log_qlock);
+	while(log_qlen==LOGSTORE_QUEUE_SIZE) {
+		pthread_cond_wait(&log_qspace, &log_qlock);
+	}
+	LogQueueItem *item = &log_queue[(log_qhead+log_qlen)%LOGSTORE_QUEUE_SIZE];
+	item->day = day;
+	item->rec = *rec;
+	log_qlen++;
+	pthread_cond_signal(&log_qcond);
+	pthread_mutex_unlock(&log_qlock);
+	return true;
+}
+
+/** Wait until all queued records are written to the day files */
+void logstore_flush() {
+	pthread_mutex_lock(&log_qlock);
+	while(log_qlen>0 || log_busy) {
+		pthread_cond_wait(&log_qspace, &log_qlock);
+	}
+	pthread_mutex_unlock(&log_qlock);
+}
+
+static void logstore_unarchive_day(ulong day);
+static void logstore_unroll_day(ulong day);
+
+/** Remove the log of a day, from its day files or its monthly
+ * archive, and take it out of the rollups
+ */
+void logstore_remove(ulong day) {
+	logstore_flush();
+	pthread_mutex_lock(&log_flock);
+	if(log_dat && log_day==day) logstore_close_day();
+	char path[PATH_MAX];
+	logstore_filename(path, day, ".dat");
+	remove(path);
+	logstore_filename(path, day, ".idx");
+	remove(path);
+	logstore_unarchive_day(day);
+	logstore_unroll_day(day);
+	pthread_mutex_unlock(&log_flock);
+}
+
+/** Remove all files in the log folder */
+void logstore_remove_all() {
+	logstore_flush();
+	pthread_mutex_lock(&log_flock);
+	logstore_close_day();
+	char path[PATH_MAX];
+	logstore_path(path, "");
+	DIR *dir = opendir(path);
+	if(dir) {
+		struct dirent *ent;
+		while((ent=readdir(dir))!=NULL) {
+			if(ent->d_name[0]=='.') continue;
+			logstore_path(path, ent->d_name);
+			remove(path);
+		}
+		closedir(dir);
+	}
+	pthread_mutex_unlock(&log_flock);
+}
+
+/* Retention and rollups
+ * Once a day is complete, its station records are summed up per
+ * station into logs/daily.sum (terminated by a LOGROLLUP_END row), and
+ * added to the totals of its month in logs/monthly.sum.
+ * Day files older than LOGSTORE_ARCHIVE_DAYS are packed into a monthly
+ * archive logs/yyyymm.arc, as a sequence of chunks of the form
+ * [LogArchiveChunk][records][index entries].
+ * Logs are kept forever by default. When built with
+ * LOGSTORE_RETENTION_DAYS set, logs older than that are removed, while
+ * the rollups are kept. Removing a day takes it out of the rollups too.
+ */
+
+/** Last day that has been rolled up, or 0 if none */
+static ulong logstore_last_rollup() {
+	char path[PATH_MAX];
+	logstore_path(path, LOGSTORE_DAILY_FILE);
+	FILE *fp = fopen(path, "rb");
+	if(!fp) return 0;
+	LogRollup row;
+	ulong day = 0;
+	fseek(fp, 0, SEEK_END);
+	long n = ftell(fp)/sizeof(LogRollup);
+	if(n>0) {
+		fseek(fp, (n-1)*sizeof(LogRollup), SEEK_SET);
+		if(fread(&row, sizeof(row), 1, fp)==1) day = row.key;
+	}
+	fclose(fp);
+	return day;
+}
+
+/** Sum up station records of a day from its log
+ * rows must hold MAX_NUM_STATIONS entries
+ */
+static void logstore_sum_day(ulong day, LogRollup *rows) {
+	LogReader reader;
+	LogRecord rec;
+	if(!reader.open(day)) return;
+	reader.set_filter(0, ULONG_MAX, logstore_type_bit(LOGDATA_STATION));
+	while(reader.next(&rec)) {
+		if(rec.sid>=MAX_NUM_STATIONS) continue;
+		LogRollup *r = rows+rec.sid;
+		r->count++;
+		r->runtime += rec.value;
+		if(rec.flags & LOGREC_FLAG_VOLUME) r->volume += rec.value2/100.f;
+		else if(rec.flags & LOGREC_FLAG_GPM) r->volume += rec.gpm*rec.value/60;
+	}
+}
+
+/** Roll up a completed day into the daily and monthly totals */
+static void logstore_rollup_day(ulong day) {
+	LogRollup rows[MAX_NUM_STATIONS];
+	memset(rows, 0, sizeof(rows));
+	logstore_sum_day(day, rows);
+
+	char path[PATH_MAX];
+	logstore_path(path, LOGSTORE_DAILY_FILE);
+	FILE *fp = fopen(path, "ab");
+	if(!fp) return;
+	for(int i=0;i<MAX_NUM_STATIONS;i++) {
+		if(!rows[i].count) continue;
+		rows[i].key = day;
+		rows[i].sid = i;
+		fwrite(rows+i, sizeof(LogRollup), 1, fp);
+	}
+	LogRollup end;
+	memset(&end, 0, sizeof(end));
+	end.key = day;
+	end.sid = LOGROLLUP_END;
+	fwrite(&end, sizeof(end), 1, fp);
+	fflush(fp);
+	fsync(fileno(fp));
+	fclose(fp);
+
+	// add to the month totals: update existing rows in place, append new ones
+	uint32_t key = logstore_month(day);
+	logstore_path(path, LOGSTORE_MONTHLY_FILE);
+	fp = fopen(path, "rb+");
+	if(!fp) fp = fopen(path, "wb+");
+	if(!fp) return;
+	LogRollup row;
+	long pos = 0;
+	while(fread(&row, sizeof(row), 1, fp)==1) {
+		if(row.key==key && row.sid<MAX_NUM_STATIONS && rows[row.sid].count) {
+			row.count += rows[row.sid].count;
+			row.runtime += rows[row.sid].runtime;
+			row.volume += rows[row.sid].volume;
+			fseek(fp, pos, SEEK_SET);
+			fwrite(&row, sizeof(row), 1, fp);
+			rows[row.sid].count = 0;
+			fseek(fp, pos+sizeof(row), SEEK_SET);
+		}
+		pos += sizeof(row);
+	}
+	fseek(fp, 0, SEEK_END);
+	for(int i=0;i<MAX_NUM_STATIONS;i++) {
+		if(!rows[i].count) continue;
+		rows[i].key = key;
+		fwrite(rows+i, sizeof(LogRollup), 1, fp);
+	}
+	fflush(fp);
+	fsync(fileno(fp));
+	fclose(fp);
+}
+
+/** Find the chunk of a day in an open archive
+ * On success, the file is positioned at the first record of the chunk
+ */
+static bool logstore_find_chunk(FILE *fp, ulong day, LogArchiveChunk *c) {
+	fseek(fp, 0, SEEK_SET);
+	while(fread(c, sizeof(LogArchiveChunk), 1, fp)==1) {
+		if(c->magic!=LOGSTORE_MAGIC) return false;
+		if(c->day==day) return true;
+		fseek(fp, c->nrec*sizeof(LogRecord)+c->nidx*sizeof(LogIndexEntry), SEEK_CUR);
+	}
+	return false;
+}
+
+/** Move a completed day from its day files into the monthly archive */
+static void logstore_archive_day(ulong day) {
+	char path[PATH_MAX];
+	logstore_filename(path, logstore_month(day), ".arc");
+	FILE *arc = fopen(path, "rb+");
+	if(!arc) arc = fopen(path, "wb+");
+	if(!arc) return;
+	LogArchiveChunk c;
+	if(!logstore_find_chunk(arc, day, &c)) {
+		logstore_filename(path, day, ".dat");
+		FILE *dat = fopen(path, "rb");
+		LogFileHeader hdr;
+		if(!dat || fread(&hdr, sizeof(hdr), 1, dat)!=1 || hdr.magic!=LOGSTORE_MAGIC || hdr.record_size!=sizeof(LogRecord)) {
+			if(dat) fclose(dat);
+			fclose(arc);
+			return;
+		}
+		fseek(dat, 0, SEEK_END);
+		c.magic = LOGSTORE_MAGIC;
+		c.day = day;
+		c.nrec = (ftell(dat)-sizeof(LogFileHeader))/sizeof(LogRecord);
+		c.nidx = (c.nrec+LOGSTORE_BLOCK_SIZE-1)/LOGSTORE_BLOCK_SIZE;
+		fseek(dat, sizeof(LogFileHeader), SEEK_SET);
+
+		// copy records block by block, rebuilding the index as we go
+		LogIndexEntry *entries = (LogIndexEntry*)calloc(c.nidx ? c.nidx : 1, sizeof(LogIndexEntry));
+		LogRecord recs[LOGSTORE_BLOCK_SIZE];
+		if(!entries) {
+			fclose(dat);
+			fclose(arc);
+			return;
+		}
+		fseek(arc, 0, SEEK_END);
+		long start = ftell(arc);
+		bool ok = (fwrite(&c, sizeof(c), 1, arc)==1);
+		for(ulong b=0; ok && b<c.nidx; b++) {
+			ulong n = c.nrec-b*LOGSTORE_BLOCK_SIZE;
+			if(n>LOGSTORE_BLOCK_SIZE) n = LOGSTORE_BLOCK_SIZE;
+			ok = (fread(recs, sizeof(LogRecord), n, dat)==n) && (fwrite(recs, sizeof(LogRecord), n, arc)==n);
+			LogIndexEntry *e = entries+b;
+			e->first_time = recs[0].end;
+			for(ulong i=0;i<n;i++) {
+				if(recs[i].end < e->first_time) e->first_time = recs[i].end;
+				if(recs[i].end > e->last_time)  e->last_time  = recs[i].end;
+				e->typemask |= logstore_type_bit(recs[i].type);
+				if(recs[i].type == LOGDATA_STATION) e->sidmask[(recs[i].sid>>5)&1] |= 1UL<<(recs[i].sid&31);
+			}
+			e->count = n;
+		}
+		if(ok) ok = (fwrite(entries, sizeof(LogIndexEntry), c.nidx, arc)==c.nidx);
+		free(entries);
+		fclose(dat);
+		fflush(arc);
+		if(!ok) {
+			// leave the day files in place, and drop the incomplete chunk
+			ftruncate(fileno(arc), start);
+			fclose(arc);
+			return;
+		}
+		fsync(fileno(arc));
+	}
+	fclose(arc);
+	logstore_filename(path, day, ".dat");
+	remove(path);
+	logstore_filename(path, day, ".idx");
+	remove(path);
+}
+
+/** Copy n bytes between files */
+static bool logstore_copy(FILE *from, FILE *to, ulong n) {
+	char buf[1024];
+	while(n>0) {
+		size_t k = (n>sizeof(buf)) ? sizeof(buf) : n;
+		if(fread(buf, 1, k, from)!=k || fwrite(buf, 1, k, to)!=k) return false;
+		n -= k;
+	}
+	return true;
+}
+
+/** Replace a file with its rewritten copy, or drop the copy */
+static void logstore_replace(FILE *fp, const char *tmp, const char *path, bool ok, bool empty) {
+	if(ok) {
+		fflush(fp);
+		fsync(fileno(fp));
+	}
+	fclose(fp);
+	if(!ok) {
+		remove(tmp);
+	} else if(empty) {
+		remove(tmp);
+		remove(path);
+	} else {
+		rename(tmp, path);
+	}
+}
+
+/** Remove the chunk of a day from its monthly archive
+ * The archive is rewritten without the chunk, and removed if
+ * no other chunk is left
+ */
+static void logstore_unarchive_day(ulong day) {
+	char path[PATH_MAX], tmp[PATH_MAX+4];
+	logstore_filename(path, logstore_month(day), ".arc");
+	FILE *arc = fopen(path, "rb");
+	if(!arc) return;
+	LogArchiveChunk c;
+	if(!logstore_find_chunk(arc, day, &c)) {
+		fclose(arc);
+		return;
+	}
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	FILE *out = fopen(tmp, "wb");
+	if(!out) {
+		fclose(arc);
+		return;
+	}
+	fseek(arc, 0, SEEK_SET);
+	bool ok = true, empty = true;
+	while(ok && fread(&c, sizeof(c), 1, arc)==1 && c.magic==LOGSTORE_MAGIC) {
+		ulong size = c.nrec*sizeof(LogRecord)+c.nidx*sizeof(LogIndexEntry);
+		if(c.day==day) {
+			fseek(arc, size, SEEK_CUR);
+			continue;
+		}
+		ok = (fwrite(&c, sizeof(c), 1, out)==1) && logstore_copy(arc, out, size);
+		empty = false;
+	}
+	fclose(arc);
+	logstore_replace(out, tmp, path, ok, empty);
+}
+
+/** Take a day out of the daily and monthly rollups
+ * The row terminating the day is kept, so the day is not rolled up again
+ */
+static void logstore_unroll_day(ulong day) {
+	if(day>logstore_last_rollup()) return;
+	LogRollup rows[MAX_NUM_STATIONS];
+	memset(rows, 0, sizeof(rows));
+	bool found = false;
+
+	// rewrite the daily rollups without the station rows of the day
+	char path[PATH_MAX], tmp[PATH_MAX+4];
+	logstore_path(path, LOGSTORE_DAILY_FILE);
+	FILE *fp = fopen(path, "rb");
+	if(!fp) return;
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	FILE *out = fopen(tmp, "wb");
+	if(!out) {
+		fclose(fp);
+		return;
+	}
+	LogRollup row;
+	bool ok = true;
+	while(ok && fread(&row, sizeof(row), 1, fp)==1) {
+		if(row.key==day && row.sid<MAX_NUM_STATIONS) {
+			rows[row.sid] = row;
+			found = true;
+			continue;
+		}
+		ok = (fwrite(&row, sizeof(row), 1, out)==1);
+	}
+	fclose(fp);
+	if(!found) ok = false;	// nothing to remove, keep the file as is
+	logstore_replace(out, tmp, path, ok, false);
+	if(!ok) return;
+
+	// subtract the day from the totals of its month
+	uint32_t key = logstore_month(day);
+	logstore_path(path, LOGSTORE_MONTHLY_FILE);
+	fp = fopen(path, "rb+");
+	if(!fp) return;
+	long pos = 0;
+	while(fread(&row, sizeof(row), 1, fp)==1) {
+		if(row.key==key && row.sid<MAX_NUM_STATIONS && rows[row.sid].count) {
+			LogRollup *r = rows+row.sid;
+			row.count = (row.count>r->count) ? row.count-r->count : 0;
+			row.runtime = (row.runtime>r->runtime) ? row.runtime-r->runtime : 0;
+			row.volume = (row.volume>r->volume) ? row.volume-r->volume : 0;
+			fseek(fp, pos, SEEK_SET);
+			fwrite(&row, sizeof(row), 1, fp);
+			fseek(fp, pos+sizeof(row), SEEK_SET);
+		}
+		pos += sizeof(row);
+	}
+	fflush(fp);
+	fsync(fileno(fp));
+	fclose(fp);
+}
+
+static int logstore_cmp_day(const void *a, const void *b) {
+	ulong x = *(const ulong*)a, y = *(const ulong*)b;
+	return (x>y) - (x<y);
+}
+
+/** Roll up, archive and expire completed days
+ * Called by the log writer when the day rolls over
+ */
+static void logstore_maintain(ulong today) {
+	char path[PATH_MAX];
+	logstore_path(path, "");
+	DIR *dir = opendir(path);
+	if(!dir) return;
+
+	// collect days with day files, and expired archives and text logs
+	static ulong days[LOGSTORE_MAX_DAYS];
+	int ndays = 0;
+	struct dirent *ent;
+	while((ent=readdir(dir))!=NULL) {
+		char *ext;
+		ulong v = strtoul(ent->d_name, &ext, 10);
+		if(ext==ent->d_name) continue;
+		if(!strcmp(ext, ".dat")) {
+			if(v<today && ndays<LOGSTORE_MAX_DAYS) days[ndays++] = v;
+		}
+		#if LOGSTORE_RETENTION_DAYS > 0
+		else if(!strcmp(ext, ".txt")) {
+			// text log of a day, written by older firmwares
+			if(v+LOGSTORE_RETENTION_DAYS <= today) {
+				logstore_path(path, ent->d_name);
+				remove(path);
+			}
+		}
+		else if(!strcmp(ext, ".arc")) {
+			ulong first, n;
+			// month key to the first day of the next month
+			logstore_month(days_from_civil(v/100, v%100, 1), &first, &n);
+			if(first+n+LOGSTORE_RETENTION_DAYS <= today) {
+				logstore_path(path, ent->d_name);
+				remove(path);
+			}
+		}
+		#endif
+	}
+	closedir(dir);
+
+	qsort(days, ndays, sizeof(ulong), logstore_cmp_day);
+	ulong rolled = logstore_last_rollup();
+	for(int i=0;i<ndays;i++) {
+		ulong day = days[i];
+		if(day>rolled) {
+			logstore_rollup_day(day);
+			rolled = day;
+		}
+		#if LOGSTORE_RETENTION_DAYS > 0
+		if(day+LOGSTORE_RETENTION_DAYS <= today) {
+			logstore_filename(path, day, ".dat");
+			remove(path);
+			logstore_filename(path, day, ".idx");
+			remove(path);
+			continue;
+		}
+		#endif
+		if(day+LOGSTORE_ARCHIVE_DAYS <= today) {
+			logstore_archive_day(day);
+		}
+	}
+}
+
+/** Add daily rollup rows of days [start, end] to totals */
+static void logstore_add_daily(FILE *fp, ulong start, ulong end, LogRollup *totals) {
+	// binary search for the first row of the start day
+	fseek(fp, 0, SEEK_END);
+	long lo = 0, hi = ftell(fp)/sizeof(LogRollup);
+	LogRollup row;
+	while(lo<hi) {
+		long mid = (lo+hi)/2;
+		fseek(fp, mid*sizeof(LogRollup), SEEK_SET);
+		if(fread(&row, sizeof(row), 1, fp)!=1) return;
+		if(row.key<start) lo = mid+1;
+		else hi = mid;
+	}
+	fseek(fp, lo*sizeof(LogRollup), SEEK_SET);
+	while(fread(&row, sizeof(row), 1, fp)==1 && row.key<=end) {
+		if(row.sid>=MAX_NUM_STATIONS) continue;
+		totals[row.sid].count += row.count;
+		totals[row.sid].runtime += row.runtime;
+		totals[row.sid].volume += row.volume;
+	}
+}
+
+/** Per-station totals of station runs over days [start, end]
+ * totals must hold MAX_NUM_STATIONS entries, indexed by station
+ * Complete months are taken from the monthly rollups, the remaining
+ * rolled-up days from the daily rollups, and the days that have not
+ * been rolled up yet (e.g. today) from their logs.
+ */
+void logstore_totals(ulong start, ulong end, LogRollup *totals) {
+	memset(totals, 0, sizeof(LogRollup)*MAX_NUM_STATIONS);
+	logstore_flush();
+	// the log writer updates the rollups when the day rolls over: read
+	// them with log_flock held, but take it for one day at a time for the
+	// days that are read from their logs, so a long range does not hold
+	// up the writer
+	pthread_mutex_lock(&log_flock);
+	ulong rolled = logstore_last_rollup();
+	char path[PATH_MAX];
+	logstore_path(path, LOGSTORE_DAILY_FILE);
+	FILE *daily = fopen(path, "rb");
+	logstore_path(path, LOGSTORE_MONTHLY_FILE);
+	FILE *monthly = fopen(path, "rb");
+
+	ulong day = start;
+	while(day<=end && day<=rolled) {
+		ulong first, n;
+		uint32_t key = logstore_month(day, &first, &n);
+		ulong last = first+n-1;
+		if(day==first && last<=end && last<=rolled && monthly) {
+			// whole month
+			LogRollup row;
+			fseek(monthly, 0, SEEK_SET);
+			while(fread(&row, sizeof(row), 1, monthly)==1) {
+				if(row.key!=key || row.sid>=MAX_NUM_STATIONS) continue;
+				totals[row.sid].count += row.count;
+				totals[row.sid].runtime += row.runtime;
+				totals[row.sid].volume += row.volume;
+			}
+		} else {
+			// part of a month
+			if(last>end) last = end;
+			if(last>rolled) last = rolled;
+			if(daily) logstore_add_daily(daily, day, last, totals);
+		}
+		day = last+1;
+	}
+	if(daily) fclose(daily);
+	if(monthly) fclose(monthly);
+	pthread_mutex_unlock(&log_flock);
+
+	for(; day<=end; day++) {
+		pthread_mutex_lock(&log_flock);
+		if(log_dat && log_day==day) {
+			fflush(log_dat);
+			fflush(log_idx);
+		}
+		logstore_sum_day(day, totals);
+		pthread_mutex_unlock(&log_flock);
+	}
+}
+
+/** Print a record in the JSON log format:
+ * station record: [pid,sid,dur,end(,gpm(,volume))]
+ * special record: [value,"xx",value2,end]
+ * Returns the number of characters written
+ */
+int logstore_print(const LogRecord *r, char *buf) {
+	if(r->type == LOGDATA_STATION) {
+		int n = sprintf(buf, "[%u,%u,%lu,%lu", r->pid, r->sid, (ulong)r->value, (ulong)r->end);
+		if(r->flags & LOGREC_FLAG_GPM) {
+			n += sprintf(buf+n, ",%5.2f", r->gpm);
+			if(r->flags & LOGREC_FLAG_VOLUME) n += sprintf(buf+n, ",%.2f", r->value2/100.f);
+		}
+		buf[n++] = ']';
+		buf[n] = 0;
+		return n;
+	}
+	byte t = (r->type==LOGDATA_CURRENT) ? LOGSTORE_NUM_TYPES-1 : r->type;
+	if(t >= LOGSTORE_NUM_TYPES) t = 0;
+	return sprintf(buf, "[%lu,\"%.2s\",%lu,%lu]", (ulong)r->value, log_type_names+t*3, (ulong)r->value2, (ulong)r->end);
+}
+
+LogReader::LogReader() : dat(NULL), idx(NULL) {
+	set_filter(0, ULONG_MAX, LOGSTORE_TYPE_ALL);
+}
+
+LogReader::~LogReader() {
+	close();
+}
+
+/** Open the log store files of a day
+ * Returns false if the day has no binary log
+ */
+bool LogReader::open(ulong day) {
+	close();
+	block = 0;
+	indexed = 0;
+	char path[PATH_MAX];
+	logstore_filename(path, day, ".dat");
+	dat = fopen(path, "rb");
+	if(!dat) return open_archive(day);
+	LogFileHeader hdr;
+	if(fread(&hdr, sizeof(hdr), 1, dat)!=1 || hdr.magic!=LOGSTORE_MAGIC || hdr.record_size!=sizeof(LogRecord)) {
+		close();
+		return false;
+	}
+	base = sizeof(LogFileHeader);
+	nrec = ULONG_MAX;
+	nidx = ULONG_MAX;
+	// without an index, fall back to a sequential scan of all records
+	logstore_filename(path, day, ".idx");
+	idx = fopen(path, "rb");
+	remain = idx ? 0 : ULONG_MAX;
+	return true;
+}
+
+/** Open the chunk of a day in its monthly archive */
+bool LogReader::open_archive(ulong day) {
+	char path[PATH_MAX];
+	logstore_filename(path, logstore_month(day), ".arc");
+	dat = fopen(path, "rb");
+	if(!dat) return false;
+	LogArchiveChunk c;
+	if(!logstore_find_chunk(dat, day, &c) || (idx=fopen(path, "rb"))==NULL) {
+		close();
+		return false;
+	}
+	base = ftell(dat);
+	nrec = c.nrec;
+	nidx = c.nidx;
+	fseek(idx, base+nrec*sizeof(LogRecord), SEEK_SET);
+	remain = 0;
+	return true;
+}
+
+void LogReader::close() {
+	if(dat) {fclose(dat); dat=NULL;}
+	if(idx) {fclose(idx); idx=NULL;}
+}
+
+/** Set query filters
+ * from, to: time range (inclusive)
+ * typemask: combination of logstore_type_bit()
+ * sid: station index, or -1 for all stations
+ */
+void LogReader::set_filter(ulong _from, ulong _to, uint16_t _typemask, int _sid) {
+	from = _from;
+	to = _to;
+	typemask = _typemask;
+	sid = _sid;
+}
+
+bool LogReader::block_match(const LogIndexEntry *e) {
+	if(e->count==0) return false;
+	if(e->last_time < from || e->first_time > to) return false;
+	if(!(e->typemask & typemask)) return false;
+	if(sid>=0 && !(e->sidmask[(sid>>5)&1] & (1UL<<(sid&31)))) return false;
+	return true;
+}
+
+bool LogReader::record_match(const LogRecord *r) {
+	if(r->end < from || r->end > to) return false;
+	if(!(logstore_type_bit(r->type) & typemask)) return false;
+	if(sid>=0 && (r->type!=LOGDATA_STATION || r->sid!=sid)) return false;
+	return true;
+}
+
+/** Read the next record matching the filters
+ * Returns false when there are no more records
+ */
+bool LogReader::next(LogRecord *rec) {
+	if(!dat) return false;
+	while(true) {
+		while(remain>0) {
+			remain--;
+			if(fread(rec, sizeof(LogRecord), 1, dat)!=1) {
+				remain = 0;
+				if(!idx) return false;
+				break;
+			}
+			if(record_match(rec)) return true;
+		}
+		if(!idx) return false;
+		// skip to the next block whose summary matches the filters
+		LogIndexEntry e;
+		do {
+			if(nidx==0 || fread(&e, sizeof(e), 1, idx)!=1) {
+				// records appended after the last index update are scanned sequentially
+				fclose(idx);
+				idx = NULL;
+				fseek(dat, base + indexed*sizeof(LogRecord), SEEK_SET);
+				remain = nrec-indexed;
+				break;
+			}
+			nidx--;
+			block++;
+			indexed = (block-1)*LOGSTORE_BLOCK_SIZE + e.count;
+		} while(!block_match(&e));
+		if(!idx) continue;
+		fseek(dat, base + (block-1)*LOGSTORE_BLOCK_SIZE*sizeof(LogRecord), SEEK_SET);
+		remain = e.count;
+	}
+}
+
+#endif // !ARDUINO
@@ -0,0 +1,153 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Binary log store header file
+ * Feb 2015 @ OpenSprinkler.com
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LOGSTORE_H
+#define _LOGSTORE_H
+
+#if !defined(ARDUINO)
+
+#include <stdio.h>
+#include <stdint.h>
+#include "defines.h"
+
+/* On RPI/BBB, each day of log is stored as two files:
+ *   logs/xxxxx.dat - append-only array of fixed-size LogRecord
+ *   logs/xxxxx.idx - sparse index, one LogIndexEntry per LOGSTORE_BLOCK_SIZE records
+ * where xxxxx is the day in epoch time. Queries consult the
+ * index first and only read the record blocks that can match.
+ * Older days are packed into monthly archives logs/yyyymm.arc,
+ * and summed up per station in logs/daily.sum and logs/monthly.sum.
+ */
+#define LOGSTORE_MAGIC					0x474C534F	// 'OSLG'
+#define LOGSTORE_VERSION				1
+#define LOGSTORE_BLOCK_SIZE			32		// number of records covered by each index entry
+#define LOGSTORE_TYPE_ALL				0xFFFF
+
+#ifndef LOGSTORE_QUEUE_SIZE
+#define LOGSTORE_QUEUE_SIZE			64		// number of records buffered for the log writer
+#endif
+#ifndef LOGSTORE_ARCHIVE_DAYS
+#define LOGSTORE_ARCHIVE_DAYS		31		// day files older than this are packed into monthly archives
+#endif
+#ifndef LOGSTORE_RETENTION_DAYS
+#define LOGSTORE_RETENTION_DAYS	0		// logs older than this are removed (0: keep forever)
+#endif
+#define LOGSTORE_MAX_DAYS				1024	// maximum number of day files processed per maintenance pass
+#define LOGSTORE_DAILY_FILE			"daily.sum"
+#define LOGSTORE_MONTHLY_FILE		"monthly.sum"
+
+#ifndef LOGSTORE_SYNC_INTERVAL
+#define LOGSTORE_SYNC_INTERVAL	30		// maximum seconds between fsync of log files
+#endif
+
+#define LOGREC_FLAG_GPM					0x01	// record carries a flow rate
+#define LOGREC_FLAG_VOLUME			0x02	// station record carries a flow volume (value2, in 1/100 pulses)
+
+/** Binary log file header */
+struct LogFileHeader {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t record_size;
+};
+
+/** Fixed-size log record */
+struct LogRecord {
+	uint32_t end;			// record (end) time
+	uint32_t value;		// station: duration; special record: first value
+	uint32_t value2;	// station: flow volume; special record: second value (e.g. active duration)
+	float    gpm;			// station: flow rate (valid if LOGREC_FLAG_GPM is set)
+	uint8_t  type;		// LOGDATA_xxx
+	uint8_t  pid;			// station: program index
+	uint8_t  sid;			// station: station index
+	uint8_t  flags;
+};
+
+/** Sparse index entry, summarizes one block of records */
+struct LogIndexEntry {
+	uint32_t first_time;
+	uint32_t last_time;
+	uint16_t typemask;	// bit set for each record type present in the block
+	uint16_t count;			// number of records in the block
+	uint32_t sidmask[2];// bit (sid%64) set for each station present in the block
+};
+
+/** Archive chunk header, followed by nrec records and nidx index entries */
+struct LogArchiveChunk {
+	uint32_t magic;
+	uint32_t day;
+	uint32_t nrec;
+	uint32_t nidx;
+};
+
+#define LOGROLLUP_END		0xFF	// sid of the row terminating a day in the daily rollups
+
+/** Per-station rollup of station runs over a day or a month */
+struct LogRollup {
+	uint32_t key;			// day, or month (yyyymm)
+	uint8_t  sid;
+	uint8_t  reserved;
+	uint16_t count;		// number of runs
+	uint32_t runtime;	// total run time (seconds)
+	float    volume;	// total flow volume
+};
+
+/** Sequential reader with time / type / station filters */
+class LogReader {
+public:
+	LogReader();
+	~LogReader();
+	bool open(ulong day);
+	void close();
+	void set_filter(ulong from, ulong to, uint16_t typemask, int sid=-1);
+	bool next(LogRecord *rec);
+private:
+	bool open_archive(ulong day);
+	bool block_match(const LogIndexEntry *e);
+	bool record_match(const LogRecord *r);
+	FILE *dat;
+	FILE *idx;
+	long base;				// file offset of the first record
+	ulong nrec;				// number of records (archive chunk only)
+	ulong nidx;				// index entries left to read (archive chunk only)
+	ulong block;			// index of the current block
+	ulong remain;			// records left to read in the current block
+	ulong indexed;		// number of records covered by the index entries read so far
+	ulong from, to;
+	uint16_t typemask;
+	int sid;
+};
+
+extern const char log_type_names[];
+
+uint16_t logstore_type_bit(byte type);
+int  logstore_type_from_name(const char *name);
+bool logstore_append(ulong day, const LogRecord *rec);
+void logstore_flush();
+void logstore_remove(ulong day);
+void logstore_remove_all();
+void logstore_totals(ulong start, ulong end, LogRollup *totals);
+int  logstore_print(const LogRecord *rec, char *buf);
+
+#endif // !ARDUINO
+
+#endif // _LOGSTORE_H
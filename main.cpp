@@ -28,6 +28,13 @@
 #include "weather.h"
 #include "server.h"
 #include "mqtt.h"
+#include "logstore.h"
+#include "notify.h"
+#include "httpclient.h"
+#include "dnscache.h"
+#include "et.h"
+#include "webhook.h"
+#include "tz.h"
 
 #if defined(ARDUINO)
 	EthernetServer *m_server = NULL;
@@ -60,6 +67,10 @@ void remote_http_callback(char*);
 #define CHECK_WEATHER_SUCCESS_TIMEOUT 86400L // Weather check success interval: 24 hrs
 #define LCD_BACKLIGHT_TIMEOUT		15			// LCD backlight timeout: 15 secs
 #define PING_TIMEOUT						200			// Ping test timeout: 200 ms
+#define FLOW_LEARN_DELAY				60			// Wait time after a station starts before learning its flow rate: 60 secs
+#define FLOW_LEARN_MIN_TIME			30			// Minimum time a station must run alone to update its flow rate: 30 secs
+#define FLOW_LEARN_MAX_GAP			60			// Longer gaps between flow updates (e.g. clock changes) are not learned from: 60 secs
+#define FLOW_DEBOUNCE_US				500			// Edges closer than this to the previous one are switch bounce, not pulses
 
 // Define buffers: need them to be sufficiently large to cover string option reading
 char ether_buffer[ETHER_BUFFER_SIZE+TMP_BUFFER_SIZE]; // ethernet buffer
@@ -69,16 +80,46 @@ char tmp_buffer[TMP_BUFFER_SIZE+MAX_SOPTS_SIZE+1];		 // scratch buffer
 OpenSprinkler os; // OpenSprinkler object
 ProgramData pd;		// ProgramdData object
 
-/* ====== Robert Hillman (RAH)'s implementation of flow sensor ======
- * flow_begin - time when valve turns on
- * flow_start - time when flow starts being measured (i.e. 2 mins after flow_begin approx
- * flow_stop - time when valve turns off (last rising edge pulse detected before off)
- * flow_gallons - total # of gallons+1 from flow_start to flow_stop
- * flow_last_gpm - last flow rate measured (averaged over flow_gallons) from last valve stopped (used to write to log file). */
-ulong flow_begin, flow_start, flow_stop, flow_gallons;
+/* ====== Flow sensor ======
+ * flow_count - total number of pulses counted
+ * flow_run - pulses attributed to each station during its current run
+ * flow_last_gpm - flow rate (pulses per minute) of the last station run (used to write to log file)
+ * flow_last_volume - flow (pulses) of the last station run (used to write to log file)
+ *
+ * Pulses counted in each second are apportioned to the stations that
+ * are on, weighted by their learned nominal flow rate. The nominal rate
+ * of a station is learned while it runs alone, once the flow has settled
+ * (FLOW_LEARN_DELAY seconds after the station started).
+ *
+ * On RPI/BBB, falling edges of the sensor are queued with their
+ * timestamps by the gpio edge event thread, so no pulse is missed when
+ * the main loop is blocked; edges dropped because the queue was full
+ * are still counted. Other platforms poll the sensor every 1ms.
+ * Edges within FLOW_DEBOUNCE_US of the previous one are ignored. */
 ulong flow_count = 0;
 byte prev_flow_state = HIGH;
+float flow_run[MAX_NUM_STATIONS];
 float flow_last_gpm=0;
+float flow_last_volume=0;
+static byte flow_solo_sid = 0xFF;	// station being learned
+static ulong flow_solo_pulses = 0;
+static ulong flow_solo_secs = 0;
+static ulong flow_pulse_first = 0;	// time (us) of the first pulse in the real-time window
+static ulong flow_pulse_last = 0;		// time (us) of the last pulse in the real-time window
+static ulong flow_pulse_count = 0;	// number of pulses in the real-time window
+static ulong flow_edge_last = 0;		// time (us) of the last counted pulse
+static bool flow_edge_seen = false;
+
+/** Count a flow pulse detected at time ts (in microseconds) */
+static void flow_pulse(ulong ts) {
+	if(flow_edge_seen && ts-flow_edge_last<FLOW_DEBOUNCE_US) return;	// bounce
+	flow_edge_seen = true;
+	flow_edge_last = ts;
+	if(!flow_pulse_count) flow_pulse_first = ts;
+	flow_pulse_last = ts;
+	flow_pulse_count++;
+	flow_count++;
+}
 
 void flow_poll() {
 	#if defined(ESP8266)
@@ -90,16 +131,103 @@ void flow_poll() {
 		return;
 	}
 	prev_flow_state = curr_flow_state;
-	ulong curr = millis();
-	flow_count++;
+	flow_pulse(micros());
+}
+
+#if defined(OSPI) || defined(OSBO)
+#define FLOW_EDGE_NONE		0
+#define FLOW_EDGE_ACTIVE	1
+#define FLOW_EDGE_FAILED	2
+static byte flow_edge_state = FLOW_EDGE_NONE;
+
+/** Count the flow pulses queued by the gpio edge event thread
+ * Returns false if edge events are not available, in which case
+ * the sensor needs to be polled
+ */
+static bool flow_edge_poll(bool count) {
+	if(flow_edge_state==FLOW_EDGE_NONE) {
+		if(!count) return false;
+		flow_edge_state = attachEdgeEvents(PIN_SENSOR1, "falling") ? FLOW_EDGE_ACTIVE : FLOW_EDGE_FAILED;
+		if(flow_edge_state!=FLOW_EDGE_ACTIVE) DEBUG_PRINTLN(F("flow sensor: edge events unavailable, polling"));
+	}
+	if(flow_edge_state!=FLOW_EDGE_ACTIVE) return false;
+	ulong ts;
+	while(readEdgeEvent(PIN_SENSOR1, &ts)) {
+		if(count) flow_pulse(ts);
+	}
+	// pulses lost to a full queue are counted, without timestamps
+	ulong dropped = readEdgeDropped(PIN_SENSOR1);
+	if(count && dropped) {
+		flow_count += dropped;
+		DEBUG_PRINT(F("flow sensor: edge queue full, pulses without timestamp: "));
+		DEBUG_PRINTLN(dropped);
+	}
+	return true;
+}
+#endif
 
-	/* RAH implementation of flow sensor */
-	if (flow_start==0) { flow_gallons=0; flow_start=curr;}	// if first pulse, record time
-	if ((curr-flow_start)<90000) { flow_gallons=0; } // wait 90 seconds before recording flow_begin
-	else {	if (flow_gallons==1)	{  flow_begin = curr;}}
-	flow_stop = curr; // get time in ms for stop
-	flow_gallons++;  // increment gallon count for each poll
-	/* End of RAH implementation of flow sensor */
+/** Update the nominal flow rate of the station being learned */
+static void flow_learn_update() {
+	if (flow_solo_sid<MAX_NUM_STATIONS && flow_solo_secs>=FLOW_LEARN_MIN_TIME) {
+		float rate = (float)flow_solo_pulses*60/flow_solo_secs;
+		StationFlowData *f = os.flow_stats+flow_solo_sid;
+		f->nominal = (f->nominal>0) ? (f->nominal*3+rate)/4 : rate;
+		os.flowstats_changed(flow_solo_sid);
+	}
+	flow_solo_sid = 0xFF;
+	flow_solo_pulses = 0;
+	flow_solo_secs = 0;
+}
+
+/** Attribute the pulses counted since the last call
+ * to the stations that are currently on
+ * This function is called once per second, elapsed is the
+ * number of seconds since the last call
+ */
+void flow_attribute(ulong curr_time, long elapsed) {
+	static ulong last_count = 0;
+	ulong pulses = flow_count - last_count;
+	last_count = flow_count;
+
+	byte sid, n=0, nknown=0, solo=0xFF;
+	float known=0;
+	for(sid=0;sid<os.nstations;sid++) {
+		if (!((os.station_bits[sid>>3]>>(sid&0x07))&1)) continue;
+		if (os.status.mas==sid+1 || os.status.mas2==sid+1) continue;	// master stations carry the flow of others
+		n++;
+		solo = sid;
+		if (os.flow_stats[sid].nominal>0) {
+			known += os.flow_stats[sid].nominal;
+			nknown++;
+		}
+	}
+	if (n!=1) solo = 0xFF;
+
+	// learn the nominal rate of a station running alone
+	if (solo!=0xFF) {
+		byte qid = pd.station_qid[solo];
+		if (qid>=pd.nqueue || curr_time < pd.queue[qid].st+FLOW_LEARN_DELAY) solo = 0xFF;
+	}
+	if (solo!=flow_solo_sid) flow_learn_update();
+	if (solo!=0xFF && elapsed>0 && elapsed<=FLOW_LEARN_MAX_GAP) {
+		flow_solo_sid = solo;
+		flow_solo_pulses += pulses;
+		flow_solo_secs += elapsed;
+	}
+
+	if (!n || !pulses) return;
+	// stations that have not been learned yet weigh as much as the average learned station
+	float dflt = nknown ? known/nknown : 1;
+	float wsum = known + (n-nknown)*dflt;
+	for(sid=0;sid<os.nstations;sid++) {
+		if (!((os.station_bits[sid>>3]>>(sid&0x07))&1)) continue;
+		if (os.status.mas==sid+1 || os.status.mas2==sid+1) continue;
+		float w = (os.flow_stats[sid].nominal>0) ? os.flow_stats[sid].nominal : dflt;
+		float share = pulses*w/wsum;
+		flow_run[sid] += share;
+		os.flow_stats[sid].volume += share;
+		os.flowstats_changed(sid);
+	}
 }
 
 #if defined(ARDUINO)
@@ -124,7 +252,7 @@ bool ui_confirm(PGM_P str) {
 		if((button&BUTTON_MASK)==BUTTON_3 && (button&BUTTON_FLAG_DOWN)) return true;
 		if((button&BUTTON_MASK)==BUTTON_1 && (button&BUTTON_FLAG_DOWN)) return false;
 		delay(10);
-	} while(millis() < timeout);
+	} while((long)(millis()-timeout)<0);
 	return false;
 }
 
@@ -134,7 +262,7 @@ void ui_state_machine() {
 	// process screen led
 	static ulong led_toggle_timeout = 0;
 	if(led_blink_ms) {
-		if(millis()>led_toggle_timeout) {
+		if((long)(millis()-led_toggle_timeout)>0) {
 			os.toggle_screen_led();
 			led_toggle_timeout = millis() + led_blink_ms;
 		}
@@ -352,6 +480,18 @@ ISR(WDT_vect)
 
 void do_setup() {
 	initialiseEpoch();	 // initialize time reference for millis() and micros()
+
+	// seed random() differently on each controller, so that
+	// retries (e.g. of the weather call) do not happen in lockstep
+	ulong seed = time(NULL) ^ micros() ^ ((ulong)getpid()<<16);
+	FILE *fp = fopen("/dev/urandom", "rb");
+	if (fp) {
+		ulong r;
+		if (fread(&r, sizeof(r), 1, fp)==1) seed ^= r;
+		fclose(fp);
+	}
+	srandom(seed);
+
 	os.begin();					 // OpenSprinkler init
 	os.options_setup();  // Setup options
 
@@ -368,11 +508,17 @@ void do_setup() {
 
 	os.mqtt.init();
 	os.status.req_mqtt_restart = true;
+
+	et_begin();	// load local weather observations
+	webhook_begin();	// load webhooks
+	tz_begin();	// load the time zone
 }
 #endif
 
 void write_log(byte type, ulong curr_time);
 void schedule_all_stations(ulong curr_time);
+static void shift_local_times(long delta);
+static bool check_match_minutes(ProgramStruct *prog, ulong first, ulong last);
 void turn_on_station(byte sid);
 void turn_off_station(byte sid, ulong curr_time);
 void process_dynamic_events(ulong curr_time);
@@ -389,12 +535,55 @@ unsigned long reboot_timer = 0;
 
 void handle_web_request(char *p);
 
+/** Per-station water percentages
+ * Resolved once per weather update (or station change), instead of
+ * per program match: the water percentage scaled by each station's
+ * crop coefficient, or with local ET, each zone's soil water depletion
+ * relative to ET_BASE. Both are capped at 250%, like the water percentage.
+ */
+static uint16_t station_wl[MAX_NUM_STATIONS];
+static long station_wl_key = -1;	// settings the percentages were resolved for (-1: invalid)
+
+void station_wl_invalidate() {
+	station_wl_key = -1;
+}
+
+uint16_t station_water_percentage(byte sid) {
+	byte wl = os.iopts[IOPT_WATER_PERCENTAGE];
+	bool balance = false;
+#if !defined(ARDUINO)
+	balance = (os.iopts[IOPT_USE_WEATHER]==WEATHER_METHOD_LOCAL_ET && os.checkwt_success_lasttime);
+#endif
+	long key = (long)wl | ((long)balance<<8) | ((long)os.nstations<<9);
+	if (key != station_wl_key) {
+		for(byte i=0;i<os.nstations;i++) {
+#if !defined(ARDUINO)
+			if (balance) {
+				float v = et_depletion(i)*100/(float)ET_BASE;
+				station_wl[i] = (v>250) ? 250 : (uint16_t)(v+0.5f);
+				continue;
+			}
+#endif
+			uint16_t v = (uint16_t)wl * os.get_station_kc(i) / 100;
+			station_wl[i] = (v>250) ? 250 : v;
+		}
+		station_wl_key = key;
+	}
+	return (sid<os.nstations) ? station_wl[sid] : wl;
+}
+
 /** Main Loop */
 void do_loop()
 {
-	// handle flow sensor using polling every 1ms (maximum freq 1/(2*1ms)=500Hz)
+	// handle flow sensor using edge events if available,
+	// otherwise polling every 1ms (maximum freq 1/(2*1ms)=500Hz)
 	static ulong flowpoll_timeout=0;
-	if(os.iopts[IOPT_SENSOR1_TYPE]==SENSOR_TYPE_FLOW) {
+#if defined(OSPI) || defined(OSBO)
+	bool flow_edge = flow_edge_poll(os.iopts[IOPT_SENSOR1_TYPE]==SENSOR_TYPE_FLOW);
+#else
+	bool flow_edge = false;
+#endif
+	if(os.iopts[IOPT_SENSOR1_TYPE]==SENSOR_TYPE_FLOW && !flow_edge) {
 		ulong curr = millis();
 		if(curr!=flowpoll_timeout) {
 			flowpoll_timeout = curr;
@@ -404,13 +593,18 @@ void do_loop()
 
 	static ulong last_time = 0;
 	static ulong last_minute = 0;
+	static long last_offset = LONG_MIN;
+	static long offset_delta = 0;		// change of the time zone offset since the last minute
+	static ulong repeat_start = 0, repeat_end = 0;	// repeated minutes after the clock went back
 
 	byte bid, sid, s, pid, qid, bitvalue;
 	ProgramStruct prog;
 
 	os.status.mas = os.iopts[IOPT_MASTER_STATION];
 	os.status.mas2= os.iopts[IOPT_MASTER_STATION_2];
-	time_t curr_time = os.now_tz();
+	time_t curr_utc = now();
+	long curr_offset = os.utc_offset(curr_utc);
+	time_t curr_time = curr_utc + curr_offset;
 	
 	// ====== Process Ethernet packets ======
 #if defined(ARDUINO)	// Process Ethernet packets for Arduino
@@ -476,7 +670,7 @@ void do_loop()
 				os.state = OS_STATE_CONNECTED;
 				connecting_timeout = 0;
 			} else {
-				if(millis()>connecting_timeout) {
+				if((long)(millis()-connecting_timeout)>0) {
 					os.state = OS_STATE_INITIAL;
 					DEBUG_PRINTLN(F("timeout"));
 				}
@@ -554,12 +748,21 @@ void do_loop()
 			} else {
 				m_client = &client;
 				ether_buffer[len] = 0;	// put a zero at the end of the packet
+				// keep the connection open for the next request if asked to
+				if(strcasestr(ether_buffer, "Connection: keep-alive")) client.keepalive();
 				handle_web_request(ether_buffer);
 				m_client = 0;
+				m_server->keep(client);
 				break;
 			}
 		}
 	}
+
+	// send remote station commands and notifications queued during
+	// this loop, then process outgoing http requests
+	os.flush_remote_commands();
+	notify_poll();
+	httpclient_poll();
 #endif	// Process Ethernet packets
 
 	// Start up MQTT when we have a network connection
@@ -615,11 +818,28 @@ void do_loop()
 		pinModeExt(PIN_SENSOR2, INPUT_PULLUP);
 		#endif
 		
+		long elapsed = (long)(curr_time - last_time);	// more than 1 if the loop was blocked
 		last_time = curr_time;
 		if (os.button_timeout) os.button_timeout--;
+
+		// ====== Check time zone offset (DST) ======
+		if (curr_offset != last_offset) {
+			if (last_offset != LONG_MIN) {
+				offset_delta += curr_offset - last_offset;
+				shift_local_times(curr_offset - last_offset);
+				elapsed -= curr_offset - last_offset;
+			}
+			last_offset = curr_offset;
+		}
+
+		// attribute flow since the last pass to the stations that were on
+		if (os.iopts[IOPT_SENSOR1_TYPE]==SENSOR_TYPE_FLOW) {
+			flow_attribute(curr_time, elapsed);
+		}
+		os.flowstats_save();
 		
 		#if defined(ESP8266)
-		if(reboot_timer && millis() > reboot_timer) {
+		if(reboot_timer && (long)(millis()-reboot_timer)>0) {
 			os.reboot_dev(REBOOT_CAUSE_TIMER);
 		}
 		#endif
@@ -702,12 +922,24 @@ void do_loop()
 		// since the granularity of start time is minute
 		// we only need to check once every minute
 		if (curr_minute != last_minute) {
+			// when the clock went forward (e.g. 23-hour DST day), the skipped
+			// minutes are checked too; when it went back (25-hour day), the
+			// repeated minutes are not checked again
+			ulong first_minute = curr_minute;
+			if (offset_delta>0 && curr_minute>last_minute && curr_minute-last_minute<=(ulong)offset_delta/60+1) {
+				first_minute = last_minute+1;
+			} else if (offset_delta<0 && curr_minute<last_minute) {
+				repeat_start = curr_minute;
+				repeat_end = last_minute;
+			}
+			offset_delta = 0;
 			last_minute = curr_minute;
+			bool repeated = (curr_minute>=repeat_start && curr_minute<=repeat_end);
 			// check through all programs
-			for(pid=0; pid<pd.nprograms; pid++) {
+			for(pid=0; pid<pd.nprograms && !repeated; pid++) {
 				delay(0);
 				pd.read(pid, &prog);	// todo future: reduce load time
-				if(prog.check_match(curr_time)) {
+				if(check_match_minutes(&prog, first_minute, curr_minute)) {
 					// program match found
 					// process all selected stations
 					for(sid=0;sid<os.nstations;sid++) {
@@ -723,7 +955,7 @@ void do_loop()
 							ulong water_time = water_time_resolve(prog.durations[sid]);
 							// if the program is set to use weather scaling
 							if (prog.use_weather) {
-								byte wl = os.iopts[IOPT_WATER_PERCENTAGE];
+								uint16_t wl = station_water_percentage(sid);
 								water_time = water_time * wl / 100;
 								if (wl < 20 && water_time < 10) // if water_percentage is less than 20% and water_time is less than 10 seconds
 																								// do not water
@@ -968,6 +1200,8 @@ void do_loop()
 			if (curr_time % FLOWCOUNT_RT_WINDOW == 0) {
 				os.flowcount_rt = (flow_count > flowcount_rt_start) ? flow_count - flowcount_rt_start: 0;
 				flowcount_rt_start = flow_count;
+				os.flowpulse_rt = (flow_pulse_count>1) ? (flow_pulse_last-flow_pulse_first)/(flow_pulse_count-1) : 0;
+				flow_pulse_count = 0;
 			}
 		}
 
@@ -1009,12 +1243,71 @@ void do_loop()
 }
 
 /** Make weather query */
+#if !defined(ARDUINO)
+/** Latitude from the location option (0 if the location is not a coordinate) */
+static float location_latitude() {
+	float lat, lon;
+	os.sopt_load(SOPT_LOCATION, tmp_buffer);
+	if (sscanf(tmp_buffer, "%f,%f", &lat, &lon)!=2 || lat<-90 || lat>90) return 0;
+	return lat;
+}
+
+/** Set water percentage from local weather observations
+ * Returns false if there are no recent observations
+ */
+static bool check_weather_local(ulong ntz) {
+	ulong today = ntz / 86400L;
+	float lat = location_latitude();
+	byte kc[MAX_NUM_STATIONS];
+	for(byte sid=0;sid<MAX_NUM_STATIONS;sid++) {
+		kc[sid] = (sid<os.nstations) ? os.get_station_kc(sid) : 100;
+	}
+	et_balance_update(today, lat, kc);
+	station_wl_invalidate();
+	int scale = et_scale(today, lat);
+	if (scale<0) return false;
+
+	wt_errCode = 0;
+	os.checkwt_success_lasttime = ntz;
+	if (scale != os.iopts[IOPT_WATER_PERCENTAGE]) {
+		os.iopts[IOPT_WATER_PERCENTAGE] = scale;
+		os.iopts_save();
+		os.weather_update_flag |= WEATHER_UPDATE_WL;
+	}
+	const ETObservation *obs = et_latest();
+	snprintf(wt_rawData, TMP_BUFFER_SIZE, "{\"et0\":%.2f,\"day\":%lu}", et_compute(obs, lat), obs->day);
+	write_log(LOGDATA_WATERLEVEL, ntz);
+	return true;
+}
+#endif
+
 void check_weather() {
+#if !defined(ARDUINO)
+	// local weather observations need no network
+	if (os.iopts[IOPT_USE_WEATHER]==WEATHER_METHOD_LOCAL_ET && !os.iopts[IOPT_REMOTE_EXT_MODE]) {
+		ulong ntz = os.now_tz();
+		if (et_refresh()) os.checkwt_lasttime = 0;	// a script has added observations
+		if (!os.checkwt_lasttime || (ntz > os.checkwt_lasttime + CHECK_WEATHER_TIMEOUT) ||
+				(ntz/86400L != os.checkwt_lasttime/86400L)) {
+			os.checkwt_lasttime = ntz;
+			if (!check_weather_local(ntz)) wt_errCode = HTTP_RQT_NOT_RECEIVED;
+		}
+		if (os.checkwt_success_lasttime && (ntz > os.checkwt_success_lasttime + CHECK_WEATHER_SUCCESS_TIMEOUT)) {
+			os.checkwt_success_lasttime = 0;
+			os.iopts[IOPT_WATER_PERCENTAGE] = 100;	// no observations for too long
+		}
+		return;
+	}
+#endif
 	// do not check weather if
 	// - network check has failed, or
 	// - the controller is in remote extension mode
 	if (os.status.network_fails>0 || os.iopts[IOPT_REMOTE_EXT_MODE]) return;
+#if defined(ARDUINO)
+	// on RPI/BBB, the weather call does not block the main loop,
+	// so weather can be updated while a program is running
 	if (os.status.program_busy) return;
+#endif
 	
 #if defined(ESP8266)
 	if (!m_server) {
@@ -1023,6 +1316,15 @@ void check_weather() {
 #endif
 
 	ulong ntz = os.now_tz();
+#if !defined(ARDUINO)
+	// resolve the weather server before the next weather call is due
+	if (!os.checkwt_lasttime || (ntz + DNSCACHE_PREFETCH_TIME > os.checkwt_lasttime + CHECK_WEATHER_TIMEOUT)) {
+		os.sopt_load(SOPT_WEATHERURL, tmp_buffer);
+		char *port = strchr(tmp_buffer, ':');
+		if (port) *port = 0;
+		dnscache_prefetch(tmp_buffer);
+	}
+#endif
 	if (os.checkwt_success_lasttime && (ntz > os.checkwt_success_lasttime + CHECK_WEATHER_SUCCESS_TIMEOUT)) {
 		// if last successful weather call timestamp is more than allowed threshold
 		// and if the selected adjustment method is not manual
@@ -1030,12 +1332,17 @@ void check_weather() {
 		// todo: the firmware currently needs to be explicitly aware of which adjustment methods
 		// use manual watering percentage (namely methods 0 and 2), this is not ideal
 		os.checkwt_success_lasttime = 0;
-		if(!(os.iopts[IOPT_USE_WEATHER]==0 || os.iopts[IOPT_USE_WEATHER]==2)) {
+		if(!(os.iopts[IOPT_USE_WEATHER]==0 || os.iopts[IOPT_USE_WEATHER]==2)
+#if !defined(ARDUINO)
+			 && !check_weather_local(ntz)	// fall back to local weather observations if there are any
+#endif
+			) {
 			os.iopts[IOPT_WATER_PERCENTAGE] = 100; // reset watering percentage to 100%
 			wt_rawData[0] = 0; 		// reset wt_rawData and errCode
 			wt_errCode = HTTP_RQT_NOT_RECEIVED;
 		}
-	} else if (!os.checkwt_lasttime || (ntz > os.checkwt_lasttime + CHECK_WEATHER_TIMEOUT)) {
+	} else if (!os.checkwt_lasttime || (ntz > os.checkwt_lasttime + CHECK_WEATHER_TIMEOUT) ||
+						 (wt_retryTime && ntz >= wt_retryTime)) {
 		os.checkwt_lasttime = ntz;
 		GetWeather();
 	}
@@ -1045,8 +1352,7 @@ void check_weather() {
  * This function turns on a scheduled station
  */
 void turn_on_station(byte sid) {
-	// RAH implementation of flow sensor
-	flow_start=0;
+	flow_run[sid] = 0;
 
 	if (os.set_station_bit(sid, 1)) {
 		push_message(NOTIFY_STATION_ON, sid);
@@ -1064,15 +1370,15 @@ void turn_off_station(byte sid, ulong curr_time) {
 	// ignore if we are turning off a station that's not running or scheduled to run
 	if (qid>=pd.nqueue)  return;
 
-	// RAH implementation of flow sensor
-	if (flow_gallons>1) {
-		if(flow_stop<=flow_begin) flow_last_gpm = 0;
-		else flow_last_gpm = (float) 60000/(float)((flow_stop-flow_begin)/(flow_gallons-1));
-	}// RAH calculate GPM, 1 pulse per gallon
-	else {flow_last_gpm = 0;}  // RAH if not one gallon (two pulses) measured then record 0 gpm
-
 	RuntimeQueueStruct *q = pd.queue+qid;
 
+	// flow attributed to this station during the run
+	if (os.iopts[IOPT_SENSOR1_TYPE]==SENSOR_TYPE_FLOW) {
+		flow_last_volume = flow_run[sid];
+		flow_last_gpm = (curr_time > q->st) ? flow_run[sid]*60/(curr_time - q->st) : 0;
+		flow_run[sid] = 0;
+	}
+
 	// check if the current time is past the scheduled start time,
 	// because we may be turning off a station that hasn't started yet
 	if (curr_time > q->st) {
@@ -1086,6 +1392,10 @@ void turn_off_station(byte sid, ulong curr_time) {
 			// log station run
 			write_log(LOGDATA_STATION, curr_time);
 			push_message(NOTIFY_STATION_OFF, sid, pd.lastrun.duration);
+#if !defined(ARDUINO)
+			et_watered(sid, pd.lastrun.duration);
+			station_wl_invalidate();
+#endif
 		}
 	}
 
@@ -1143,6 +1453,29 @@ void process_dynamic_events(ulong curr_time) {
 	}
 }
 
+/** Check if a program starts in any minute from first to last */
+static bool check_match_minutes(ProgramStruct *prog, ulong first, ulong last) {
+	for(ulong m=first; m<=last; m++) {
+		if(prog->check_match(m*60)) return true;
+	}
+	return false;
+}
+
+/** Move local time stamps by a change of the time zone offset (e.g. DST)
+ * so that running and queued stations, and the rain delay, keep
+ * their real durations
+ */
+static void shift_local_times(long delta) {
+	for(RuntimeQueueStruct *q=pd.queue; q<pd.queue+pd.nqueue; q++) {
+		if(q->st) q->st += delta;
+	}
+	if(pd.last_seq_stop_time) pd.last_seq_stop_time += delta;
+	if(os.nvdata.rd_stop_time) {
+		os.nvdata.rd_stop_time += delta;
+		os.nvdata_save();
+	}
+}
+
 /** Scheduler
  * This function loops through the queue
  * and schedules the start time of each station
@@ -1250,7 +1583,7 @@ void manual_start_program(byte pid, byte uwt) {
 		else if(pid>0)
 			dur = water_time_resolve(prog.durations[sid]);
 		if(uwt) {
-			dur = dur * os.iopts[IOPT_WATER_PERCENTAGE] / 100;
+			dur = dur * station_water_percentage(sid) / 100;
 		}
 		if(dur>0 && !(os.attrib_dis[bid]&(1<<s))) {
 			RuntimeQueueStruct *q = pd.enqueue();
@@ -1275,175 +1608,184 @@ void ip2string(char* str, byte ip[4]) {
 	sprintf_P(str+strlen(str), PSTR("%d.%d.%d.%d"), ip[0], ip[1], ip[2], ip[3]);
 }
 
-void push_message(int type, uint32_t lval, float fval, const char* sval) {
-	static char topic[TMP_BUFFER_SIZE];
-	static char payload[TMP_BUFFER_SIZE];
-	char* postval = tmp_buffer;
+/** MQTT topic and payload of an event
+ * Returns false if the event is not published on MQTT
+ */
+bool notify_format_mqtt(const NotifyEvent *ev, char *topic, char *payload) {
+	uint32_t lval = ev->lval;
+	float fval = ev->fval;
 	uint32_t volume;
 
-	bool ifttt_enabled = os.iopts[IOPT_IFTTT_ENABLE]&type;
+	topic[0] = 0;
+	payload[0] = 0;
 
-	// check if this type of event is enabled for push notification
-	if (!ifttt_enabled && !os.mqtt.enabled())
-		return;
+	switch(ev->type) {
+		case  NOTIFY_STATION_ON:
+			sprintf_P(topic, PSTR("opensprinkler/station/%d"), lval);
+			strcpy_P(payload, PSTR("{\"state\":1}"));
+			break;
 
-	if (ifttt_enabled) {
-		strcpy_P(postval, PSTR("{\"value1\":\""));
-	}
+		case NOTIFY_STATION_OFF:
+			sprintf_P(topic, PSTR("opensprinkler/station/%d"), lval);
+			if (os.iopts[IOPT_SENSOR1_TYPE]==SENSOR_TYPE_FLOW) {
+				sprintf_P(payload, PSTR("{\"state\":0,\"duration\":%d,\"flow\":%d.%02d}"), (int)fval, (int)ev->flow, (int)(ev->flow*100)%100);
+			} else {
+				sprintf_P(payload, PSTR("{\"state\":0,\"duration\":%d}"), (int)fval);
+			}
+			break;
 
-	if (os.mqtt.enabled()) {
-		topic[0] = 0;
-		payload[0] = 0;
-	}
+		case NOTIFY_SENSOR1:
+			strcpy_P(topic, PSTR("opensprinkler/sensor1"));
+			sprintf_P(payload, PSTR("{\"state\":%d}"), (int)fval);
+			break;
 
-	switch(type) {
-		case  NOTIFY_STATION_ON:
+		case NOTIFY_SENSOR2:
+			strcpy_P(topic, PSTR("opensprinkler/sensor2"));
+			sprintf_P(payload, PSTR("{\"state\":%d}"), (int)fval);
+			break;
 
-			if (os.mqtt.enabled()) {
-				sprintf_P(topic, PSTR("opensprinkler/station/%d"), lval);
-				strcpy_P(payload, PSTR("{\"state\":1}"));
-			}
+		case NOTIFY_RAINDELAY:
+			strcpy_P(topic, PSTR("opensprinkler/raindelay"));
+			sprintf_P(payload, PSTR("{\"state\":%d}"), (int)fval);
 			break;
 
-		case NOTIFY_STATION_OFF:
+		case NOTIFY_FLOWSENSOR:
+			volume = os.iopts[IOPT_PULSE_RATE_1];
+			volume = (volume<<8)+os.iopts[IOPT_PULSE_RATE_0];
+			volume = lval*volume;
+			strcpy_P(topic, PSTR("opensprinkler/sensor/flow"));
+			sprintf_P(payload, PSTR("{\"count\":%d,\"volume\":%d.%02d}"), lval, (int)volume/100, (int)volume%100);
+			break;
 
-			if (os.mqtt.enabled()) {
-				sprintf_P(topic, PSTR("opensprinkler/station/%d"), lval);
-				if (os.iopts[IOPT_SENSOR1_TYPE]==SENSOR_TYPE_FLOW) {
-					sprintf_P(payload, PSTR("{\"state\":0,\"duration\":%d,\"flow\":%d.%02d}"), (int)fval, (int)flow_last_gpm, (int)(flow_last_gpm*100)%100);
-				} else {
-					sprintf_P(payload, PSTR("{\"state\":0,\"duration\":%d}"), (int)fval);
-				}
-			}
-			if (ifttt_enabled) {
+		case NOTIFY_REBOOT:
+			strcpy_P(topic, PSTR("opensprinkler/system"));
+			strcpy_P(payload, PSTR("{\"state\":\"started\"}"));
+			break;
+	}
+	return strlen(topic) && strlen(payload);
+}
+
+/** Text of an event (as sent to IFTTT), appended to buf */
+void notify_format_text(const NotifyEvent *ev, char *postval) {
+	uint32_t lval = ev->lval;
+	float fval = ev->fval;
+	uint32_t volume;
+
+	switch(ev->type) {
+		case NOTIFY_STATION_OFF:
+			{
 				char name[STATION_NAME_SIZE];
 				os.get_station_name(lval, name);
 				sprintf_P(postval+strlen(postval), PSTR("Station %s closed. It ran for %d minutes %d seconds."), name, (int)fval/60, (int)fval%60);
-
-				if(os.iopts[IOPT_SENSOR1_TYPE]==SENSOR_TYPE_FLOW) {
-					sprintf_P(postval+strlen(postval), PSTR(" Flow rate: %d.%02d"), (int)flow_last_gpm, (int)(flow_last_gpm*100)%100);
-				}
+			}
+			if(os.iopts[IOPT_SENSOR1_TYPE]==SENSOR_TYPE_FLOW) {
+				sprintf_P(postval+strlen(postval), PSTR(" Flow rate: %d.%02d"), (int)ev->flow, (int)(ev->flow*100)%100);
 			}
 			break;
 
 		case NOTIFY_PROGRAM_SCHED:
-
-			if (ifttt_enabled) {
-				if (sval) strcat_P(postval, PSTR("Manually scheduled "));
-				else strcat_P(postval, PSTR("Automatically scheduled "));
-				strcat_P(postval, PSTR("Program "));
-				{
-					ProgramStruct prog;
-					pd.read(lval, &prog);
-					if(lval<pd.nprograms) strcat(postval, prog.name);
-				}
-				sprintf_P(postval+strlen(postval), PSTR(" with %d%% water level."), (int)fval);
+			if (ev->flags&NOTIFY_FLAG_MANUAL) strcat_P(postval, PSTR("Manually scheduled "));
+			else strcat_P(postval, PSTR("Automatically scheduled "));
+			strcat_P(postval, PSTR("Program "));
+			{
+				ProgramStruct prog;
+				pd.read(lval, &prog);
+				if(lval<pd.nprograms) strcat(postval, prog.name);
 			}
+			sprintf_P(postval+strlen(postval), PSTR(" with %d%% water level."), (int)fval);
 			break;
 
 		case NOTIFY_SENSOR1:
-
-			if (os.mqtt.enabled()) {
-				strcpy_P(topic, PSTR("opensprinkler/sensor1"));
-				sprintf_P(payload, PSTR("{\"state\":%d}"), (int)fval);
-			}
-			if (ifttt_enabled) {
-				strcat_P(postval, PSTR("Sensor 1 "));
-				strcat_P(postval, ((int)fval)?PSTR("activated."):PSTR("de-activated."));
-			}
+			strcat_P(postval, PSTR("Sensor 1 "));
+			strcat_P(postval, ((int)fval)?PSTR("activated."):PSTR("de-activated."));
 			break;
-			
-		case NOTIFY_SENSOR2:
 
-			if (os.mqtt.enabled()) {
-				strcpy_P(topic, PSTR("opensprinkler/sensor2"));
-				sprintf_P(payload, PSTR("{\"state\":%d}"), (int)fval);
-			}
-			if (ifttt_enabled) {
-				strcat_P(postval, PSTR("Sensor 2 "));
-				strcat_P(postval, ((int)fval)?PSTR("activated."):PSTR("de-activated."));
-			}
+		case NOTIFY_SENSOR2:
+			strcat_P(postval, PSTR("Sensor 2 "));
+			strcat_P(postval, ((int)fval)?PSTR("activated."):PSTR("de-activated."));
 			break;
 
 		case NOTIFY_RAINDELAY:
-
-			if (os.mqtt.enabled()) {
-				strcpy_P(topic, PSTR("opensprinkler/raindelay"));
-				sprintf_P(payload, PSTR("{\"state\":%d}"), (int)fval);
-			}
-			if (ifttt_enabled) {
-				strcat_P(postval, PSTR("Rain delay "));
-				strcat_P(postval, ((int)fval)?PSTR("activated."):PSTR("de-activated."));
-			}
+			strcat_P(postval, PSTR("Rain delay "));
+			strcat_P(postval, ((int)fval)?PSTR("activated."):PSTR("de-activated."));
 			break;
 
 		case NOTIFY_FLOWSENSOR:
-
 			volume = os.iopts[IOPT_PULSE_RATE_1];
 			volume = (volume<<8)+os.iopts[IOPT_PULSE_RATE_0];
 			volume = lval*volume;
-			if (os.mqtt.enabled()) {
-				strcpy_P(topic, PSTR("opensprinkler/sensor/flow"));
-				sprintf_P(payload, PSTR("{\"count\":%d,\"volume\":%d.%02d}"), lval, (int)volume/100, (int)volume%100);
-			}
-			if (ifttt_enabled) {
-				sprintf_P(postval+strlen(postval), PSTR("Flow count: %d, volume: %d.%02d"), lval, (int)volume/100, (int)volume%100);
-			}
+			sprintf_P(postval+strlen(postval), PSTR("Flow count: %d, volume: %d.%02d"), lval, (int)volume/100, (int)volume%100);
 			break;
 
 		case NOTIFY_WEATHER_UPDATE:
-
-			if (ifttt_enabled) {
-				if(lval>0) {
-					strcat_P(postval, PSTR("External IP updated: "));
-					byte ip[4] = {(byte)((lval>>24)&0xFF),
-									(byte)((lval>>16)&0xFF),
-									(byte)((lval>>8)&0xFF),
-									(byte)(lval&0xFF)};
-					ip2string(postval, ip);
-				}
-				if(fval>=0) {
-					sprintf_P(postval+strlen(postval), PSTR("Water level updated: %d%%."), (int)fval);
-				}
+			if(lval>0) {
+				strcat_P(postval, PSTR("External IP updated: "));
+				byte ip[4] = {(byte)((lval>>24)&0xFF),
+								(byte)((lval>>16)&0xFF),
+								(byte)((lval>>8)&0xFF),
+								(byte)(lval&0xFF)};
+				ip2string(postval, ip);
+			}
+			if(fval>=0) {
+				sprintf_P(postval+strlen(postval), PSTR("Water level updated: %d%%."), (int)fval);
 			}
 			break;
 
 		case NOTIFY_REBOOT:
-
-			if (os.mqtt.enabled()) {
-				strcpy_P(topic, PSTR("opensprinkler/system"));
-				strcpy_P(payload, PSTR("{\"state\":\"started\"}"));
-			}
-			if (ifttt_enabled) {
-				#if defined(ARDUINO)
-					strcat_P(postval, PSTR("Rebooted. Device IP: "));
-					#if defined(ESP8266)
-					{
-						IPAddress _ip;
-						if (m_server) {
-							_ip = Ethernet.localIP();
-						} else {
-							_ip = WiFi.localIP();
-						}
-						byte ip[4] = {_ip[0], _ip[1], _ip[2], _ip[3]};
-						ip2string(postval, ip);
+			#if defined(ARDUINO)
+				strcat_P(postval, PSTR("Rebooted. Device IP: "));
+				#if defined(ESP8266)
+				{
+					IPAddress _ip;
+					if (m_server) {
+						_ip = Ethernet.localIP();
+					} else {
+						_ip = WiFi.localIP();
 					}
-					#else
-						ip2string(postval, &(Ethernet.localIP()[0]));
-					#endif
-					//strcat(postval, ":");
-					//itoa(_port, postval+strlen(postval), 10);
+					byte ip[4] = {_ip[0], _ip[1], _ip[2], _ip[3]};
+					ip2string(postval, ip);
+				}
 				#else
-					strcat_P(postval, PSTR("Process restarted."));
+					ip2string(postval, &(Ethernet.localIP()[0]));
 				#endif
-			}
+				//strcat(postval, ":");
+				//itoa(_port, postval+strlen(postval), 10);
+			#else
+				strcat_P(postval, PSTR("Process restarted."));
+			#endif
 			break;
 	}
+}
+
+/** Push notification
+ * On RPI/BBB, the event is queued and delivered by notify_poll(),
+ * otherwise it is delivered right away
+ */
+void push_message(int type, uint32_t lval, float fval, const char* sval) {
+	NotifyEvent ev;
+	ev.type = type;
+	ev.flags = sval ? NOTIFY_FLAG_MANUAL : 0;
+	ev.lval = lval;
+	ev.fval = fval;
+	ev.flow = flow_last_gpm;
+	ev.time = os.now_tz();
+	ev.ms = millis();
+
+#if !defined(ARDUINO)
+	notify_push(&ev);
+#else
+	static char topic[TMP_BUFFER_SIZE];
+	static char payload[TMP_BUFFER_SIZE];
+	char* postval = tmp_buffer;
+
+	bool ifttt_enabled = os.iopts[IOPT_IFTTT_ENABLE]&type;
 
-	if (os.mqtt.enabled() && strlen(topic) && strlen(payload))
+	if (os.mqtt.enabled() && notify_format_mqtt(&ev, topic, payload))
 		os.mqtt.publish(topic, payload);
 
 	if (ifttt_enabled) {
+		strcpy_P(postval, PSTR("{\"value1\":\""));
+		notify_format_text(&ev, postval);
 		strcat_P(postval, PSTR("\"}"));
 
 		//char postBuffer[1500];
@@ -1455,8 +1797,9 @@ void push_message(int type, uint32_t lval, float fval, const char* sval) {
 						"Content-Type: application/json\r\n\r\n$S"),
 						SOPT_IFTTT_KEY, DEFAULT_IFTTT_URL, strlen(postval), postval);
 
-		os.send_http_request(DEFAULT_IFTTT_URL, 80, ether_buffer, remote_http_callback);
+		os.queue_http_request(DEFAULT_IFTTT_URL, 80, ether_buffer, remote_http_callback);
 	}
+#endif
 }
 
 // ================================
@@ -1488,7 +1831,7 @@ void make_logfile_name(char *name) {
  * must be strictly two characters with an ending 0
  * so each name is 3 characters total
  */
-static const char log_type_names[] PROGMEM =
+const char log_type_names[] PROGMEM =
 	"  \0"
 	"s1\0"
 	"rd\0"
@@ -1497,19 +1840,41 @@ static const char log_type_names[] PROGMEM =
 	"s2\0"
 	"cu\0";
 
+/** Second value of a special (non-station) log record */
+static ulong log_special_value(byte type, ulong curr_time) {
+	ulong lvalue=0;
+	switch(type) {
+		case LOGDATA_FLOWSENSE:
+			lvalue = (curr_time>os.sensor1_active_lasttime)?(curr_time-os.sensor1_active_lasttime):0;
+			break;
+		case LOGDATA_SENSOR1:
+			lvalue = (curr_time>os.sensor1_active_lasttime)?(curr_time-os.sensor1_active_lasttime):0;
+			break;
+		case LOGDATA_SENSOR2:
+			lvalue = (curr_time>os.sensor2_active_lasttime)?(curr_time-os.sensor2_active_lasttime):0;
+			break;
+		case LOGDATA_RAINDELAY:
+			lvalue = (curr_time>os.raindelay_on_lasttime)?(curr_time-os.raindelay_on_lasttime):0;
+			break;
+		case LOGDATA_WATERLEVEL:
+			lvalue = os.iopts[IOPT_WATER_PERCENTAGE];
+			break;
+	}
+	return lvalue;
+}
+
 /** write run record to log on SD card */
 void write_log(byte type, ulong curr_time) {
 
 	if (!os.iopts[IOPT_ENABLE_LOGGING]) return;
 
+#if defined(ARDUINO)
 	// file name will be logs/xxxxx.tx where xxxxx is the day in epoch time
 	ultoa(curr_time / 86400, tmp_buffer, 10);
 	make_logfile_name(tmp_buffer);
 
 	// Step 1: open file if exists, or create new otherwise, 
 	// and move file pointer to the end  
-#if defined(ARDUINO) // prepare log folder for Arduino
-
 	#if defined(ESP8266)
 	File file = SPIFFS.open(tmp_buffer, "r+");
 	if(!file) {
@@ -1533,22 +1898,6 @@ void write_log(byte type, ulong curr_time) {
 	}
 	#endif
 	
-#else // prepare log folder for RPI/BBB
-	struct stat st;
-	if(stat(get_filename_fullpath(LOG_PREFIX), &st)) {
-		if(mkdir(get_filename_fullpath(LOG_PREFIX), S_IRUSR | S_IWUSR | S_IXUSR | S_IRGRP | S_IWGRP | S_IXGRP | S_IROTH | S_IWOTH | S_IXOTH)) {
-			return;
-		}
-	}
-	FILE *file;
-	file = fopen(get_filename_fullpath(tmp_buffer), "rb+");
-	if(!file) {
-		file = fopen(get_filename_fullpath(tmp_buffer), "wb");
-		if (!file)	return;
-	}
-	fseek(file, 0, SEEK_END);
-#endif	// prepare log folder
-	
 	// Step 2: prepare data buffer
 	strcpy_P(tmp_buffer, PSTR("["));
 
@@ -1568,49 +1917,48 @@ void write_log(byte type, ulong curr_time) {
 		strcat_P(tmp_buffer, PSTR(",\""));
 		strcat_P(tmp_buffer, log_type_names+type*3);
 		strcat_P(tmp_buffer, PSTR("\","));
-
-		switch(type) {
-			case LOGDATA_FLOWSENSE:
-				lvalue = (curr_time>os.sensor1_active_lasttime)?(curr_time-os.sensor1_active_lasttime):0;
-				break;
-			case LOGDATA_SENSOR1:
-				lvalue = (curr_time>os.sensor1_active_lasttime)?(curr_time-os.sensor1_active_lasttime):0;
-				break;
-			case LOGDATA_SENSOR2:
-				lvalue = (curr_time>os.sensor2_active_lasttime)?(curr_time-os.sensor2_active_lasttime):0;
-				break;
-			case LOGDATA_RAINDELAY:
-				lvalue = (curr_time>os.raindelay_on_lasttime)?(curr_time-os.raindelay_on_lasttime):0;
-				break;
-			case LOGDATA_WATERLEVEL:
-				lvalue = os.iopts[IOPT_WATER_PERCENTAGE];
-				break;
-		}
-		ultoa(lvalue, tmp_buffer+strlen(tmp_buffer), 10);
+		ultoa(log_special_value(type, curr_time), tmp_buffer+strlen(tmp_buffer), 10);
 	}
 	strcat_P(tmp_buffer, PSTR(","));
 	ultoa(curr_time, tmp_buffer+strlen(tmp_buffer), 10);
 	if((os.iopts[IOPT_SENSOR1_TYPE]==SENSOR_TYPE_FLOW) && (type==LOGDATA_STATION)) {
-		// RAH implementation of flow sensor
+		// flow rate and volume attributed to the station
 		strcat_P(tmp_buffer, PSTR(","));
-		#if defined(ARDUINO)
 		dtostrf(flow_last_gpm,5,2,tmp_buffer+strlen(tmp_buffer));
-		#else
-		sprintf(tmp_buffer+strlen(tmp_buffer), "%5.2f", flow_last_gpm);
-		#endif
+		strcat_P(tmp_buffer, PSTR(","));
+		dtostrf(flow_last_volume,1,2,tmp_buffer+strlen(tmp_buffer));
 	}
 	strcat_P(tmp_buffer, PSTR("]\r\n"));
 
-#if defined(ARDUINO)
 	#if defined(ESP8266)
 	file.write((byte*)tmp_buffer, strlen(tmp_buffer));
 	#else
 	file.write(tmp_buffer);
 	#endif
 	file.close();
-#else
-	fwrite(tmp_buffer, 1, strlen(tmp_buffer), file);
-	fclose(file);
+
+#else // RPI/BBB: append a fixed-size record to the binary log store
+	LogRecord rec;
+	memset(&rec, 0, sizeof(rec));
+	rec.type = type;
+	rec.end = curr_time;
+	if(type == LOGDATA_STATION) {
+		rec.pid = pd.lastrun.program;
+		rec.sid = pd.lastrun.station;
+		rec.value = pd.lastrun.duration;
+		if(os.iopts[IOPT_SENSOR1_TYPE]==SENSOR_TYPE_FLOW) {
+			// flow rate and volume (in 1/100 pulses) attributed to the station
+			rec.flags |= LOGREC_FLAG_GPM | LOGREC_FLAG_VOLUME;
+			rec.gpm = flow_last_gpm;
+			rec.value2 = (uint32_t)(flow_last_volume*100+0.5f);
+		}
+	} else {
+		if(type==LOGDATA_FLOWSENSE) {
+			rec.value = (flow_count>os.flowcount_log_start)?(flow_count-os.flowcount_log_start):0;
+		}
+		rec.value2 = log_special_value(type, curr_time);
+	}
+	logstore_append(curr_time / 86400, &rec);
 #endif
 }
 
@@ -1654,12 +2002,15 @@ void delete_log(char *name) {
 	
 #else // delete_log implementation for RPI/BBB
 	if (strncmp(name, "all", 3) == 0) {
-		// delete the log folder
+		// delete all log files, then the log folder
+		logstore_remove_all();
 		rmdir(get_filename_fullpath(LOG_PREFIX));
 		return;
 	} else {
+		ulong day = atol(name);
 		make_logfile_name(name);
 		remove(get_filename_fullpath(tmp_buffer));
+		logstore_remove(day);
 	}
 #endif
 }
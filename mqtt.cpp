@@ -37,7 +37,10 @@
 #else
 	#include <time.h>
 	#include <stdio.h>
+	#include <stdlib.h>
 	#include <string.h>
+	#include <pthread.h>
+	#include <unistd.h>
 	#include <mosquitto.h>
 
 	#define MQTT_KEEPALIVE 60
@@ -46,6 +49,7 @@
 #endif
 
 #include "OpenSprinkler.h"
+#include "program.h"
 #include "mqtt.h"
 
 // Debug routines to help identify any blocking of the event loop for an extended period
@@ -71,6 +75,7 @@
 #endif
 
 extern OpenSprinkler os;
+extern ProgramData pd;
 
 #define MQTT_DEFAULT_PORT		1883	// Default port for MQTT. Can be overwritten through App config
 #define MQTT_MAX_HOST_LEN		50		// Note: App is set to max 50 chars for broker name
@@ -82,13 +87,120 @@ extern OpenSprinkler os;
 #define MQTT_ONLINE_PAYLOAD		"online"
 #define MQTT_OFFLINE_PAYLOAD	"offline"
 
+// Command topics: the controller subscribes to these and acts on them like the equivalent HTTP commands.
+// Commands are not authenticated (anyone who can publish to the broker can send them), so they are off
+// unless the MQTT options have "cmd":1
+#define MQTT_STATION_TOPIC		MQTT_ROOT_TOPIC "/station/+/set"	// Payload: seconds to run the station, 0 to turn it off (as /cm)
+#define MQTT_PROGRAM_TOPIC		MQTT_ROOT_TOPIC "/program/+/run"	// Payload: 1 to use weather adjustment, 0 otherwise (as /mp)
+#define MQTT_RAINDELAY_TOPIC	MQTT_ROOT_TOPIC "/raindelay/set"	// Payload: rain delay in hours, 0 to stop it (as /cv?rd)
+#define MQTT_ENABLE_TOPIC		MQTT_ROOT_TOPIC "/enable/set"		// Payload: 1 to enable the controller, 0 to disable it (as /cv?en)
+#define MQTT_MAX_PAYLOAD_LEN	16		// Longer command payloads are ignored
+#define MQTT_MAX_TOPIC_LEN		64		// Longer command topics are ignored
+
+// State topics: retained, published when the state differs from the last published state
+//   opensprinkler/station/<sid>/state		1 if the station is on, 0 otherwise
+//   opensprinkler/<name>/state				for the names in _state_names
+// On (re)connect, all states are published again, together with Home Assistant discovery configs
+#define MQTT_STATE_INTERVAL		1000	// Milliseconds between comparisons of the state with the last published state
+#ifndef MQTT_STATE_RATE
+#define MQTT_STATE_RATE			20		// Maximum number of state and discovery messages published per interval
+#endif
+#ifndef MQTT_DISCOVERY
+	#if defined(ARDUINO)
+	#define MQTT_DISCOVERY		0		// Discovery configs exceed the default PubSubClient packet size
+	#else
+	#define MQTT_DISCOVERY		1
+	#endif
+#endif
+#define MQTT_DISCOVERY_PREFIX	"homeassistant"
+#define MQTT_DISCOVERY_PAYLOAD_LEN	384
+#define MQTT_SWITCH_RUNTIME		600		// Seconds a station runs when switched on through discovery
+
 #define MQTT_SUCCESS			0					// Returned when function operated successfully
 #define MQTT_ERROR				1					// Returned whan function failed
 
+static const char *_command_topics[] = {MQTT_STATION_TOPIC, MQTT_PROGRAM_TOPIC, MQTT_RAINDELAY_TOPIC, MQTT_ENABLE_TOPIC};
+#define MQTT_NUM_COMMAND_TOPICS	(sizeof(_command_topics)/sizeof(_command_topics[0]))
+
+byte change_manual_station(byte sid, byte en, uint16_t timer);
+byte change_manual_program(int pid, byte uwt);
+byte change_raindelay(int rd);
+byte change_enable(byte en);
+
+// Parse a non-negative decimal number, returns -1 if the string is not one
+static long _parse_number(const char *s) {
+	long v = 0;
+	if (*s == 0) return -1;
+	for (; *s; s++) {
+		if (*s < '0' || *s > '9' || v > 100000L) return -1;
+		v = v * 10 + (*s - '0');
+	}
+	return v;
+}
+
+// Parse the index in a topic of the form "<prefix><index><suffix>", returns -1 if the topic does not match
+static long _parse_topic_index(const char *topic, const char *prefix, const char *suffix) {
+	char buf[8];
+	size_t len = strlen(prefix);
+	if (strncmp(topic, prefix, len)) return -1;
+	topic += len;
+	const char *end = strchr(topic, '/');
+	if (end == NULL || end == topic || end - topic >= (int)sizeof(buf) || strcmp(end, suffix)) return -1;
+	strncpy(buf, topic, end - topic);
+	buf[end - topic] = 0;
+	return _parse_number(buf);
+}
+
+// Act on a message received on one of the command topics, through the same code paths as the HTTP commands
+static void _command(const char *topic, const char *payload) {
+	if (!OSMqtt::commands()) return;	// a message of an earlier subscription
+	long index, value = _parse_number(payload);
+	byte ret = 0;	// 0: ignored, otherwise the result code of the HTTP command
+
+	if ((index = _parse_topic_index(topic, MQTT_ROOT_TOPIC "/station/", "/set")) >= 0) {
+		if (index < os.nstations && value >= 0 && value <= 64800)
+			ret = change_manual_station(index, value ? 1 : 0, value);
+	} else if ((index = _parse_topic_index(topic, MQTT_ROOT_TOPIC "/program/", "/run")) >= 0) {
+		if (index < pd.nprograms)
+			ret = change_manual_program(index, value == 1 ? 1 : 0);
+	} else if (!strcmp(topic, MQTT_RAINDELAY_TOPIC)) {
+		if (value >= 0)
+			ret = change_raindelay(value);
+	} else if (!strcmp(topic, MQTT_ENABLE_TOPIC)) {
+		if (value == 0 || value == 1)
+			ret = change_enable(value);
+	}
+	DEBUG_LOGF("MQTT Command: %s %s (%d)\n", topic, payload, ret);
+	(void)ret;	// only logged in debug builds
+}
+
+// Other state published on "opensprinkler/<name>/state", with its Home Assistant component and name
+enum {
+	MQTT_STATE_ENABLE = 0,
+	MQTT_STATE_RAINDELAY,
+	MQTT_STATE_SENSOR1,
+	MQTT_STATE_SENSOR2,
+	MQTT_STATE_WATERLEVEL,
+	MQTT_STATE_FLOW,
+	MQTT_NUM_STATES
+};
+static const char *_state_names[] = {"enable", "raindelay", "sensor1", "sensor2", "waterlevel", "flow"};
+static const char *_state_components[] = {"switch", "binary_sensor", "binary_sensor", "binary_sensor", "sensor", "sensor"};
+static const char *_state_titles[] = {"Enable", "Rain Delay", "Sensor 1", "Sensor 2", "Water Level", "Flow Rate"};
+static const char *_state_units[] = {NULL, NULL, NULL, NULL, "%", "pulses/min"};
+
+static volatile bool _session_new = false;			// Set on (re)connect: every state and discovery config is published again
+static long _state_last[MQTT_NUM_STATES];			// Last published states
+static byte _state_known = 0;						// Bit n is set once state n is published on this connection
+static byte _station_last[MAX_NUM_BOARDS];			// Last published station states
+static byte _station_known[MAX_NUM_BOARDS];			// Bit s is set once station s is published on this connection
+static uint16_t _discovery_next = 0;				// Next discovery config to publish (states first, then stations)
+
 char OSMqtt::_id[MQTT_MAX_ID_LEN + 1] = {0};		// Id to identify the client to the broker
 char OSMqtt::_host[MQTT_MAX_HOST_LEN + 1] = {0};	// IP or host name of the broker
 int OSMqtt::_port = MQTT_DEFAULT_PORT;				// Port of the broker (default 1883)
 bool OSMqtt::_enabled = false;						// Flag indicating whether MQTT is enabled
+bool OSMqtt::_commands = false;						// Flag indicating whether commands are accepted on the command topics
 
 // Initialise the client libraries and event handlers.
 void OSMqtt::init(void) {
@@ -99,6 +211,10 @@ void OSMqtt::init(void) {
 	uint8_t mac[6] = {0};
 	os.load_hardware_mac(mac, m_server!=NULL);
 	snprintf(id, MQTT_MAX_ID_LEN, "OS-%02X%02X%02X%02X%02X%02X", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+#else
+	char host[MQTT_MAX_ID_LEN - 3] = {0};	// what fits in the id after "OS-"
+	gethostname(host, sizeof(host) - 1);
+	snprintf(id, MQTT_MAX_ID_LEN, "OS-%s", host);
 #endif
 
 	init(id);
@@ -108,8 +224,13 @@ void OSMqtt::init(void) {
 void OSMqtt::init(const char * clientId) {
 	DEBUG_LOGF("MQTT Init: ClientId %s\n", clientId);
 
-	strncpy(_id, clientId, MQTT_MAX_ID_LEN);
-	_id[MQTT_MAX_ID_LEN] = 0;
+	// the id is also the Home Assistant node id, which only allows [A-Za-z0-9_-]
+	int i;
+	for (i = 0; i < MQTT_MAX_ID_LEN && clientId[i]; i++) {
+		char c = clientId[i];
+		_id[i] = ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '-') ? c : '_';
+	}
+	_id[i] = 0;
 	_init();
 };
 
@@ -119,30 +240,36 @@ void OSMqtt::begin(void) {
 	char host[MQTT_MAX_HOST_LEN + 1] = {0};
 	int port = MQTT_DEFAULT_PORT;
 	int enabled = 0;
+	int commands = 0;
 
-	// JSON configuration settings in the form of "{server:"host_name|IP address", port: 1883, enabled:"0|1"}"
+	// JSON configuration settings in the form of "{server:"host_name|IP address", port: 1883, enabled:"0|1", cmd:"0|1"}"
 	String config = os.sopt_load(SOPT_MQTT_OPTS);
 	if (config.length() != 0) {
-		sscanf(config.c_str(), "\"server\":\"%[^\"]\",\"port\":\%d,\"enable\":\%d", host, &port, &enabled);
+		sscanf(config.c_str(), "\"server\":\"%[^\"]\",\"port\":\%d,\"enable\":\%d,\"cmd\":\%d", host, &port, &enabled, &commands);
 	}
 
-	begin(host, port, (bool)enabled);
+	begin(host, port, (bool)enabled, (bool)commands);
 }
 
 // Start the MQTT service and connect to the MQTT broker.
-void OSMqtt::begin( const char * host, int port, bool enabled ) {
-	DEBUG_LOGF("MQTT Begin: Config (%s:%d) %s\n", host, port, enabled ? "Enabled" : "Disabled");
+void OSMqtt::begin( const char * host, int port, bool enabled, bool commands ) {
+	DEBUG_LOGF("MQTT Begin: Config (%s:%d) %s%s\n", host, port, enabled ? "Enabled" : "Disabled", commands ? ", Commands" : "");
 
 	strncpy(_host, host, MQTT_MAX_HOST_LEN);
 	_host[MQTT_MAX_ID_LEN] = 0;
 	_port = port;
 	_enabled = enabled;
+	_commands = commands;
 
 	if (mqtt_client == NULL || os.status.network_fails > 0) return;
 
+#if defined(ARDUINO)
 	if (_connected()) {
 		_disconnect();
 	}
+#else
+	_disconnect();	// stops the network thread, also while it is still connecting
+#endif
 
 	if (_enabled) {
 		_connect();
@@ -150,17 +277,21 @@ void OSMqtt::begin( const char * host, int port, bool enabled ) {
 }
 
 // Publish an MQTT message to a specific topic
-void OSMqtt::publish(const char *topic, const char *payload) {
+void OSMqtt::publish(const char *topic, const char *payload, bool retain) {
 	DEBUG_LOGF("MQTT Publish: %s %s\n", topic, payload);
 
-	if (mqtt_client == NULL || !_enabled || os.status.network_fails > 0) return;
+	if (mqtt_client == NULL || !_enabled) return;
+
+#if defined(ARDUINO)
+	if (os.status.network_fails > 0) return;
 
 	if (!_connected()) {
 		DEBUG_LOGF("MQTT Publish: Not connected\n");
 		return;
 	}
-
-	_publish(topic, payload);
+#endif
+	// On RPI/BBB, the message is queued until the broker can be reached
+	_publish(topic, payload, retain);
 }
 
 // Regularly call the loop function to ensure "keep alive" messages are sent to the broker and to reconnect if needed.
@@ -178,6 +309,8 @@ void OSMqtt::loop(void) {
 
 	int state = _loop();
 
+	if (_connected()) _publish_state();
+
 #if defined(ENABLE_DEBUG)
 	// Print a diagnostic message whenever the MQTT state changes
 	bool network = os.network_connected(), mqtt = _connected();
@@ -194,6 +327,107 @@ void OSMqtt::loop(void) {
 #endif
 }
 
+// Current value of one of the other states
+static long _state_value(byte i) {
+	switch (i) {
+		case MQTT_STATE_ENABLE:		return os.status.enabled;
+		case MQTT_STATE_RAINDELAY:	return os.status.rain_delayed;
+		case MQTT_STATE_SENSOR1:	return os.status.sensor1_active;
+		case MQTT_STATE_SENSOR2:	return os.status.sensor2_active;
+		case MQTT_STATE_WATERLEVEL:	return os.iopts[IOPT_WATER_PERCENTAGE];
+		case MQTT_STATE_FLOW:		return os.flowcount_rt * 60 / FLOWCOUNT_RT_WINDOW;
+		default:					return 0;
+	}
+}
+
+#if MQTT_DISCOVERY
+// Publish the Home Assistant discovery config of state i (i < MQTT_NUM_STATES) or station i-MQTT_NUM_STATES
+static void _publish_discovery(uint16_t i, const char *uid) {
+	char topic[96], payload[MQTT_DISCOVERY_PAYLOAD_LEN], name[STATION_NAME_SIZE + 1];
+	int n;
+
+	if (i < MQTT_NUM_STATES) {
+		// without commands, the enable switch is a binary sensor
+		const char *component = (i == MQTT_STATE_ENABLE && !OSMqtt::commands()) ? "binary_sensor" : _state_components[i];
+		snprintf(topic, sizeof(topic), MQTT_DISCOVERY_PREFIX "/%s/%s/%s/config", component, uid, _state_names[i]);
+		n = snprintf(payload, sizeof(payload), "{\"name\":\"%s\",\"uniq_id\":\"%s_%s\",\"stat_t\":\"" MQTT_ROOT_TOPIC "/%s/state\"",
+					_state_titles[i], uid, _state_names[i], _state_names[i]);
+		if (_state_units[i]) {
+			n += snprintf(payload + n, sizeof(payload) - n, ",\"unit_of_meas\":\"%s\"", _state_units[i]);
+		} else {
+			n += snprintf(payload + n, sizeof(payload) - n, ",\"pl_on\":\"1\",\"pl_off\":\"0\"");
+		}
+		if (i == MQTT_STATE_ENABLE && OSMqtt::commands()) {
+			n += snprintf(payload + n, sizeof(payload) - n, ",\"cmd_t\":\"" MQTT_ENABLE_TOPIC "\"");
+		}
+	} else {
+		byte sid = i - MQTT_NUM_STATES;
+		os.get_station_name(sid, name);
+		for (char *c = name; *c; c++) if (*c == '"' || *c == '\\') *c = ' ';
+		if (OSMqtt::commands()) {
+			snprintf(topic, sizeof(topic), MQTT_DISCOVERY_PREFIX "/switch/%s/station%d/config", uid, sid);
+			n = snprintf(payload, sizeof(payload), "{\"name\":\"%s\",\"uniq_id\":\"%s_station%d\",\"stat_t\":\"" MQTT_ROOT_TOPIC "/station/%d/state\","
+						"\"cmd_t\":\"" MQTT_ROOT_TOPIC "/station/%d/set\",\"pl_on\":\"%d\",\"pl_off\":\"0\",\"stat_on\":\"1\",\"stat_off\":\"0\"",
+						name, uid, sid, sid, sid, MQTT_SWITCH_RUNTIME);
+		} else {
+			snprintf(topic, sizeof(topic), MQTT_DISCOVERY_PREFIX "/binary_sensor/%s/station%d/config", uid, sid);
+			n = snprintf(payload, sizeof(payload), "{\"name\":\"%s\",\"uniq_id\":\"%s_station%d\",\"stat_t\":\"" MQTT_ROOT_TOPIC "/station/%d/state\","
+						"\"pl_on\":\"1\",\"pl_off\":\"0\"",
+						name, uid, sid, sid);
+		}
+	}
+	snprintf(payload + n, sizeof(payload) - n, ",\"avty_t\":\"" MQTT_AVAILABILITY_TOPIC "\"}");
+	OSMqtt::publish(topic, payload, true);
+}
+#endif
+
+// Publish the states that differ from the last published ones, at most MQTT_STATE_RATE messages per interval.
+// States left over are published in the next interval.
+void OSMqtt::_publish_state(void) {
+	static unsigned long last_time = 0;
+	char topic[48], payload[24];
+	int budget = MQTT_STATE_RATE;
+
+	if (_session_new) {
+		_session_new = false;
+		_state_known = 0;
+		memset(_station_known, 0, sizeof(_station_known));
+		_discovery_next = 0;
+	} else if (millis() - last_time < MQTT_STATE_INTERVAL) {
+		return;
+	}
+	last_time = millis();
+
+#if MQTT_DISCOVERY
+	while (budget > 0 && _discovery_next < MQTT_NUM_STATES + os.nstations) {
+		_publish_discovery(_discovery_next++, _id[0] ? _id : "OS");
+		budget--;
+	}
+#endif
+
+	for (byte i = 0; i < MQTT_NUM_STATES && budget > 0; i++) {
+		long v = _state_value(i);
+		if ((_state_known & (1 << i)) && v == _state_last[i]) continue;
+		snprintf(topic, sizeof(topic), MQTT_ROOT_TOPIC "/%s/state", _state_names[i]);
+		snprintf(payload, sizeof(payload), "%ld", v);
+		publish(topic, payload, true);
+		_state_last[i] = v;
+		_state_known |= (1 << i);
+		budget--;
+	}
+
+	for (byte sid = 0; sid < os.nstations && budget > 0; sid++) {
+		byte bid = sid >> 3, mask = 1 << (sid & 0x07);
+		byte v = os.station_bits[bid] & mask;
+		if ((_station_known[bid] & mask) && v == (_station_last[bid] & mask)) continue;
+		snprintf(topic, sizeof(topic), MQTT_ROOT_TOPIC "/station/%d/state", sid);
+		publish(topic, v ? "1" : "0", true);
+		_station_last[bid] = (_station_last[bid] & ~mask) | v;
+		_station_known[bid] |= mask;
+		budget--;
+	}
+}
+
 /**************************** ARDUINO ********************************************/
 #if defined(ARDUINO)
 
@@ -202,6 +436,19 @@ void OSMqtt::loop(void) {
 	#endif
 	EthernetClient ethClient;
 
+// Copy a received message out of the client's buffer and act on it
+static void _mqtt_message_cb(char *topic, byte *payload, unsigned int length) {
+	char t[MQTT_MAX_TOPIC_LEN + 1], p[MQTT_MAX_PAYLOAD_LEN + 1];
+	if (strlen(topic) > MQTT_MAX_TOPIC_LEN || length > MQTT_MAX_PAYLOAD_LEN) {
+		DEBUG_LOGF("MQTT Command: Message too long on %s\n", topic);
+		return;
+	}
+	strcpy(t, topic);
+	memcpy(p, payload, length);
+	p[length] = 0;
+	_command(t, p);
+}
+
 int OSMqtt::_init(void) {
 	Client * client = NULL;
 
@@ -221,6 +468,8 @@ int OSMqtt::_init(void) {
 		return MQTT_ERROR;
 	}
 
+	mqtt_client->setCallback(_mqtt_message_cb);
+
 	return MQTT_SUCCESS;
 }
 
@@ -228,6 +477,12 @@ int OSMqtt::_connect(void) {
 	mqtt_client->setServer(_host, _port);
 	if (mqtt_client->connect(_id, NULL, NULL, MQTT_AVAILABILITY_TOPIC, 0, true, MQTT_OFFLINE_PAYLOAD)) {
 		mqtt_client->publish(MQTT_AVAILABILITY_TOPIC, MQTT_ONLINE_PAYLOAD, true);
+		_session_new = true;
+		for (byte i = 0; _commands && i < MQTT_NUM_COMMAND_TOPICS; i++) {
+			if (!mqtt_client->subscribe(_command_topics[i])) {
+				DEBUG_LOGF("MQTT Subscribe: Failed (%d)\n", mqtt_client->state());
+			}
+		}
 	} else {
 		DEBUG_LOGF("MQTT Connect: Failed (%d)\n", mqtt_client->state());
 		return MQTT_ERROR;
@@ -242,8 +497,8 @@ int OSMqtt::_disconnect(void) {
 
 bool OSMqtt::_connected(void) { return mqtt_client->connected(); }
 
-int OSMqtt::_publish(const char *topic, const char *payload) {
-	if (!mqtt_client->publish(topic, payload)) {
+int OSMqtt::_publish(const char *topic, const char *payload, bool retain) {
+	if (!mqtt_client->publish(topic, payload, retain)) {
 		DEBUG_LOGF("MQTT Publish: Failed (%d)\n", mqtt_client->state());
 		return MQTT_ERROR;
 	}
@@ -274,27 +529,115 @@ const char * OSMqtt::_state_string(int rc) {
 
 /************************** RASPBERRY PI / BBB / DEMO ****************************************/
 
-static bool _connected = false;
+// On RPI/BBB, the connection is handled by the mosquitto network thread, so a slow or unreachable broker
+// never blocks the main loop. Outgoing messages are queued (also while the broker is down) and published
+// by loop() with QoS1: a message stays in the queue until the broker acknowledges it. Messages in flight
+// when the connection drops are sent again by libmosquitto after reconnecting; loop() only publishes
+// the messages libmosquitto has not accepted yet. When the queue is full, the oldest message is dropped. Incoming commands are
+// handed over to the main loop, so they are executed on the same thread as the HTTP commands.
+
+#ifndef MQTT_QUEUE_SIZE
+#define MQTT_QUEUE_SIZE			64		// Maximum number of outgoing messages waiting for the broker
+#endif
+#define MQTT_MAX_INFLIGHT		16		// Maximum number of messages published but not acknowledged yet
+#define MQTT_INBOX_SIZE			8		// Maximum number of received commands waiting for the main loop
+#define MQTT_RECONNECT_MIN		2		// The network thread retries connecting after 2, 4, 8 .. MQTT_RECONNECT_DELAY seconds
+
+struct MqttMessage {
+	char *topic;
+	char *payload;
+	int mid;								// Message id while published and not acknowledged, 0 otherwise
+	bool acked;
+	bool retain;
+};
+
+struct MqttCommand {
+	char topic[MQTT_MAX_TOPIC_LEN + 1];
+	char payload[MQTT_MAX_PAYLOAD_LEN + 1];
+};
+
+static volatile bool _connected = false;
+static bool _started = false;				// Flag indicating whether the network thread is running
+static pthread_mutex_t _lock = PTHREAD_MUTEX_INITIALIZER;	// Protects the queues, shared with the network thread
+static MqttMessage _queue[MQTT_QUEUE_SIZE];	// Outgoing messages, oldest first
+static int _queue_head = 0, _queue_count = 0;
+static int _inflight = 0;
+static unsigned long _dropped = 0;			// Number of messages dropped because the queue was full
+static MqttCommand _inbox[MQTT_INBOX_SIZE];
+static int _inbox_head = 0, _inbox_count = 0;
+
+static MqttMessage *_queue_at(int i) { return &_queue[(_queue_head + i) % MQTT_QUEUE_SIZE]; }
+
+// Remove the oldest message from the queue (call with _lock held)
+static void _queue_pop(void) {
+	MqttMessage *m = _queue_at(0);
+	if (m->mid && !m->acked) _inflight--;
+	free(m->topic);
+	free(m->payload);
+	m->topic = m->payload = NULL;
+	_queue_head = (_queue_head + 1) % MQTT_QUEUE_SIZE;
+	_queue_count--;
+}
 
 static void _mqtt_connection_cb(struct mosquitto *mqtt_client, void *obj, int reason) {
 	DEBUG_LOGF("MQTT Connnection Callback: %s (%d)\n", mosquitto_strerror(reason), reason);
 
-	::_connected = true;
-
 	if (reason == 0) {
+		::_connected = true;
+		_session_new = true;
 		int rc = mosquitto_publish(mqtt_client, NULL, MQTT_AVAILABILITY_TOPIC, strlen(MQTT_ONLINE_PAYLOAD), MQTT_ONLINE_PAYLOAD, 0, true);
 		if (rc != MOSQ_ERR_SUCCESS) {
 			DEBUG_LOGF("MQTT Publish: Failed (%s)\n", mosquitto_strerror(rc));
 		}
+		// (re)subscribe to the command topics, the broker may not have kept the session
+		for (byte i = 0; OSMqtt::commands() && i < MQTT_NUM_COMMAND_TOPICS; i++) {
+			rc = mosquitto_subscribe(mqtt_client, NULL, _command_topics[i], 0);
+			if (rc != MOSQ_ERR_SUCCESS) {
+				DEBUG_LOGF("MQTT Subscribe: Failed (%s)\n", mosquitto_strerror(rc));
+			}
+		}
 	}
 }
 
 static void _mqtt_disconnection_cb(struct mosquitto *mqtt_client, void *obj, int reason) {
 	DEBUG_LOGF("MQTT Disconnnection Callback: %s (%d)\n", mosquitto_strerror(reason), reason);
 
+	// messages published but not acknowledged yet are kept by libmosquitto, which sends them
+	// again with the same mid after reconnecting, so they are not published again here
 	::_connected = false;
 }
 
+static void _mqtt_publish_cb(struct mosquitto *mqtt_client, void *obj, int mid) {
+	pthread_mutex_lock(&_lock);
+	for (int i = 0; i < _queue_count; i++) {
+		MqttMessage *m = _queue_at(i);
+		if (m->mid == mid && !m->acked) {
+			m->acked = true;
+			_inflight--;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&_lock);
+}
+
+static void _mqtt_message_cb(struct mosquitto *mqtt_client, void *obj, const struct mosquitto_message *message) {
+	if (strlen(message->topic) > MQTT_MAX_TOPIC_LEN || message->payloadlen > MQTT_MAX_PAYLOAD_LEN) {
+		DEBUG_LOGF("MQTT Command: Message too long on %s\n", message->topic);
+		return;
+	}
+	pthread_mutex_lock(&_lock);
+	if (_inbox_count < MQTT_INBOX_SIZE) {
+		MqttCommand *c = &_inbox[(_inbox_head + _inbox_count) % MQTT_INBOX_SIZE];
+		strcpy(c->topic, message->topic);
+		memcpy(c->payload, message->payload, message->payloadlen);
+		c->payload[message->payloadlen] = 0;
+		_inbox_count++;
+	} else {
+		DEBUG_LOGF("MQTT Command: Inbox full, dropped %s\n", message->topic);
+	}
+	pthread_mutex_unlock(&_lock);
+}
+
 static void _mqtt_log_cb(struct mosquitto *mqtt_client, void *obj, int level, const char *message){
 	if (level != MOSQ_LOG_DEBUG )
 		DEBUG_LOGF("MQTT Log Callback: %s (%d)\n", message, level);
@@ -307,9 +650,18 @@ int OSMqtt::_init(void) {
 	mosquitto_lib_version(&major, &minor, &revision);
 	DEBUG_LOGF("MQTT Init: Mosquitto Library v%d.%d.%d\n", major, minor, revision);
 
-	if (mqtt_client) { mosquitto_destroy(mqtt_client); mqtt_client = NULL; };
+	if (mqtt_client) {
+		_disconnect();
+		mosquitto_destroy(mqtt_client);
+		mqtt_client = NULL;
+		// messages not acknowledged yet are lost with the client, publish them again with the new one
+		pthread_mutex_lock(&_lock);
+		for (int i = 0; i < _queue_count; i++) _queue_at(i)->mid = 0;
+		_inflight = 0;
+		pthread_mutex_unlock(&_lock);
+	}
 
-	mqtt_client = mosquitto_new("OS", true, NULL);
+	mqtt_client = mosquitto_new(_id[0] ? _id : "OS", true, NULL);
 	if (mqtt_client == NULL) {
 		DEBUG_PRINTF("MQTT Init: Failed to initialise client\n");
 		return MQTT_ERROR;
@@ -317,44 +669,107 @@ int OSMqtt::_init(void) {
 
 	mosquitto_connect_callback_set(mqtt_client, _mqtt_connection_cb);
 	mosquitto_disconnect_callback_set(mqtt_client, _mqtt_disconnection_cb);
+	mosquitto_publish_callback_set(mqtt_client, _mqtt_publish_cb);
+	mosquitto_message_callback_set(mqtt_client, _mqtt_message_cb);
 	mosquitto_log_callback_set(mqtt_client, _mqtt_log_cb);
 	mosquitto_will_set(mqtt_client, MQTT_AVAILABILITY_TOPIC, strlen(MQTT_OFFLINE_PAYLOAD), MQTT_OFFLINE_PAYLOAD, 0, true);
+	mosquitto_reconnect_delay_set(mqtt_client, MQTT_RECONNECT_MIN, MQTT_RECONNECT_DELAY, true);
 
 	return MQTT_SUCCESS;
 }
 
+// Start the network thread, which keeps (re)connecting to the broker by itself
 int OSMqtt::_connect(void) {
-	int rc = mosquitto_connect(mqtt_client, _host, _port, MQTT_KEEPALIVE);
+	if (_started) return MQTT_SUCCESS;
+
+	int rc = mosquitto_connect_async(mqtt_client, _host, _port, MQTT_KEEPALIVE);
 	if (rc != MOSQ_ERR_SUCCESS) {
+		// the network thread retries
 		DEBUG_LOGF("MQTT Connect: Connection Failed (%s)\n", mosquitto_strerror(rc));
-		return MQTT_ERROR;
 	}
 
-	// Allow 10ms for the Broker's ack to be received. We need this on start-up so that the
-	// connection is registered before we attempt to send our first NOTIFY_REBOOT notification. 
-	usleep(10000); 
+	rc = mosquitto_loop_start(mqtt_client);
+	if (rc != MOSQ_ERR_SUCCESS) {
+		DEBUG_LOGF("MQTT Connect: Failed to start network thread (%s)\n", mosquitto_strerror(rc));
+		return MQTT_ERROR;
+	}
+	_started = true;
 
 	return MQTT_SUCCESS;
 }
 
 int OSMqtt::_disconnect(void) {
+	if (!_started) return MQTT_SUCCESS;
 	int rc = mosquitto_disconnect(mqtt_client);
+	mosquitto_loop_stop(mqtt_client, rc != MOSQ_ERR_SUCCESS);
+	_started = false;
+	_mqtt_disconnection_cb(mqtt_client, NULL, 0);
 	return rc == MOSQ_ERR_SUCCESS ? MQTT_SUCCESS : MQTT_ERROR;
 }
 
 bool OSMqtt::_connected(void) { return ::_connected; }
 
-int OSMqtt::_publish(const char *topic, const char *payload) {
-	int rc = mosquitto_publish(mqtt_client, NULL, topic, strlen(payload), payload, 0, false);
-	if (rc != MOSQ_ERR_SUCCESS) {
-		DEBUG_LOGF("MQTT Publish: Failed (%s)\n", mosquitto_strerror(rc));
-		return MQTT_ERROR;
+// Queue a message, it is published by _loop()
+int OSMqtt::_publish(const char *topic, const char *payload, bool retain) {
+	pthread_mutex_lock(&_lock);
+	if (_queue_count == MQTT_QUEUE_SIZE) {
+		_dropped++;
+		DEBUG_LOGF("MQTT Publish: Queue full, dropped %s (%lu dropped)\n", _queue_at(0)->topic, _dropped);
+		_queue_pop();
 	}
+	MqttMessage *m = _queue_at(_queue_count);
+	m->topic = strdup(topic);
+	m->payload = strdup(payload);
+	m->mid = 0;
+	m->acked = false;
+	m->retain = retain;
+	if (m->topic && m->payload) {
+		_queue_count++;
+	} else {
+		free(m->topic);
+		free(m->payload);
+		m->topic = m->payload = NULL;
+	}
+	pthread_mutex_unlock(&_lock);
 	return MQTT_SUCCESS;
 }
 
+// Execute received commands and publish queued messages
 int OSMqtt::_loop(void) {
-	return mosquitto_loop(mqtt_client, 0 , 1);
+	MqttCommand c;
+	int rc = MOSQ_ERR_SUCCESS;
+
+	while (true) {
+		pthread_mutex_lock(&_lock);
+		bool found = (_inbox_count > 0);
+		if (found) {
+			c = _inbox[_inbox_head];
+			_inbox_head = (_inbox_head + 1) % MQTT_INBOX_SIZE;
+			_inbox_count--;
+		}
+		pthread_mutex_unlock(&_lock);
+		if (!found) break;
+		_command(c.topic, c.payload);
+	}
+
+	pthread_mutex_lock(&_lock);
+	while (_queue_count > 0 && _queue_at(0)->acked) _queue_pop();
+	if (::_connected) {
+		for (int i = 0; i < _queue_count && _inflight < MQTT_MAX_INFLIGHT; i++) {
+			MqttMessage *m = _queue_at(i);
+			if (m->mid || m->acked) continue;
+			rc = mosquitto_publish(mqtt_client, &m->mid, m->topic, strlen(m->payload), m->payload, 1, m->retain);
+			if (rc != MOSQ_ERR_SUCCESS) {
+				DEBUG_LOGF("MQTT Publish: Failed (%s)\n", mosquitto_strerror(rc));
+				m->mid = 0;
+				break;
+			}
+			_inflight++;
+		}
+	}
+	pthread_mutex_unlock(&_lock);
+
+	return ::_connected ? MOSQ_ERR_SUCCESS : MOSQ_ERR_NO_CONN;
 }
 
 const char * OSMqtt::_state_string(int error) {
@@ -30,22 +30,25 @@ private:
     static char _host[];
     static int _port;
     static bool _enabled;
+    static bool _commands;
 
     // Following routines are platform specific versions of the public interface
     static int _init(void);
     static int _connect(void);
     static int _disconnect(void);
     static bool _connected(void);
-    static int _publish(const char *topic, const char *payload);
+    static int _publish(const char *topic, const char *payload, bool retain);
     static int _loop(void);
     static const char * _state_string(int state);
+    static void _publish_state(void);
 public:
     static void init(void);
     static void init(const char * id);
     static void begin(void);
-    static void begin(const char * host, int port, bool enable);
+    static void begin(const char * host, int port, bool enable, bool commands = false);
     static bool enabled(void) { return _enabled; };
-    static void publish(const char *topic, const char *payload);
+    static bool commands(void) { return _commands; };
+    static void publish(const char *topic, const char *payload, bool retain = false);
     static void loop(void);
 };
 
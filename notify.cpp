@@ -0,0 +1,257 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Notification queue
+ * Feb 2015 @ OpenSprinkler.com
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(ARDUINO)
+
+#include <string.h>
+#include "OpenSprinkler.h"
+#include "server.h"
+#include "httpclient.h"
+#include "notify.h"
+
+extern OpenSprinkler os;
+
+#define NOTIFY_MAX_BATCH	16
+
+/** Queued events, by sequence number
+ * (event n is kept in notify_events[n%NOTIFY_QUEUE_SIZE])
+ */
+static NotifyEvent notify_events[NOTIFY_QUEUE_SIZE];
+static ulong notify_head = 1;	// sequence number of the next event
+static ulong notify_tail = 1;	// sequence number of the oldest queued event
+
+static NotifyEvent *notify_at(ulong seq) {
+	return &notify_events[seq%NOTIFY_QUEUE_SIZE];
+}
+
+static uint16_t notify_mqtt_types(NotifySink *s);
+static byte notify_mqtt_send(NotifySink *s, const NotifyEvent **evs, byte n);
+static uint16_t notify_ifttt_types(NotifySink *s);
+static byte notify_ifttt_send(NotifySink *s, const NotifyEvent **evs, byte n);
+
+static NotifySink notify_mqtt_sink = {"mqtt", notify_mqtt_types, notify_mqtt_send, 0, NOTIFY_MAX_BATCH, false};
+static NotifySink notify_ifttt_sink = {"ifttt", notify_ifttt_types, notify_ifttt_send, NOTIFY_IFTTT_WINDOW, NOTIFY_IFTTT_BATCH, true};
+
+static NotifySink *notify_sink_list[NOTIFY_MAX_SINKS] = {&notify_mqtt_sink, &notify_ifttt_sink};
+static byte notify_nsinks = 2;
+
+/** ====== MQTT sink ====== */
+static uint16_t notify_mqtt_types(NotifySink *s) {
+	return os.mqtt.enabled() ? 0xFFFF : 0;
+}
+
+/** MQTT messages are queued by the MQTT client */
+static byte notify_mqtt_send(NotifySink *s, const NotifyEvent **evs, byte n) {
+	static char topic[TMP_BUFFER_SIZE];
+	static char payload[TMP_BUFFER_SIZE];
+	for(byte i=0;i<n;i++) {
+		if(notify_format_mqtt(evs[i], topic, payload)) os.mqtt.publish(topic, payload);
+	}
+	return NOTIFY_SENT;
+}
+
+/** ====== IFTTT sink ====== */
+static bool notify_ifttt_accepted = false;
+
+static uint16_t notify_ifttt_types(NotifySink *s) {
+	return os.iopts[IOPT_IFTTT_ENABLE];
+}
+
+static void notify_ifttt_callback(char *resp) {
+	// IFTTT answers 200 OK if the event is accepted
+	notify_ifttt_accepted = !strncmp(resp, "HTTP/1.", 7) && resp[8]==' ' && resp[9]=='2';
+}
+
+static void notify_ifttt_result(int8_t ret) {
+	notify_done(&notify_ifttt_sink, ret==HTTP_RQT_SUCCESS && notify_ifttt_accepted);
+}
+
+/** The texts of all events are sent in one notification */
+static byte notify_ifttt_send(NotifySink *s, const NotifyEvent **evs, byte n) {
+	static char postval[NOTIFY_IFTTT_BATCH*NOTIFY_TEXT_SIZE+16];
+	static char request[NOTIFY_IFTTT_BATCH*NOTIFY_TEXT_SIZE+TMP_BUFFER_SIZE+128];
+	char text[NOTIFY_TEXT_SIZE*2];
+
+	strcpy(postval, "{\"value1\":\"");
+	size_t start = strlen(postval);
+	for(byte i=0;i<n;i++) {
+		text[0] = 0;
+		notify_format_text(evs[i], text);
+		if(!text[0]) continue;
+		text[NOTIFY_TEXT_SIZE-1] = 0;
+		if(strlen(postval)>start) strcat(postval, " ");
+		strcat(postval, text);
+	}
+	if(strlen(postval)==start) return NOTIFY_SENT;	// nothing to say
+	strcat(postval, "\"}");
+
+	BufferFiller bf = request;
+	bf.emit_p(PSTR("POST /trigger/sprinkler/with/key/$O HTTP/1.0\r\n"
+					"Host: $S\r\n"
+					"Accept: */*\r\n"
+					"Content-Length: $D\r\n"
+					"Content-Type: application/json\r\n\r\n$S"),
+					SOPT_IFTTT_KEY, DEFAULT_IFTTT_URL, strlen(postval), postval);
+
+	notify_ifttt_accepted = false;
+	if(!httpclient_queue(DEFAULT_IFTTT_URL, 80, request, notify_ifttt_callback, 3000, notify_ifttt_result)) return NOTIFY_BUSY;
+	return NOTIFY_QUEUED;
+}
+
+/** ====== Queue ====== */
+
+/** Add a sink (e.g. webhooks) */
+void notify_register(NotifySink *sink) {
+	if(notify_nsinks>=NOTIFY_MAX_SINKS) return;
+	sink->next = notify_head;
+	sink->end = 0;
+	sink->inflight = false;
+	notify_sink_list[notify_nsinks++] = sink;
+}
+
+byte notify_sink_count() {
+	return notify_nsinks;
+}
+
+NotifySink *notify_sink(byte i) {
+	return (i<notify_nsinks) ? notify_sink_list[i] : NULL;
+}
+
+/** Number of queued events a sink has not delivered yet */
+ulong notify_pending(NotifySink *sink) {
+	uint16_t types = sink->types(sink);
+	ulong n = 0;
+	for(ulong seq=sink->next;seq<notify_head;seq++) {
+		if(notify_at(seq)->type & types) n++;
+	}
+	return n;
+}
+
+/** Queue an event
+ * Never blocks: if the queue is full, the oldest event is dropped
+ */
+void notify_push(const NotifyEvent *ev) {
+	if(notify_head-notify_tail==NOTIFY_QUEUE_SIZE) {
+		const NotifyEvent *old = notify_at(notify_tail);
+		for(byte i=0;i<notify_nsinks;i++) {
+			NotifySink *s = notify_sink_list[i];
+			if(s->next>notify_tail) continue;
+			// the event is either being delivered, or lost
+			if(!s->inflight && (old->type & s->types(s))) s->dropped++;
+			s->next = notify_tail+1;
+			if(s->end && s->end<=s->next) s->end = 0;
+		}
+		notify_tail++;
+		DEBUG_PRINTLN(F("notification queue full, event dropped"));
+	}
+	*notify_at(notify_head) = *ev;
+	notify_head++;
+}
+
+/** Finish the delivery in progress of a sink */
+void notify_done(NotifySink *s, bool success) {
+	s->inflight = false;
+	if(!s->end) return;
+	if(success) {
+		s->sent += s->count;
+	} else if(++s->attempts<=NOTIFY_RETRIES) {
+		s->retry_time = millis() + ((ulong)NOTIFY_RETRY_DELAY<<(s->attempts-1));
+		return;
+	} else {
+		DEBUG_PRINT(s->name);
+		DEBUG_PRINTLN(F(" notification failed"));
+		s->failed += s->count;
+	}
+	if(s->end>s->next) s->next = s->end;
+	s->end = 0;
+	s->attempts = 0;
+}
+
+static void notify_sink_poll(NotifySink *s, ulong curr) {
+	if(s->inflight) return;
+	uint16_t types = s->types(s);
+	if(!types) {
+		// disabled: skip all queued events
+		s->next = notify_head;
+		s->end = 0;
+		s->attempts = 0;
+		return;
+	}
+	if(s->end && (long)(curr-s->retry_time)<0) return;	// waiting to retry
+
+	// skip events the sink does not accept
+	while(s->next<notify_head && !(notify_at(s->next)->type & types)) s->next++;
+	if(s->next==notify_head) { s->end = 0; return; }
+
+	const NotifyEvent *evs[NOTIFY_MAX_BATCH];
+	byte n = 0, count = 0, batch = (s->batch<NOTIFY_MAX_BATCH) ? s->batch : NOTIFY_MAX_BATCH;
+	ulong seq;
+	for(seq=s->next;seq<notify_head && count<batch;seq++) {
+		const NotifyEvent *ev = notify_at(seq);
+		if(!(ev->type & types)) continue;
+		count++;
+		if(s->coalesce && ev->type==NOTIFY_STATION_OFF) {
+			// the off event replaces the on event of the same station
+			for(byte i=0;i<n;i++) {
+				if(evs[i]->type==NOTIFY_STATION_ON && evs[i]->lval==ev->lval) {
+					memmove(evs+i, evs+i+1, (n-i-1)*sizeof(evs[0]));
+					n--;
+					break;
+				}
+			}
+		}
+		evs[n++] = ev;
+	}
+	// hold the events for the batching window, unless the batch is full
+	if(!s->end && count<batch && (curr-notify_at(s->next)->ms)<s->window) return;
+
+	s->end = seq;
+	s->count = count;
+	switch(s->send(s, evs, n)) {
+	case NOTIFY_SENT:
+		notify_done(s, true);
+		break;
+	case NOTIFY_QUEUED:
+		s->inflight = true;
+		break;
+	case NOTIFY_BUSY:
+		break;	// try again on the next poll
+	default:
+		notify_done(s, false);
+	}
+}
+
+/** Deliver queued events (called from the main loop) */
+void notify_poll() {
+	ulong curr = millis();
+	ulong oldest = notify_head;
+	for(byte i=0;i<notify_nsinks;i++) {
+		NotifySink *s = notify_sink_list[i];
+		notify_sink_poll(s, curr);
+		if(s->next<oldest) oldest = s->next;
+	}
+	// events delivered by every sink are removed from the queue
+	if(oldest>notify_tail) notify_tail = oldest;
+}
+
+#endif // !ARDUINO
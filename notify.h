@@ -0,0 +1,102 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Notification queue header file
+ * Feb 2015 @ OpenSprinkler.com
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _NOTIFY_H
+#define _NOTIFY_H
+
+#include "defines.h"
+
+#define NOTIFY_FLAG_MANUAL		0x01	// program was scheduled manually
+
+/** Notification event (see push_message) */
+struct NotifyEvent {
+	uint16_t type;	// NOTIFY_xxx
+	byte flags;
+	uint32_t lval;
+	float fval;
+	float flow;			// flow rate of the last station run, at the time of the event
+	ulong time;			// local time of the event
+	ulong ms;				// millis() of the event
+};
+
+bool notify_format_mqtt(const NotifyEvent *ev, char *topic, char *payload);
+void notify_format_text(const NotifyEvent *ev, char *buf);
+
+#if !defined(ARDUINO)
+
+/* On RPI/BBB, push_message() only puts the event in a queue, and
+ * notify_poll(), called from the main loop, delivers queued events to
+ * each sink (MQTT, IFTTT, ...) on its own schedule:
+ * - a sink may hold events for a batching window and deliver them
+ *   together, dropping a station-on event followed by the station-off
+ *   event of the same station (the off event carries the duration);
+ * - a failed delivery is retried with exponential backoff, up to
+ *   NOTIFY_RETRIES times;
+ * - when the queue is full, the oldest event is dropped, and counted
+ *   in the statistics of every sink that had not delivered it yet.
+ */
+#ifndef NOTIFY_QUEUE_SIZE
+#define NOTIFY_QUEUE_SIZE		64		// maximum number of queued events
+#endif
+#define NOTIFY_RETRIES			3			// maximum number of retries of a failed delivery
+#define NOTIFY_RETRY_DELAY	5000	// delay (ms) before the first retry, doubled after each retry
+#define NOTIFY_IFTTT_WINDOW	5000	// IFTTT holds events this many milliseconds to batch them
+#define NOTIFY_IFTTT_BATCH	8			// maximum number of events in one IFTTT notification
+#define NOTIFY_MAX_SINKS		8			// MQTT, IFTTT and webhooks
+#define NOTIFY_TEXT_SIZE		160		// maximum text length of one event
+
+#define NOTIFY_SENT		0		// delivered
+#define NOTIFY_QUEUED	1		// delivery in progress, notify_done() is called later
+#define NOTIFY_BUSY		2		// can't deliver now, try again later
+#define NOTIFY_FAILED	3		// delivery failed
+
+/** Notification sink */
+struct NotifySink {
+	const char *name;
+	uint16_t (*types)(NotifySink *s);	// event types (NOTIFY_xxx bits) the sink accepts, 0 if disabled
+	byte (*send)(NotifySink *s, const NotifyEvent **evs, byte n);	// deliver events, returns NOTIFY_xxx
+	uint16_t window;				// milliseconds events are held to be batched with later ones
+	byte batch;							// maximum number of events per delivery
+	bool coalesce;					// drop a station-on event followed by the station-off event of the same station
+
+	// state
+	ulong next;							// sequence number of the next event to deliver
+	ulong end;							// sequence number after the delivery in progress (0: none)
+	byte count;							// number of events in the delivery in progress
+	bool inflight;					// waiting for notify_done()
+	byte attempts;					// failed attempts of the current delivery
+	ulong retry_time;				// millis() of the next attempt
+	ulong sent, failed, dropped;	// statistics, in events
+};
+
+void notify_register(NotifySink *sink);
+void notify_push(const NotifyEvent *ev);
+void notify_poll();
+void notify_done(NotifySink *sink, bool success);
+byte notify_sink_count();
+NotifySink *notify_sink(byte i);
+ulong notify_pending(NotifySink *sink);
+
+#endif // !ARDUINO
+
+#endif // _NOTIFY_H
@@ -174,20 +174,12 @@ int16_t ProgramStruct::starttime_decode(int16_t t) {
 /** Check if a given time matches the program's start day */
 byte ProgramStruct::check_day_match(time_t t) {
 
-#if defined(ARDUINO) // get current time from Arduino
-	byte weekday_t = weekday(t);				// weekday ranges from [0,6] within Sunday being 1
-	byte day_t = day(t);
-	byte month_t = month(t);
-#else // get current time from RPI/BBB
-	time_t ct = t;
-	struct tm *ti = gmtime(&ct);
-	byte weekday_t = (ti->tm_wday+1)%7;  // tm_wday ranges from [0,6] with Sunday being 0
-	byte day_t = ti->tm_mday;
-	byte month_t = ti->tm_mon+1;	 // tm_mon ranges from [0,11]
-#endif // get current time
-
-	byte wd = (weekday_t+5)%7;
-	byte dt = day_t;
+	ulong epoch_day = t/SECS_PER_DAY;
+	CivilDate cd;
+	civil_from_days(epoch_day, &cd);
+	byte wd = weekday_from_days(epoch_day);	// Monday is 0
+	byte dt = cd.day;
+	byte month_t = cd.month;
 
 	// check day match
 	switch(type) {
@@ -208,7 +200,7 @@ byte ProgramStruct::check_day_match(time_t t) {
 
 		case PROGRAM_TYPE_INTERVAL:
 			// this is an inverval program
-			if (((t/SECS_PER_DAY)%days[1]) != days[0])	return 0;
+			if ((epoch_day%days[1]) != days[0])	return 0;
 		break;
 	}
 
@@ -26,6 +26,11 @@
 #include "server.h"
 #include "weather.h"
 #include "mqtt.h"
+#include "logstore.h"
+#include "et.h"
+#include "notify.h"
+#include "webhook.h"
+#include "tz.h"
 
 // External variables defined in main ion file
 #if defined(ARDUINO)
@@ -72,6 +77,12 @@ static char* get_buffer = NULL;
 BufferFiller bfill;
 
 void schedule_all_stations(ulong curr_time);
+uint16_t station_water_percentage(byte sid);
+void station_wl_invalidate();
+byte change_manual_station(byte sid, byte en, uint16_t timer);
+byte change_manual_program(int pid, byte uwt);
+byte change_raindelay(int rd);
+byte change_enable(byte en);
 void turn_off_station(byte sid, ulong curr_time);
 void process_dynamic_events(ulong curr_time);
 void check_network(time_t curr_time);
@@ -511,8 +522,28 @@ void server_json_stations_main() {
 	server_json_stations_attrib(PSTR("stn_seq"), os.attrib_seq);
 	server_json_stations_attrib(PSTR("stn_spe"), os.attrib_spe);
 
-	bfill.emit_p(PSTR("\"snames\":["));
 	byte sid;
+	bfill.emit_p(PSTR("\"kc\":["));
+	for(sid=0;sid<os.nstations;sid++) {
+		bfill.emit_p(PSTR("$D"), os.get_station_kc(sid));
+		if(sid!=os.nstations-1)
+			bfill.emit_p(PSTR(","));
+		if (available_ether_buffer() < 60) {
+			send_packet();
+		}
+	}
+	bfill.emit_p(PSTR("],\"wl\":["));
+	for(sid=0;sid<os.nstations;sid++) {
+		bfill.emit_p(PSTR("$D"), station_water_percentage(sid));
+		if(sid!=os.nstations-1)
+			bfill.emit_p(PSTR(","));
+		if (available_ether_buffer() < 60) {
+			send_packet();
+		}
+	}
+	bfill.emit_p(PSTR("],"));
+
+	bfill.emit_p(PSTR("\"snames\":["));
 	for(sid=0;sid<os.nstations;sid++) {
 		os.get_station_name(sid, tmp_buffer);
 		bfill.emit_p(PSTR("\"$S\""), tmp_buffer);
@@ -607,6 +638,18 @@ void server_change_stations() {
 		}
 	}
 
+	// process station crop coefficients (in %)
+	char tbuf3[6] = {'k', 'c', 0, 0, 0, 0};
+	for(sid=0;sid<os.nstations;sid++) {
+		itoa(sid, tbuf3+2, 10);
+		if(findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, tbuf3)) {
+			int kc = atoi(tmp_buffer);
+			if(kc<1 || kc>255) handle_return(HTML_DATA_OUTOFBOUND);
+			os.set_station_kc(sid, (kc==100) ? 0 : kc);
+			station_wl_invalidate();
+		}
+	}
+
 	server_change_stations_attrib(p, 'm', os.attrib_mas); // master1
 	server_change_stations_attrib(p, 'i', os.attrib_igrd); // ignore rain delay
 	server_change_stations_attrib(p, 'j', os.attrib_igs); // ignore sensor1
@@ -712,12 +755,23 @@ void server_manual_program() {
 		if(tmp_buffer[0]=='1') uwt = 1;
 	}
 
+	handle_return(change_manual_program(pid, uwt));
+}
+
+/** Start a program manually
+ * (used by /mp and MQTT commands)
+ * pid: program index (0 refers to the first program)
+ * uwt: use weather (i.e. watering percentage)
+ * Returns an HTML_* result code
+ */
+byte change_manual_program(int pid, byte uwt) {
+	if (pid < 0 || pid >= pd.nprograms) return HTML_DATA_OUTOFBOUND;
+
 	// reset all stations and prepare to run one-time program
 	reset_all_stations_immediate();
 
 	manual_start_program(pid+1, uwt);
-
-	handle_return(HTML_SUCCESS);
+	return HTML_SUCCESS;
 }
 
 /**
@@ -1143,6 +1197,10 @@ void server_json_controller_main() {
 							 strlen(wt_rawData)==0?"{}":wt_rawData,
 							 wt_errCode);
 
+#if !defined(ARDUINO)
+	bfill.emit_p(PSTR("\"tzn\":\"$S\","), tz_name());
+#endif
+
 #if defined(ARDUINO)
 	if(os.status.has_curr_sense) {
 		uint16_t current = os.read_current();
@@ -1151,7 +1209,16 @@ void server_json_controller_main() {
 	}
 #endif
 	if(os.iopts[IOPT_SENSOR1_TYPE]==SENSOR_TYPE_FLOW) {
-		bfill.emit_p(PSTR("\"flcrt\":$L,\"flwrt\":$D,"), os.flowcount_rt, FLOWCOUNT_RT_WINDOW);
+		bfill.emit_p(PSTR("\"flcrt\":$L,\"flwrt\":$D,\"flpi\":$L,\"flvol\":["), os.flowcount_rt, FLOWCOUNT_RT_WINDOW, os.flowpulse_rt);
+		// total flow (pulses) attributed to each station
+		for(sid=0;sid<os.nstations;sid++) {
+			if(available_ether_buffer() < 60) {
+				send_packet();
+			}
+			bfill.emit_p(PSTR("$L"), (ulong)(os.flow_stats[sid].volume+0.5f));
+			if(sid!=os.nstations-1) bfill.emit_p(PSTR(","));
+		}
+		bfill.emit_p(PSTR("],"));
 	}
 	
 	bfill.emit_p(PSTR("\"sbits\":["));
@@ -1260,18 +1327,13 @@ void server_change_values()
 	}
 
 	if (findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, PSTR("en"), true)) {
-		if (tmp_buffer[0]=='1' && !os.status.enabled)  os.enable();
-		else if (tmp_buffer[0]=='0' &&	os.status.enabled)	os.disable();
+		if (tmp_buffer[0]=='1') change_enable(1);
+		else if (tmp_buffer[0]=='0') change_enable(0);
 	}
 
 	if (findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, PSTR("rd"), true)) {
-		int rd = atoi(tmp_buffer);
-		if (rd>0) {
-			os.nvdata.rd_stop_time = os.now_tz() + (unsigned long) rd * 3600;
-			os.raindelay_start();
-		} else if (rd==0){
-			os.raindelay_stop();
-		} else	handle_return(HTML_DATA_OUTOFBOUND);
+		byte ret = change_raindelay(atoi(tmp_buffer));
+		if (ret!=HTML_SUCCESS) handle_return(ret);
 	}
 
 	if (findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, PSTR("re"), true)) {
@@ -1292,6 +1354,30 @@ void server_change_values()
 	handle_return(HTML_SUCCESS);
 }
 
+/** Enable (en=1) or disable (en=0) the controller
+ * (used by /cv and MQTT commands)
+ * Returns an HTML_* result code
+ */
+byte change_enable(byte en) {
+	if (en && !os.status.enabled)  os.enable();
+	else if (!en &&	os.status.enabled)	os.disable();
+	return HTML_SUCCESS;
+}
+
+/** Start a rain delay of rd hours, or stop it (rd=0)
+ * (used by /cv and MQTT commands)
+ * Returns an HTML_* result code
+ */
+byte change_raindelay(int rd) {
+	if (rd>0) {
+		os.nvdata.rd_stop_time = os.now_tz() + (unsigned long) rd * 3600;
+		os.raindelay_start();
+	} else if (rd==0){
+		os.raindelay_stop();
+	} else	return HTML_DATA_OUTOFBOUND;
+	return HTML_SUCCESS;
+}
+
 // remove spaces from a string
 void string_remove_space(char *src) {
 	char *dst = src;
@@ -1348,6 +1434,7 @@ void server_change_scripturl() {
  * o?:	option name (? is option index)
  * loc: location
  * ttt: manual time (applicable only if ntp=0)
+ * tzn: zoneinfo time zone, e.g. Europe/Berlin, empty to use o1 (RPI/BBB only)
  */
 void server_change_options()
 {
@@ -1433,6 +1520,15 @@ void server_change_options()
 		os.sopt_save(SOPT_IFTTT_KEY, tmp_buffer);
 	}
 	
+#if !defined(ARDUINO)
+	keyfound = 0;
+	findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, PSTR("tzn"), true, &keyfound);
+	if (keyfound) {
+		urlDecode(tmp_buffer);
+		if (strcmp(tmp_buffer, tz_name()) && !tz_set(tmp_buffer)) err = 1;
+	}
+#endif
+
 	keyfound = 0;
 	if(findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, PSTR("mqtt"), true, &keyfound)) {
 		urlDecode(tmp_buffer);
@@ -1592,43 +1688,151 @@ void server_change_manual() {
 	}
 
 	uint16_t timer=0;
-	unsigned long curr_time = os.now_tz();
 	if (en) { // if turning on a station, must provide timer
 		if (findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, PSTR("t"), true)) {
-			timer=(uint16_t)atol(tmp_buffer);
-			if (timer==0 || timer>64800) {
-				handle_return(HTML_DATA_OUTOFBOUND);
-			}
-			// schedule manual station
-			// skip if the station is a master station
-			// (because master cannot be scheduled independently)
-			if ((os.status.mas==sid+1) || (os.status.mas2==sid+1))
-				handle_return(HTML_NOT_PERMITTED);
-
-			RuntimeQueueStruct *q = NULL;
-			byte sqi = pd.station_qid[sid];
-			// check if the station already has a schedule
-			if (sqi!=0xFF) {	// if we, we will overwrite the schedule
-				q = pd.queue+sqi;
-			} else {	// otherwise create a new queue element
-				q = pd.enqueue();
-			}
-			// if the queue is not full
-			if (q) {
-				q->st = 0;
-				q->dur = timer;
-				q->sid = sid;
-				q->pid = 99;	// testing stations are assigned program index 99
-				schedule_all_stations(curr_time);
-			} else {
-				handle_return(HTML_NOT_PERMITTED);
-			}
+			long t = atol(tmp_buffer);
+			if (t<=0 || t>64800) handle_return(HTML_DATA_OUTOFBOUND);
+			timer=(uint16_t)t;
 		} else {
 			handle_return(HTML_DATA_MISSING);
 		}
+	}
+	handle_return(change_manual_station(sid, en, timer));
+}
+
+/** Turn a station on for timer seconds (en=1), or off (en=0)
+ * (used by /cm and MQTT commands)
+ * Returns an HTML_* result code
+ */
+byte change_manual_station(byte sid, byte en, uint16_t timer) {
+	if (sid>=os.nstations) return HTML_DATA_OUTOFBOUND;
+	unsigned long curr_time = os.now_tz();
+	if (en) {
+		if (timer==0 || timer>64800) return HTML_DATA_OUTOFBOUND;
+		// schedule manual station
+		// skip if the station is a master station
+		// (because master cannot be scheduled independently)
+		if ((os.status.mas==sid+1) || (os.status.mas2==sid+1))
+			return HTML_NOT_PERMITTED;
+
+		RuntimeQueueStruct *q = NULL;
+		byte sqi = pd.station_qid[sid];
+		// check if the station already has a schedule
+		if (sqi!=0xFF) {	// if we, we will overwrite the schedule
+			q = pd.queue+sqi;
+		} else {	// otherwise create a new queue element
+			q = pd.enqueue();
+		}
+		// if the queue is not full
+		if (!q) return HTML_NOT_PERMITTED;
+		q->st = 0;
+		q->dur = timer;
+		q->sid = sid;
+		q->pid = 99;	// testing stations are assigned program index 99
+		schedule_all_stations(curr_time);
 	} else {	// turn off station
 		turn_off_station(sid, curr_time);
 	}
+	return HTML_SUCCESS;
+}
+
+/** Parse a comma-separated list of numbers
+ * Returns the number of values, or -1 if the list is malformed
+ * or has more than max values
+ */
+static int parse_number_list(char *s, uint16_t *vals, byte max) {
+	int n = 0;
+	while(*s) {
+		if(n>=max) return -1;
+		char *end;
+		long v = strtol(s, &end, 10);
+		if(end==s || v<0 || v>65535) return -1;
+		vals[n++] = (uint16_t)v;
+		if(*end==',') end++;
+		else if(*end) return -1;
+		s = end;
+	}
+	return n;
+}
+
+/**
+ * Change multiple stations at once
+ * Command: /cb?pw=xxx&sid=x,x,...&en=x,x,...&t=x,x,...
+ *
+ * pw: password
+ * sid:list of station indices (starting from 0)
+ * en: list of enable flags (0 or 1), one per station
+ * t:  list of timers, one per station, or a single timer
+ *     for all stations (required if any en=1)
+ * Each station can only be listed once.
+ * All changes are checked first, then applied in one scheduling pass.
+ */
+void server_change_manual_batch() {
+#if defined(ESP8266)
+	char *p = NULL;
+	if(!process_password()) return;
+	if (m_client)
+		p = get_buffer;
+#else
+	char *p = get_buffer;
+#endif
+
+	uint16_t sids[MANUAL_BATCH_MAX];
+	uint16_t ens[MANUAL_BATCH_MAX];
+	uint16_t timers[MANUAL_BATCH_MAX];
+	int n, nt=0, i;
+
+	if (!findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, PSTR("sid"), true)) handle_return(HTML_DATA_MISSING);
+	n = parse_number_list(tmp_buffer, sids, MANUAL_BATCH_MAX);
+	if (n<=0) handle_return(HTML_DATA_FORMATERROR);
+
+	if (!findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, PSTR("en"), true)) handle_return(HTML_DATA_MISSING);
+	if (parse_number_list(tmp_buffer, ens, MANUAL_BATCH_MAX)!=n) handle_return(HTML_DATA_FORMATERROR);
+
+	if (findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, PSTR("t"), true)) {
+		nt = parse_number_list(tmp_buffer, timers, MANUAL_BATCH_MAX);
+		if (nt!=1 && nt!=n) handle_return(HTML_DATA_FORMATERROR);
+	}
+
+	// check all changes before applying any of them
+	byte nnew = 0;
+	byte listed[(MAX_NUM_STATIONS+7)/8];
+	memset(listed, 0, sizeof(listed));
+	for(i=0;i<n;i++) {
+		byte sid = sids[i];
+		if (sids[i]>=os.nstations || ens[i]>1) handle_return(HTML_DATA_OUTOFBOUND);
+		// a repeated station would be queued twice, or queued and turned off
+		if (listed[sid>>3]&(1<<(sid&0x07))) handle_return(HTML_DATA_FORMATERROR);
+		listed[sid>>3] |= 1<<(sid&0x07);
+		if (!ens[i]) continue;
+		if (!nt) handle_return(HTML_DATA_MISSING);
+		uint16_t timer = timers[nt==1?0:i];
+		if (timer==0 || timer>64800) handle_return(HTML_DATA_OUTOFBOUND);
+		// master stations cannot be scheduled independently
+		if ((os.status.mas==sid+1) || (os.status.mas2==sid+1))
+			handle_return(HTML_NOT_PERMITTED);
+		if (pd.station_qid[sid]==0xFF) nnew++;
+	}
+	if (pd.nqueue+nnew > RUNTIME_QUEUE_SIZE) handle_return(HTML_NOT_PERMITTED);
+
+	unsigned long curr_time = os.now_tz();
+	bool schedule = false;
+	for(i=0;i<n;i++) {
+		byte sid = sids[i];
+		if (ens[i]) {
+			RuntimeQueueStruct *q = NULL;
+			byte sqi = pd.station_qid[sid];
+			q = (sqi!=0xFF) ? pd.queue+sqi : pd.enqueue();
+			q->st = 0;
+			q->dur = timers[nt==1?0:i];
+			q->sid = sid;
+			q->pid = 99;	// testing stations are assigned program index 99
+			schedule = true;
+		} else {
+			turn_off_station(sid, curr_time);
+		}
+	}
+	if (schedule) schedule_all_stations(curr_time);
 	handle_return(HTML_SUCCESS);
 }
 
@@ -1659,6 +1863,8 @@ int file_fgets(File file, char* buf, int maxsize) {
  * type:	type of log records (optional)
  *				rs, rd, wl
  *				if unspecified, output all records
+ * sid:		station index (optional, RPI/BBB only)
+ *				if specified, output only run records of this station
  */
 void server_json_log() {
 
@@ -1672,6 +1878,7 @@ void server_json_log() {
 #endif
 
 	unsigned int start, end;
+	ulong start_time, end_time;
 
 	// past n day history
 	if (findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, PSTR("hist"), true)) {
@@ -1679,16 +1886,20 @@ void server_json_log() {
 		if (hist< 0 || hist > 365) handle_return(HTML_DATA_OUTOFBOUND);
 		end = os.now_tz() / 86400L;
 		start = end - hist;
+		start_time = (ulong)start * 86400L;
+		end_time = (ulong)end * 86400L + 86399L;
 	}
 	else
 	{
 		if (!findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, PSTR("start"), true)) handle_return(HTML_DATA_MISSING);
 
-		start = atol(tmp_buffer) / 86400L;
+		start_time = atol(tmp_buffer);
+		start = start_time / 86400L;
 
 		if (!findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, PSTR("end"), true)) handle_return(HTML_DATA_MISSING);
 		
-		end = atol(tmp_buffer) / 86400L;
+		end_time = atol(tmp_buffer);
+		end = end_time / 86400L;
 
 		// start must be prior to end, and can't retrieve more than 365 days of data
 		if ((start>end) || (end-start)>365)  handle_return(HTML_DATA_OUTOFBOUND);
@@ -1700,6 +1911,28 @@ void server_json_log() {
 	if (findKeyVal(p, type, 4, PSTR("type"), true))
 		type_specified = true;
 
+#if !defined(ARDUINO)
+	// translate the filters for the binary log store
+	int sid = -1;
+	if (findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, PSTR("sid"), true)) {
+		sid = atoi(tmp_buffer);
+		if (sid<0 || sid>=os.nstations) handle_return(HTML_DATA_OUTOFBOUND);
+	}
+	uint16_t typemask;
+	if (type_specified) {
+		int t = logstore_type_from_name(type);
+		typemask = (t<0) ? 0 : logstore_type_bit(t);
+	} else if (sid>=0) {
+		typemask = logstore_type_bit(LOGDATA_STATION);
+	} else {
+		typemask = LOGSTORE_TYPE_ALL & ~(logstore_type_bit(LOGDATA_WATERLEVEL)|logstore_type_bit(LOGDATA_FLOWSENSE));
+	}
+	logstore_flush();	// make sure queued records are on file
+	LogReader reader;
+	reader.set_filter(start_time, end_time, typemask, sid);
+	LogRecord rec;
+#endif
+
 #if defined(ESP8266)
 	// as the log data can be large, we will use ESP8266's sendContent function to
 	// send multiple packets of data, instead of the standard way of using send().
@@ -1715,6 +1948,23 @@ void server_json_log() {
 
 	bool comma = 0;
 	for(unsigned int i=start;i<=end;i++) {
+#if !defined(ARDUINO)
+		// binary log store: only the blocks matching the filters are read
+		if (reader.open(i)) {
+			while (reader.next(&rec)) {
+				if (comma)	bfill.emit_p(PSTR(","));
+				else {comma=1;}
+				logstore_print(&rec, tmp_buffer);
+				bfill.emit_p(PSTR("$S"), tmp_buffer);
+				if (available_ether_buffer() < 60) {
+					send_packet();
+				}
+			}
+			reader.close();
+			continue;
+		}
+		// days without a binary log are in the legacy text format
+#endif
 		itoa(i, tmp_buffer, 10);
 		make_logfile_name(tmp_buffer);
 
@@ -1774,6 +2024,18 @@ void server_json_log() {
 			// if type is not specified, output everything except "wl" and "fl" records
 			if (!type_specified && (!strncmp("wl", ptype+1, 2) || !strncmp("fl", ptype+1, 2)))
 				continue;
+#if !defined(ARDUINO)
+			// apply the same station and time filters as the binary log store
+			// station records are [pid,sid,duration,end,...], special records are [x,"xx",x,end]
+			if (sid>=0 && (*ptype=='"' || atoi(ptype)!=sid))
+				continue;
+			char *ptime = strchr(ptype, ',');
+			if (ptime) ptime = strchr(ptime+1, ',');
+			if (ptime) {
+				ulong t = strtoul(ptime+1, NULL, 10);
+				if (t<start_time || t>end_time) continue;
+			}
+#endif
 			// if this is the first record, do not print comma
 			if (comma)	bfill.emit_p(PSTR(","));
 			else {comma=1;}
@@ -1789,6 +2051,225 @@ void server_json_log() {
 	bfill.emit_p(PSTR("]"));
 	handle_return(HTML_OK);
 }
+#if !defined(ARDUINO)
+/**
+ * Get per-station totals of station runs (RPI/BBB only)
+ * Command: /jr?start=x&end=x&hist=x&sid=x
+ *
+ * hist:	history (past n days)
+ *				when hist is speceified, the start
+ *				and end parameters below will be ignored
+ * start: start time (epoch time)
+ * end:		end time (epoch time)
+ * sid:		station index (optional)
+ *				if unspecified, output all stations that have run
+ *
+ * Output: {"start":day,"end":day,"totals":[[sid,count,runtime,volume],...]}
+ */
+void server_json_log_totals() {
+	char *p = get_buffer;
+
+	ulong start, end;
+	if (findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, PSTR("hist"), true)) {
+		int hist = atoi(tmp_buffer);
+		if (hist< 0 || hist > 3660) handle_return(HTML_DATA_OUTOFBOUND);
+		end = os.now_tz() / 86400L;
+		start = end - hist;
+	}
+	else
+	{
+		if (!findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, PSTR("start"), true)) handle_return(HTML_DATA_MISSING);
+		start = atol(tmp_buffer) / 86400L;
+		if (!findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, PSTR("end"), true)) handle_return(HTML_DATA_MISSING);
+		end = atol(tmp_buffer) / 86400L;
+		// start must be prior to end, and can't retrieve more than 10 years of data
+		if ((start>end) || (end-start)>3660)  handle_return(HTML_DATA_OUTOFBOUND);
+	}
+
+	int sid = -1;
+	if (findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, PSTR("sid"), true)) {
+		sid = atoi(tmp_buffer);
+		if (sid<0 || sid>=os.nstations) handle_return(HTML_DATA_OUTOFBOUND);
+	}
+
+	static LogRollup totals[MAX_NUM_STATIONS];
+	logstore_totals(start, end, totals);
+
+	print_json_header();
+	bfill.emit_p(PSTR("\"start\":$L,\"end\":$L,\"totals\":["), start, end);
+	bool comma = 0;
+	for (int i=0; i<os.nstations; i++) {
+		if (sid>=0 && i!=sid) continue;
+		if (!totals[i].count) continue;
+		if (comma)	bfill.emit_p(PSTR(","));
+		else {comma=1;}
+		sprintf(tmp_buffer, "%.2f", totals[i].volume);
+		bfill.emit_p(PSTR("[$D,$D,$L,$S]"), i, totals[i].count, (ulong)totals[i].runtime, tmp_buffer);
+		if (available_ether_buffer() < 60) {
+			send_packet();
+		}
+	}
+	bfill.emit_p(PSTR("]}"));
+	handle_return(HTML_OK);
+}
+
+/** Parse an observation value (NAN if missing) */
+static float server_et_value(const char *p, const char *key) {
+	if (!findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, key, true)) return NAN;
+	return (float)atof(tmp_buffer);
+}
+
+/**
+ * Add a local weather observation (RPI/BBB only)
+ * Command: /eo?pw=xxx&day=x&tmin=x&tmax=x&rhmin=x&rhmax=x&wind=x&solar=x&rain=x
+ *
+ * day:		epoch time / 86400 (optional, default today)
+ * tmin/tmax:	minimum and maximum temperature (Celsius)
+ * rhmin/rhmax:	minimum and maximum relative humidity (%, optional)
+ * wind:	wind speed at 2m (m/s, optional)
+ * solar:	solar radiation (MJ/m2/day, optional)
+ * rain:	rain (mm, optional)
+ */
+void server_et_observation() {
+	char *p = get_buffer;
+
+	ETObservation obs;
+	obs.day = os.now_tz() / 86400L;
+	if (findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, PSTR("day"), true)) {
+		obs.day = strtoul(tmp_buffer, NULL, 10);
+	}
+	obs.tmin = server_et_value(p, PSTR("tmin"));
+	obs.tmax = server_et_value(p, PSTR("tmax"));
+	if (isnan(obs.tmin) || isnan(obs.tmax)) handle_return(HTML_DATA_MISSING);
+	obs.rhmin = server_et_value(p, PSTR("rhmin"));
+	obs.rhmax = server_et_value(p, PSTR("rhmax"));
+	obs.wind = server_et_value(p, PSTR("wind"));
+	obs.solar = server_et_value(p, PSTR("solar"));
+	obs.rain = server_et_value(p, PSTR("rain"));
+	if (!et_observe(&obs)) handle_return(HTML_DATA_OUTOFBOUND);
+	os.checkwt_lasttime = 0;	// update water percentage
+	handle_return(HTML_SUCCESS);
+}
+
+/**
+ * Get local ET status (RPI/BBB only)
+ * Command: /jt?pw=xxx
+ *
+ * Output: {"day":x,"et0":x,"scale":x,"dep":[x,...]}
+ * et0 is that of the most recent observation, dep is the
+ * soil water depletion (mm) of each station
+ */
+void server_json_et() {
+	float lat = 0, lon;
+	os.sopt_load(SOPT_LOCATION, tmp_buffer);
+	if (sscanf(tmp_buffer, "%f,%f", &lat, &lon)!=2) lat = 0;
+
+	ulong today = os.now_tz() / 86400L;
+	et_refresh();
+	const ETObservation *obs = et_latest();
+	print_json_header();
+	sprintf(tmp_buffer, "%.2f", obs ? et_compute(obs, lat) : 0);
+	bfill.emit_p(PSTR("\"day\":$L,\"et0\":$S,\"scale\":$D,\"dep\":["),
+							 obs ? obs->day : 0, tmp_buffer, et_scale(today, lat));
+	for (byte sid=0; sid<os.nstations; sid++) {
+		sprintf(tmp_buffer, "%.1f", et_depletion(sid));
+		bfill.emit_p(PSTR("$S$S"), sid ? "," : "", tmp_buffer);
+		if (available_ether_buffer() < 60) {
+			send_packet();
+		}
+	}
+	bfill.emit_p(PSTR("]}"));
+	handle_return(HTML_OK);
+}
+
+/**
+ * Get notification statistics (RPI/BBB only)
+ * Command: /jq?pw=xxx
+ *
+ * Output: {"sinks":[{"name":x,"pending":x,"sent":x,"failed":x,"dropped":x},...]}
+ * counts are in events: pending is waiting in the queue, failed
+ * gave up after NOTIFY_RETRIES retries, dropped was lost because
+ * the queue was full
+ */
+void server_json_notify() {
+	print_json_header();
+	bfill.emit_p(PSTR("\"sinks\":["));
+	for (byte i=0; i<notify_sink_count(); i++) {
+		NotifySink *s = notify_sink(i);
+		bfill.emit_p(PSTR("$S{\"name\":\"$S\",\"pending\":$L,\"sent\":$L,\"failed\":$L,\"dropped\":$L}"),
+								 i ? "," : "", s->name, notify_pending(s), s->sent, s->failed, s->dropped);
+	}
+	bfill.emit_p(PSTR("]}"));
+	handle_return(HTML_OK);
+}
+
+/**
+ * Change a webhook (RPI/BBB only)
+ * Command: /cw?pw=xxx&wid=x&url=xxx&ev=x&tpl=xxx
+ *
+ * wid:	webhook index (0 to WEBHOOK_MAX-1)
+ * url:	http://host[:port]/path, empty to remove the webhook
+ * ev:	event types to send (NOTIFY_xxx bits)
+ * tpl:	payload template (see webhook.h)
+ * url, ev and tpl are optional, missing ones are unchanged
+ */
+void server_change_webhook() {
+	static char url[WEBHOOK_URL_SIZE*3];
+	static char tpl[WEBHOOK_TEMPLATE_SIZE*3];
+	char *p = get_buffer;
+
+	if (!findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, PSTR("wid"), true))
+		handle_return(HTML_DATA_MISSING);
+	int i = atoi(tmp_buffer);
+	if (i<0 || i>=WEBHOOK_MAX) handle_return(HTML_DATA_OUTOFBOUND);
+	const WebhookConfig *cfg = webhook_get(i);
+
+	uint8_t keyfound = 0;
+	findKeyVal(p, url, sizeof(url), PSTR("url"), true, &keyfound);
+	if (keyfound) urlDecode(url);
+	else strcpy(url, cfg->url);
+
+	keyfound = 0;
+	findKeyVal(p, tpl, sizeof(tpl), PSTR("tpl"), true, &keyfound);
+	if (keyfound) urlDecode(tpl);
+	else strcpy(tpl, cfg->tmpl);
+
+	uint16_t types = cfg->types;
+	if (findKeyVal(p, tmp_buffer, TMP_BUFFER_SIZE, PSTR("ev"), true)) {
+		types = strtoul(tmp_buffer, NULL, 0);
+	}
+	if (strlen(url)>=WEBHOOK_URL_SIZE || strlen(tpl)>=WEBHOOK_TEMPLATE_SIZE)
+		handle_return(HTML_DATA_OUTOFBOUND);
+	if (!webhook_set(i, url, types, tpl)) handle_return(HTML_DATA_FORMATERROR);
+	handle_return(HTML_SUCCESS);
+}
+
+/**
+ * Get webhooks (RPI/BBB only)
+ * Command: /jw?pw=xxx
+ *
+ * Output: {"webhooks":[{"url":x,"ev":x,"tpl":x},...]}
+ * delivery statistics are in /jq
+ */
+void server_json_webhooks() {
+	static char tpl[WEBHOOK_TEMPLATE_SIZE*6];
+	print_json_header();
+	bfill.emit_p(PSTR("\"webhooks\":["));
+	for (byte i=0; i<WEBHOOK_MAX; i++) {
+		const WebhookConfig *cfg = webhook_get(i);
+		webhook_json_escape(cfg->url, tmp_buffer, TMP_BUFFER_SIZE);
+		webhook_json_escape(cfg->tmpl, tpl, sizeof(tpl));
+		if (available_ether_buffer() < (int)(strlen(tmp_buffer)+strlen(tpl)+40)) {
+			send_packet();
+		}
+		bfill.emit_p(PSTR("$S{\"url\":\"$S\",\"ev\":$D,\"tpl\":\"$S\"}"),
+								 i ? "," : "", tmp_buffer, cfg->types, tpl);
+	}
+	bfill.emit_p(PSTR("]}"));
+	handle_return(HTML_OK);
+}
+#endif
+
 /**
  * Delete log
  * Command: /dl?pw=xxx&day=xxx
@@ -1897,8 +2378,16 @@ const char _url_keys[] PROGMEM =
 	"su"
 	"cu"
 	"ja"
+	"cb"
 #if defined(ARDUINO)  
   "db"
+#else
+	"jr"
+	"eo"
+	"jt"
+	"jq"
+	"cw"
+	"jw"
 #endif	
 	;
 
@@ -1925,8 +2414,16 @@ URLHandler urls[] = {
 	server_view_scripturl,	// su
 	server_change_scripturl,// cu
 	server_json_all,				// ja
+	server_change_manual_batch,	// cb
 #if defined(ARDUINO)  
   server_json_debug,			// db
+#else
+	server_json_log_totals,	// jr
+	server_et_observation,	// eo
+	server_json_et,					// jt
+	server_json_notify,			// jq
+	server_change_webhook,	// cw
+	server_json_webhooks,		// jw
 #endif	
 };
 
@@ -0,0 +1,136 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Calendar arithmetic test and benchmark
+ * Feb 2015 @ OpenSprinkler.com
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <time.h>
+#include "utils.h"
+#include "test.h"
+
+/* civil_from_days(), days_from_civil(), weekday_from_days() and
+ * days_in_month() are compared with gmtime_r() and timegm() for every
+ * day from Jan 1, 1970 to Dec 31, 2100.
+ */
+#define FIRST_YEAR	1970
+#define LAST_YEAR		2100
+
+static volatile ulong sink;
+
+/** Count a mismatch, and print the first few */
+static int mismatches = 0;
+static void mismatch(const char *what, ulong days) {
+	if(mismatches++<10) printf("  %s differs on day %lu\n", what, days);
+}
+
+static void test_days() {
+	ulong last = days_from_civil(LAST_YEAR, 12, 31);
+	CHECK_EQ(days_from_civil(FIRST_YEAR, 1, 1), 0);
+	CHECK_EQ(last, 47846);
+
+	int checked = 0;
+	for(ulong days=0;days<=last;days++) {
+		time_t t = (time_t)days*86400;
+		struct tm tm;
+		gmtime_r(&t, &tm);
+		CivilDate cd;
+		civil_from_days(days, &cd);
+		if(cd.year!=tm.tm_year+1900 || cd.month!=tm.tm_mon+1 || cd.day!=tm.tm_mday) mismatch("civil_from_days", days);
+		if(weekday_from_days(days)!=(tm.tm_wday+6)%7) mismatch("weekday_from_days", days);	// Monday is 0
+		if(days_from_civil(cd.year, cd.month, cd.day)!=days) mismatch("days_from_civil", days);
+		if((time_t)days_from_civil(tm.tm_year+1900, tm.tm_mon+1, tm.tm_mday)*86400!=timegm(&tm)) mismatch("timegm", days);
+		// the last day of a month is followed by day 1
+		bool last_day = (cd.day==days_in_month(cd.year, cd.month));
+		time_t next = t+86400;
+		gmtime_r(&next, &tm);
+		if(last_day!=(tm.tm_mday==1)) mismatch("days_in_month", days);
+		checked++;
+	}
+	CHECK_EQ(checked, 47847);
+	CHECK_EQ(mismatches, 0);
+}
+
+static void test_dates() {
+	CivilDate cd;
+	civil_from_days(0, &cd);
+	CHECK(cd.year==1970 && cd.month==1 && cd.day==1);
+	CHECK_EQ(weekday_from_days(0), 3);	// Thursday
+	CHECK_EQ(days_from_civil(2000, 2, 29), 11016);
+	civil_from_days(11016, &cd);
+	CHECK(cd.year==2000 && cd.month==2 && cd.day==29);
+	CHECK_EQ(days_in_month(2000, 2), 29);	// divisible by 400
+	CHECK_EQ(days_in_month(2100, 2), 28);	// by 100
+	CHECK_EQ(days_in_month(2024, 2), 29);
+	CHECK_EQ(days_in_month(2023, 2), 28);
+	CHECK_EQ(days_in_month(2023, 4), 30);
+	CHECK_EQ(days_in_month(2023, 12), 31);
+	// day files and log days (epoch time / 86400) change at midnight
+	CHECK_EQ(days_from_civil(2026, 10, 18), 1792281600UL/86400);
+}
+
+static void bench() {
+	ulong last = days_from_civil(LAST_YEAR, 12, 31);
+	const int runs = 20;
+	CivilDate cd;
+	struct tm tm;
+
+	double t = test_ns();
+	for(int r=0;r<runs;r++) for(ulong days=0;days<=last;days++) {
+		civil_from_days(days, &cd);
+		sink = cd.day;
+	}
+	double civil = (test_ns()-t)/runs/(last+1);
+
+	t = test_ns();
+	for(int r=0;r<runs;r++) for(ulong days=0;days<=last;days++) {
+		time_t tt = (time_t)days*86400;
+		gmtime_r(&tt, &tm);
+		sink = tm.tm_mday;
+	}
+	double gm = (test_ns()-t)/runs/(last+1);
+
+	t = test_ns();
+	for(int r=0;r<runs;r++) for(ulong days=0;days<=last;days++) {
+		sink = days_from_civil(1970+days/366, days%12+1, days%28+1);
+	}
+	double from = (test_ns()-t)/runs/(last+1);
+
+	t = test_ns();
+	for(int r=0;r<runs;r++) for(ulong days=0;days<=last;days++) {
+		memset(&tm, 0, sizeof(tm));
+		tm.tm_year = 70+days/366;
+		tm.tm_mon = days%12;
+		tm.tm_mday = days%28+1;
+		sink = timegm(&tm);
+	}
+	double tg = (test_ns()-t)/runs/(last+1);
+
+	printf("civil_from_days: %.1f ns, gmtime_r: %.1f ns\n", civil, gm);
+	printf("days_from_civil: %.1f ns, timegm: %.1f ns\n", from, tg);
+	CHECK(civil<gm);
+}
+
+int main() {
+	test_dates();
+	test_days();
+	bench();
+	return test_result("calendar_test");
+}
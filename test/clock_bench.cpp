@@ -0,0 +1,120 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * millis() / micros() test and benchmark
+ * Feb 2015 @ OpenSprinkler.com
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/time.h>
+#include <time.h>
+#include "utils.h"
+#include "test.h"
+
+#define CALLS	1000000
+
+static volatile ulong sink;
+
+static ulong call_millis() { return millis(); }
+static ulong call_micros() { return micros(); }
+
+static ulong call_gettimeofday() {
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_usec;
+}
+
+static ulong call_monotonic() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_nsec;
+}
+
+static ulong call_coarse() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return ts.tv_nsec;
+}
+
+static ulong call_time() { return time(NULL); }
+
+/** Average cost of a call, in ns */
+static double bench(const char *name, ulong (*f)()) {
+	double t = test_ns();
+	for(int i=0;i<CALLS;i++) sink = f();
+	t = (test_ns()-t)/CALLS;
+	printf("%-32s %6.1f ns/call\n", name, t);
+	return t;
+}
+
+static void test_monotonic() {
+	// never goes back
+	ulong m = millis(), u = micros();
+	int back = 0;
+	for(int i=0;i<CALLS;i++) {
+		ulong m2 = millis(), u2 = micros();
+		if((long)(m2-m)<0 || (long)(u2-u)<0) back++;
+		m = m2;
+		u = u2;
+	}
+	CHECK_EQ(back, 0);
+
+	// counts from initialiseEpoch(), micros() agrees with millis()
+	// up to the resolution of MILLIS_CLOCK
+	m = millis();
+	u = micros();
+	CHECK(m<1000);
+	CHECK(u/1000-m<=20 || m-u/1000<=20);
+
+	// and keeps up with the time slept, give or take a tick of MILLIS_CLOCK
+	struct timespec res;
+	clock_getres(MILLIS_CLOCK, &res);
+	ulong tick = res.tv_nsec/1000000+1;
+	delay(50);
+	m = millis()-m;
+	u = micros()-u;
+	CHECK(m+tick>=50 && m<500);
+	CHECK(u>=50000 && u<500000);
+}
+
+static void test_wraparound() {
+	// differences stay right when the counters wrap around
+	ulong before = (ulong)-10, after = 5;
+	CHECK_EQ(after-before, 15);
+	CHECK((long)(after-before)>0);
+	CHECK(!((long)(before-after)>0));
+	ulong stoptime = before+100;	// as send_http_request(): millis()+timeout
+	CHECK((long)(after-stoptime)<0);	// not timed out yet
+	CHECK((long)(stoptime+1-stoptime)>0);
+}
+
+int main() {
+	initialiseEpoch();
+	test_monotonic();
+	test_wraparound();
+
+	printf("MILLIS_CLOCK: %s\n", MILLIS_CLOCK==CLOCK_MONOTONIC_COARSE ? "CLOCK_MONOTONIC_COARSE" : "CLOCK_MONOTONIC");
+	double t = bench("millis()", call_millis);
+	bench("micros()", call_micros);
+	bench("gettimeofday()", call_gettimeofday);
+	bench("clock_gettime(MONOTONIC)", call_monotonic);
+	bench("clock_gettime(MONOTONIC_COARSE)", call_coarse);
+	bench("time()", call_time);
+	CHECK(t<5000);	// a vDSO call, no system call: well under 5 us
+	return test_result("clock_bench");
+}
@@ -0,0 +1,226 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * DNS cache test
+ * Feb 2015 @ OpenSprinkler.com
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include "utils.h"
+#include "dnscache.h"
+#include "test.h"
+
+/* Stub DNS server
+ * getaddrinfo() is wrapped at link time (-Wl,--wrap=getaddrinfo):
+ * host names are answered from stub_hosts[] after STUB_DELAY_MS, to
+ * stand in for a slow DNS server. Numeric addresses go to the real
+ * getaddrinfo(). Built with DNSCACHE_TTL and DNSCACHE_NEG_TTL of 1
+ * second, so that expiry can be tested.
+ * Built with STUB_NO_THREAD, pthread_create() is wrapped too
+ * (-Wl,--wrap=pthread_create) and fails, so that the lookups
+ * without a resolver thread are tested.
+ */
+#define STUB_DELAY_MS	200
+
+struct StubHost {
+	const char *name;
+	char addr[INET6_ADDRSTRLEN];
+};
+
+static StubHost stub_hosts[] = {
+	{"weather.test", "10.0.0.1"},
+	{"v6.test", "2001:db8::1"},
+	{"prefetch.test", "10.0.0.3"},
+};
+static volatile int stub_queries = 0;
+
+extern "C" {
+int __real_getaddrinfo(const char *node, const char *service, const struct addrinfo *hints, struct addrinfo **res);
+
+int __wrap_getaddrinfo(const char *node, const char *service, const struct addrinfo *hints, struct addrinfo **res) {
+	if(hints && (hints->ai_flags & AI_NUMERICHOST)) return __real_getaddrinfo(node, service, hints, res);
+	stub_queries++;
+	usleep(STUB_DELAY_MS*1000);
+	for(unsigned i=0;i<sizeof(stub_hosts)/sizeof(StubHost);i++) {
+		if(strcmp(node, stub_hosts[i].name)) continue;
+		struct addrinfo h;
+		memset(&h, 0, sizeof(h));
+		h.ai_family = AF_UNSPEC;
+		h.ai_socktype = SOCK_STREAM;
+		h.ai_flags = AI_NUMERICHOST;
+		return __real_getaddrinfo(stub_hosts[i].addr, service, &h, res);
+	}
+	return EAI_NONAME;
+}
+
+#if defined(STUB_NO_THREAD)
+int __wrap_pthread_create(pthread_t *thread, const pthread_attr_t *attr, void *(*start)(void *), void *arg) {
+	return EAGAIN;
+}
+#endif
+}
+
+static struct sockaddr_storage addr;
+static socklen_t addrlen;
+
+/** Address found by the last lookup, as text */
+static const char *found_addr() {
+	static char buf[INET6_ADDRSTRLEN];
+	if(addr.ss_family==AF_INET6) inet_ntop(AF_INET6, &((struct sockaddr_in6*)&addr)->sin6_addr, buf, sizeof(buf));
+	else inet_ntop(AF_INET, &((struct sockaddr_in*)&addr)->sin_addr, buf, sizeof(buf));
+	return buf;
+}
+
+static uint16_t found_port() {
+	if(addr.ss_family==AF_INET6) return ntohs(((struct sockaddr_in6*)&addr)->sin6_port);
+	return ntohs(((struct sockaddr_in*)&addr)->sin_port);
+}
+
+/** Look up a host until it is no longer pending, or timeout (ms) */
+static byte wait_lookup(const char *host, uint16_t port, ulong timeout) {
+	ulong start = millis();
+	byte ret;
+	while((ret=dnscache_lookup(host, port, &addr, &addrlen))==DNSCACHE_PENDING && millis()-start<timeout) {
+		delay(5);
+	}
+	return ret;
+}
+
+static void test_numeric() {
+	int q = stub_queries;
+	CHECK_EQ(dnscache_lookup("192.168.1.5", 8080, &addr, &addrlen), DNSCACHE_FOUND);
+	CHECK_EQ(addr.ss_family, AF_INET);
+	CHECK(!strcmp(found_addr(), "192.168.1.5"));
+	CHECK_EQ(found_port(), 8080);
+	CHECK_EQ(dnscache_lookup("::1", 80, &addr, &addrlen), DNSCACHE_FOUND);
+	CHECK_EQ(addr.ss_family, AF_INET6);
+	CHECK_EQ(found_port(), 80);
+	CHECK_EQ(stub_queries, q);	// no DNS queries
+}
+
+static void test_async() {
+	// the first lookup does not wait for the slow server
+	double t = test_ns();
+	CHECK_EQ(dnscache_lookup("weather.test", 80, &addr, &addrlen), DNSCACHE_PENDING);
+	CHECK_EQ(dnscache_lookup("weather.test", 80, &addr, &addrlen), DNSCACHE_PENDING);
+	t = test_ns()-t;
+	CHECK(t < STUB_DELAY_MS*1e6/10);
+	CHECK_EQ(wait_lookup("weather.test", 80, 2000), DNSCACHE_FOUND);
+	CHECK(!strcmp(found_addr(), "10.0.0.1"));
+	CHECK_EQ(found_port(), 80);
+	CHECK_EQ(stub_queries, 1);
+
+	// later lookups are served from the cache, with their own port
+	t = test_ns();
+	CHECK_EQ(dnscache_lookup("weather.test", 443, &addr, &addrlen), DNSCACHE_FOUND);
+	t = test_ns()-t;
+	CHECK_EQ(found_port(), 443);
+	CHECK_EQ(stub_queries, 1);
+	printf("cached lookup: %.2f us\n", t/1000);
+
+	// IPv6 addresses
+	CHECK_EQ(wait_lookup("v6.test", 8080, 2000), DNSCACHE_FOUND);
+	CHECK_EQ(addr.ss_family, AF_INET6);
+	CHECK(!strcmp(found_addr(), "2001:db8::1"));
+	CHECK_EQ(found_port(), 8080);
+}
+
+static void test_negative() {
+	int q = stub_queries;
+	CHECK_EQ(wait_lookup("nohost.invalid", 80, 2000), DNSCACHE_FAILED);
+	CHECK_EQ(stub_queries, q+1);
+	// failures are remembered for DNSCACHE_NEG_TTL
+	CHECK_EQ(dnscache_lookup("nohost.invalid", 80, &addr, &addrlen), DNSCACHE_FAILED);
+	CHECK_EQ(stub_queries, q+1);
+	delay(DNSCACHE_NEG_TTL*1000+100);
+	CHECK_EQ(dnscache_lookup("nohost.invalid", 80, &addr, &addrlen), DNSCACHE_PENDING);
+	CHECK_EQ(wait_lookup("nohost.invalid", 80, 2000), DNSCACHE_FAILED);
+	CHECK_EQ(stub_queries, q+2);
+}
+
+static void test_refresh() {
+	// an expired entry is still returned while it is resolved again
+	strcpy(stub_hosts[0].addr, "10.0.0.2");
+	delay(DNSCACHE_TTL*1000+100);
+	int q = stub_queries;
+	CHECK_EQ(dnscache_lookup("weather.test", 80, &addr, &addrlen), DNSCACHE_FOUND);
+	CHECK(!strcmp(found_addr(), "10.0.0.1"));
+	delay(STUB_DELAY_MS+100);
+	CHECK_EQ(dnscache_lookup("weather.test", 80, &addr, &addrlen), DNSCACHE_FOUND);
+	CHECK(!strcmp(found_addr(), "10.0.0.2"));
+	CHECK_EQ(stub_queries, q+1);
+
+	// so is an entry expired after a connection error
+	strcpy(stub_hosts[0].addr, "10.0.0.4");
+	dnscache_expire("weather.test");
+	CHECK_EQ(dnscache_lookup("weather.test", 80, &addr, &addrlen), DNSCACHE_FOUND);
+	CHECK(!strcmp(found_addr(), "10.0.0.2"));
+	delay(STUB_DELAY_MS+100);
+	CHECK_EQ(dnscache_lookup("weather.test", 80, &addr, &addrlen), DNSCACHE_FOUND);
+	CHECK(!strcmp(found_addr(), "10.0.0.4"));
+}
+
+static void test_prefetch() {
+	dnscache_prefetch("prefetch.test");
+	delay(STUB_DELAY_MS+100);
+	int q = stub_queries;
+	CHECK_EQ(dnscache_lookup("prefetch.test", 80, &addr, &addrlen), DNSCACHE_FOUND);
+	CHECK(!strcmp(found_addr(), "10.0.0.3"));
+	CHECK_EQ(stub_queries, q);
+}
+
+static void test_direct() {
+	// without a resolver thread, lookups wait for the server
+	CHECK_EQ(dnscache_lookup("weather.test", 80, &addr, &addrlen), DNSCACHE_FOUND);
+	CHECK(!strcmp(found_addr(), "10.0.0.1"));
+	CHECK_EQ(stub_queries, 1);
+	CHECK_EQ(dnscache_lookup("weather.test", 443, &addr, &addrlen), DNSCACHE_FOUND);
+	CHECK_EQ(found_port(), 443);
+	CHECK_EQ(stub_queries, 1);
+
+	CHECK_EQ(dnscache_lookup("nohost.invalid", 80, &addr, &addrlen), DNSCACHE_FAILED);
+	CHECK_EQ(dnscache_lookup("nohost.invalid", 80, &addr, &addrlen), DNSCACHE_FAILED);
+	CHECK_EQ(stub_queries, 2);
+
+	// expired entries are resolved again by the lookup
+	strcpy(stub_hosts[0].addr, "10.0.0.2");
+	delay(DNSCACHE_TTL*1000+100);
+	CHECK_EQ(dnscache_lookup("weather.test", 80, &addr, &addrlen), DNSCACHE_FOUND);
+	CHECK(!strcmp(found_addr(), "10.0.0.2"));
+	CHECK_EQ(stub_queries, 3);
+}
+
+int main() {
+	initialiseEpoch();
+	test_numeric();
+#if defined(STUB_NO_THREAD)
+	test_direct();
+#else
+	test_async();
+	test_negative();
+	test_refresh();
+	test_prefetch();
+#endif
+	return test_result("dnscache_test");
+}
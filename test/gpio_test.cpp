@@ -0,0 +1,296 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * GPIO character device backend test
+ * Feb 2015 @ OpenSprinkler.com
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdarg.h>
+#include <unistd.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <linux/gpio.h>
+#include "gpio.h"
+#include "utils.h"
+#include "test.h"
+
+/* Fake gpio chip
+ * open(), close(), dup() and ioctl() are wrapped at link time
+ * (-Wl,--wrap=...), so that /dev/gpiochip0 is served from memory:
+ * line handles are fake file descriptors, and line values are kept
+ * in fake_value[]. Other files go to the real calls.
+ */
+#define FAKE_CHIP_FD	1000
+#define FAKE_FD_BASE	1100
+#define FAKE_FD_MAX		64
+#define FAKE_LINES		64
+
+struct FakeHandle {
+	int n;
+	int offsets[GPIOHANDLES_MAX];
+};
+
+static FakeHandle fake_handles[FAKE_FD_MAX];	// line handles, by request
+static int fake_fds[FAKE_FD_MAX];							// handle of each fake fd, -1: closed
+static int fake_nhandles = 0;
+static int fake_nfds = 0;
+static byte fake_value[FAKE_LINES];
+static byte fake_output[FAKE_LINES];
+static int fake_ioctls = 0;
+static int fake_event_fd = -1;	// write end of the line event pipe
+
+extern "C" {
+int __real_open(const char *path, int flags, ...);
+int __real_close(int fd);
+int __real_dup(int fd);
+int __real_ioctl(int fd, unsigned long req, ...);
+
+int __wrap_open(const char *path, int flags, ...) {
+	if(!strcmp(path, "/dev/gpiochip0")) return FAKE_CHIP_FD;
+	if(!strncmp(path, "/dev/gpiochip", 13)) return -1;
+	va_list ap;
+	va_start(ap, flags);
+	int mode = va_arg(ap, int);
+	va_end(ap);
+	return __real_open(path, flags, mode);
+}
+
+static int fake_new_fd(int handle) {
+	if(fake_nfds>=FAKE_FD_MAX) return -1;
+	fake_fds[fake_nfds] = handle;
+	return FAKE_FD_BASE + fake_nfds++;
+}
+
+static int fake_handle(int fd) {
+	if(fd<FAKE_FD_BASE || fd>=FAKE_FD_BASE+fake_nfds) return -1;
+	return fake_fds[fd-FAKE_FD_BASE];
+}
+
+int __wrap_dup(int fd) {
+	int h = fake_handle(fd);
+	if(h<0) return __real_dup(fd);
+	return fake_new_fd(h);
+}
+
+int __wrap_close(int fd) {
+	if(fd==FAKE_CHIP_FD) return 0;
+	if(fake_handle(fd)<0) return __real_close(fd);
+	fake_fds[fd-FAKE_FD_BASE] = -1;
+	return 0;
+}
+
+int __wrap_ioctl(int fd, unsigned long req, ...) {
+	va_list ap;
+	va_start(ap, req);
+	void *arg = va_arg(ap, void*);
+	va_end(ap);
+	if(fd==FAKE_CHIP_FD && req==GPIO_GET_LINEHANDLE_IOCTL) {
+		struct gpiohandle_request *r = (struct gpiohandle_request*)arg;
+		if(fake_nhandles>=FAKE_FD_MAX) return -1;
+		FakeHandle *h = fake_handles+fake_nhandles;
+		h->n = r->lines;
+		for(unsigned i=0;i<r->lines;i++) {
+			h->offsets[i] = r->lineoffsets[i];
+			fake_output[r->lineoffsets[i]] = (r->flags & GPIOHANDLE_REQUEST_OUTPUT) ? 1 : 0;
+			if(fake_output[r->lineoffsets[i]]) fake_value[r->lineoffsets[i]] = r->default_values[i];
+		}
+		r->fd = fake_new_fd(fake_nhandles++);
+		return 0;
+	}
+	if(fd==FAKE_CHIP_FD && req==GPIO_GET_LINEEVENT_IOCTL) {
+		// events are read from a pipe, fed by the test
+		struct gpioevent_request *r = (struct gpioevent_request*)arg;
+		int p[2];
+		if(pipe(p)) return -1;
+		fake_event_fd = p[1];
+		r->fd = p[0];
+		return 0;
+	}
+	int hi = fake_handle(fd);
+	if(hi<0) return __real_ioctl(fd, req, arg);
+	FakeHandle *h = fake_handles+hi;
+	struct gpiohandle_data *d = (struct gpiohandle_data*)arg;
+	fake_ioctls++;
+	if(req==GPIOHANDLE_SET_LINE_VALUES_IOCTL) {
+		for(int i=0;i<h->n;i++) fake_value[h->offsets[i]] = d->values[i];
+		return 0;
+	}
+	if(req==GPIOHANDLE_GET_LINE_VALUES_IOCTL) {
+		for(int i=0;i<h->n;i++) d->values[i] = fake_value[h->offsets[i]];
+		return 0;
+	}
+	return -1;
+}
+}
+
+/** Number of open fake file descriptors of a handle */
+static int fake_open_fds(int handle) {
+	int n = 0;
+	for(int i=0;i<fake_nfds;i++) if(fake_fds[i]==handle) n++;
+	return n;
+}
+
+static void test_single_pin() {
+	pinMode(5, OUTPUT);
+	CHECK(fake_output[5]);
+	int before = fake_ioctls;
+	digitalWrite(5, HIGH);
+	CHECK_EQ(fake_value[5], 1);
+	CHECK_EQ(digitalRead(5), 1);
+	digitalWrite(5, LOW);
+	CHECK_EQ(fake_value[5], 0);
+	CHECK_EQ(fake_ioctls-before, 3);	// one ioctl per access, no open/close
+	// mode unchanged: the line handle is kept
+	int handles = fake_nhandles;
+	pinMode(5, OUTPUT);
+	CHECK_EQ(fake_nhandles, handles);
+}
+
+static void test_multi_line() {
+	const byte pins[] = {17, 27, 22};
+	GPIOLines *lines = gpio_lines_open(pins, 3);
+	CHECK(lines!=NULL);
+	int handle = fake_nhandles-1;
+	CHECK_EQ(fake_handles[handle].n, 3);
+
+	// all pins are set with one ioctl
+	const byte values[] = {1, 0, 1};
+	int before = fake_ioctls;
+	gpio_lines_write(lines, values);
+	CHECK_EQ(fake_ioctls-before, 1);
+	CHECK_EQ(fake_value[17], 1);
+	CHECK_EQ(fake_value[27], 0);
+	CHECK_EQ(fake_value[22], 1);
+
+	// a single pin of the handle only changes its own line
+	digitalWrite(27, HIGH);
+	CHECK_EQ(fake_value[17], 1);
+	CHECK_EQ(fake_value[27], 1);
+	CHECK_EQ(fake_value[22], 1);
+	CHECK_EQ(digitalRead(22), 1);
+
+	// so does a pin written through its file descriptor
+	int fd = gpio_fd_open(22);
+	CHECK(fd>0);
+	CHECK_EQ(gpio_fd_open(22), fd);
+	gpio_write(fd, LOW);
+	CHECK_EQ(fake_value[17], 1);
+	CHECK_EQ(fake_value[27], 1);
+	CHECK_EQ(fake_value[22], 0);
+	gpio_write(fd, HIGH);
+	CHECK_EQ(fake_value[22], 1);
+	gpio_fd_close(fd);	// kept open for the pin
+	CHECK_EQ(fake_open_fds(handle), 2);
+
+	// the same pins are not requested again
+	CHECK(gpio_lines_open(pins, 3)==lines);
+
+	// requesting a pin of the handle on its own releases the handle,
+	// with the file descriptors handed out for its pins
+	pinMode(27, INPUT);
+	CHECK_EQ(fake_open_fds(handle), 0);
+	CHECK(!fake_output[27]);
+	// the other pins get handles of their own on the next request
+	int handles = fake_nhandles;
+	pinMode(22, OUTPUT);
+	CHECK_EQ(fake_nhandles, handles+1);
+	digitalWrite(22, LOW);
+	CHECK_EQ(fake_value[22], 0);
+}
+
+static void test_shift_register() {
+	// shift out 25 boards of 8 stations: clock low, data, clock high for each bit
+	const byte pins[] = {4, 22, 23};	// clock, data, latch
+	GPIOLines *lines = gpio_lines_open(pins, 3);
+	CHECK(lines!=NULL);
+	byte values[3] = {0, 0, 0};
+	int before = fake_ioctls;
+	double t = test_ns();
+	for(int i=0;i<8*25;i++) {
+		values[0] = 0;
+		values[1] = i&1;
+		gpio_lines_write(lines, values);
+		values[0] = 1;
+		gpio_lines_write(lines, values);
+	}
+	values[2] = 1;
+	gpio_lines_write(lines, values);
+	t = test_ns()-t;
+	CHECK_EQ(fake_ioctls-before, 8*25*2+1);
+	printf("shift register refresh (25 boards): %d ioctls, %.1f us excluding the kernel\n", fake_ioctls-before, t/1000);
+}
+
+static void test_edge_events() {
+	CHECK(attachEdgeEvents(6, "falling"));
+	CHECK(fake_event_fd>=0);
+
+	// more edges than the queue holds arrive while the main loop is busy
+	const int n = 300;
+	for(int i=0;i<n;i++) {
+		struct gpioevent_data ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.timestamp = (uint64_t)(i+1)*1000000;	// 1 ms apart
+		ev.id = GPIOEVENT_EVENT_FALLING_EDGE;
+		if(write(fake_event_fd, &ev, sizeof(ev))!=sizeof(ev)) break;
+	}
+	int pending;
+	do { delay(5); } while(ioctl(fake_event_fd, FIONREAD, &pending)==0 && pending>0);
+	delay(20);
+
+	int queued = 0;
+	ulong ts, first = 0;
+	while(readEdgeEvent(6, &ts)) {
+		if(!queued) first = ts;
+		queued++;
+	}
+	CHECK_EQ(first, 1000);
+	CHECK_EQ(queued, 256);
+	// the dropped edges are reported once
+	CHECK_EQ(readEdgeDropped(6), n-256);
+	CHECK_EQ(readEdgeDropped(6), 0);
+	CHECK(!readEdgeEvent(6, &ts));
+}
+
+static void test_pulses() {
+	// a pin of a multi-line handle gets a handle of its own, and the
+	// pulse thread a duplicate of it, closed after the train
+	const byte pins[] = {12, 13};
+	gpio_lines_open(pins, 2);
+	const ulong us[] = {200, 100, 200, 100};
+	int before = fake_ioctls;
+	CHECK(gpio_pulses_queue(12, us, 4, 2));
+	int handle = fake_nhandles-1;
+	CHECK_EQ(fake_handles[handle].n, 1);
+	CHECK_EQ(fake_handles[handle].offsets[0], 12);
+	ulong start = millis();
+	while(fake_ioctls-before<4*2+1 && millis()-start<1000) delay(1);
+	delay(10);
+	CHECK_EQ(fake_ioctls-before, 4*2+1);	// one per edge, and the final low
+	CHECK_EQ(fake_value[12], 0);
+	CHECK_EQ(fake_open_fds(handle), 1);	// the pin's own, the thread's copy is closed
+}
+
+int main() {
+	test_single_pin();
+	test_multi_line();
+	test_shift_register();
+	test_edge_events();
+	test_pulses();
+	return test_result("gpio_test");
+}
@@ -0,0 +1,125 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Memory-mapped gpio register driver test
+ * Feb 2015 @ OpenSprinkler.com
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <unistd.h>
+#include "gpio.h"
+#include "test.h"
+
+/* The register driver is run against an in-memory register file,
+ * attached with gpiomem_attach(). Word offsets as on BCM283x.
+ */
+#define REG_GPFSEL0	0
+#define REG_GPSET0	7
+#define REG_GPCLR0	10
+#define REG_WORDS		(0xB4/4)
+
+static volatile uint32_t regs[REG_WORDS];
+
+/** Write a device tree compatible list to a file */
+static bool compatible(const char *list, int len) {
+	const char *path = "/tmp/os_gpiomem_compatible";
+	FILE *fp = fopen(path, "wb");
+	if(!fp) return false;
+	fwrite(list, 1, len, fp);
+	fclose(fp);
+	bool ok = gpiomem_compatible(path);
+	unlink(path);
+	return ok;
+}
+
+#define COMPATIBLE(s) compatible(s, sizeof(s))
+
+static void test_compatible() {
+	CHECK(COMPATIBLE("raspberrypi,3-model-b\0brcm,bcm2837"));
+	CHECK(COMPATIBLE("raspberrypi,4-model-b\0brcm,bcm2711"));
+	CHECK(COMPATIBLE("raspberrypi,model-zero-w\0brcm,bcm2835"));
+	CHECK(COMPATIBLE("raspberrypi,2-model-b\0brcm,bcm2836"));
+	CHECK(!COMPATIBLE("raspberrypi,5-model-b\0brcm,bcm2712"));	// RPi 5: RP1 gpio
+	CHECK(!COMPATIBLE("ti,am335x-bone-black\0ti,am33xx"));
+	CHECK(!COMPATIBLE("brcm,bcm28"));
+	CHECK(!gpiomem_compatible("/nonexistent"));
+}
+
+static void test_lines() {
+	gpiomem_attach(regs);
+	CHECK(gpiomem_open());
+
+	// pins are set to output (function 001), other pins are kept
+	regs[REG_GPFSEL0] = 0xFFFFFFFF;
+	regs[REG_GPFSEL0+2] = 0;
+	const byte pins[] = {4, 22, 23};	// clock, data, latch
+	GPIOLines *lines = gpio_lines_open(pins, 3);
+	CHECK(lines!=NULL);
+	CHECK_EQ(regs[REG_GPFSEL0], 0xFFFF9FFF);	// pin 4: bits 12-14
+	CHECK_EQ(regs[REG_GPFSEL0+2], (1<<6)|(1<<9));	// pins 22, 23
+
+	// one register write sets, one clears
+	const byte values[] = {1, 0, 1};
+	gpio_lines_write(lines, values);
+	CHECK_EQ(regs[REG_GPSET0], (1<<4)|(1<<23));
+	CHECK_EQ(regs[REG_GPCLR0], 1<<22);
+
+	regs[REG_GPSET0] = 0;
+	const byte low[] = {0, 0, 0};
+	gpio_lines_write(lines, low);
+	CHECK_EQ(regs[REG_GPSET0], 0);	// no set write
+	CHECK_EQ(regs[REG_GPCLR0], (1<<4)|(1<<22)|(1<<23));
+
+	// only bank 0 pins are set through the registers
+	const byte high[] = {40};
+	regs[REG_GPFSEL0+4] = 0;
+	gpio_lines_open(high, 1);
+	CHECK_EQ(regs[REG_GPFSEL0+4], 0);
+}
+
+static void test_shift_register() {
+	// shift out 25 boards of 8 stations: clock low with data, then clock high
+	const byte pins[] = {4, 22, 23};
+	GPIOLines *lines = gpio_lines_open(pins, 3);
+	byte values[3] = {0, 0, 0};
+	const int runs = 1000;
+	double t = test_ns();
+	for(int r=0;r<runs;r++) {
+		values[2] = 0;
+		for(int i=0;i<8*25;i++) {
+			values[0] = 0;
+			values[1] = i&1;
+			gpio_lines_write(lines, values);
+			values[0] = 1;
+			gpio_lines_write(lines, values);
+		}
+		values[2] = 1;
+		gpio_lines_write(lines, values);
+	}
+	t = (test_ns()-t)/runs;
+	printf("shift register refresh (25 boards, in-memory registers): %.2f us\n", t/1000);
+	CHECK(t<100000);	// well under 100 us per refresh
+}
+
+int main() {
+	test_compatible();
+	test_lines();
+	test_shift_register();
+	return test_result("gpiomem_test");
+}
@@ -0,0 +1,148 @@
+#!/bin/bash
+# MQTT command and state test against a local mosquitto broker.
+#
+# Builds the demo firmware, runs it with MQTT pointed at a broker started
+# on MQTT_PORT, and checks that commands published on the command topics
+# act like the equivalent HTTP commands (/js, /jc), and that the states
+# are published back. Skipped if mosquitto, its clients, libmosquitto-dev
+# or curl are not installed, or the demo's http port (80) is in use.
+#
+# Usage: test/mqtt_test.sh (from the source directory, also run by ./build.sh test)
+
+MQTT_PORT=${MQTT_PORT:-18830}
+HTTP="http://127.0.0.1:80"
+PW="pw=a6d82bced638de3def1e9bbb4983225c"	# md5 of the default password "opendoor"
+
+skip() {
+	echo "mqtt_test: skipped ($1)"
+	exit 0
+}
+
+for c in mosquitto mosquitto_pub mosquitto_sub curl; do
+	command -v $c > /dev/null || skip "$c not found"
+done
+echo '#include <mosquitto.h>' | g++ -E -x c++ - > /dev/null 2>&1 || skip "libmosquitto-dev not found"
+curl -s -m 1 $HTTP > /dev/null && skip "port 80 in use"
+
+DIR=$(mktemp -d)
+BROKER=
+DEMO=
+cleanup() {
+	[ -n "$DEMO" ] && kill $DEMO 2> /dev/null
+	[ -n "$BROKER" ] && kill $BROKER 2> /dev/null
+	wait 2> /dev/null
+	rm -rf "$DIR"
+}
+trap cleanup EXIT
+
+failed=0
+checks=0
+check() {
+	checks=$((checks+1))
+	if [ "$2" != "$3" ]; then
+		echo "FAILED: $1: got '$2', expected '$3'"
+		failed=$((failed+1))
+	fi
+}
+
+# Poll a command until its output matches a pattern, or 5 seconds pass
+wait_for() {
+	local i out
+	for i in $(seq 100); do
+		out=$(eval "$1" 2> /dev/null)
+		if [[ "$out" =~ $2 ]]; then echo ok; return; fi
+		sleep 0.05
+	done
+	echo "$out"
+}
+
+# Value of a field in the /jc output
+jc() {
+	curl -s "$HTTP/jc?$PW" | grep -o "\"$1\":[0-9]*" | cut -d: -f2
+}
+
+# Status of a station in the /js output
+js() {
+	curl -s "$HTTP/js?$PW" | grep -o '"sn":\[[0-9,]*' | cut -d[ -f2 | cut -d, -f$(($1+1))
+}
+
+# Retained message on a topic
+retained() {
+	mosquitto_sub -p $MQTT_PORT -C 1 -W 2 -t "$1"
+}
+
+pub() {
+	mosquitto_pub -p $MQTT_PORT -t "$1" -m "$2"
+}
+
+echo "Building demo firmware..."
+SRCS="main.cpp OpenSprinkler.cpp program.cpp server.cpp utils.cpp weather.cpp gpio.cpp etherport.cpp mqtt.cpp logstore.cpp httpclient.cpp dnscache.cpp et.cpp notify.cpp webhook.cpp tz.cpp"
+g++ -std=gnu++14 -DDEMO -o "$DIR/OpenSprinkler" $SRCS -lpthread -lmosquitto || exit 1
+
+mosquitto -p $MQTT_PORT > "$DIR/broker.log" 2>&1 &
+BROKER=$!
+(cd "$DIR" && exec ./OpenSprinkler > demo.log 2>&1) &
+DEMO=$!
+check "http server" "$(wait_for "curl -s $HTTP/jc?$PW" devt)" ok
+
+# point the controller at the broker, commands are off by default
+curl -s "$HTTP/co?$PW&mqtt=%22server%22:%22127.0.0.1%22,%22port%22:$MQTT_PORT,%22enable%22:1" > /dev/null
+check "availability" "$(wait_for "retained opensprinkler/availability" online)" ok
+check "initial state" "$(wait_for "retained opensprinkler/station/0/state" 0)" ok
+pub opensprinkler/station/0/set 60
+sleep 1
+check "commands off" "$(js 0)" 0
+
+curl -s "$HTTP/co?$PW&mqtt=%22server%22:%22127.0.0.1%22,%22port%22:$MQTT_PORT,%22enable%22:1,%22cmd%22:1" > /dev/null
+sleep 1
+check "availability with commands" "$(wait_for "retained opensprinkler/availability" online)" ok
+
+# station on and off, as /cm
+start=$(date +%s%N)
+pub opensprinkler/station/0/set 60
+check "station on" "$(wait_for "js 0" 1)" ok
+echo "station command round trip: $((($(date +%s%N)-start)/1000000)) ms (including http polling)"
+check "station state on" "$(wait_for "retained opensprinkler/station/0/state" 1)" ok
+pub opensprinkler/station/0/set 0
+check "station off" "$(wait_for "js 0" 0)" ok
+check "station state off" "$(wait_for "retained opensprinkler/station/0/state" 0)" ok
+
+# invalid commands are ignored
+pub opensprinkler/station/0/set abc
+pub opensprinkler/station/99/set 60
+pub opensprinkler/station/x/set 60
+sleep 1
+check "invalid station commands" "$(js 0)" 0
+
+# program run, as /mp: program 0 runs the last station for 2 minutes
+curl -s "$HTTP/cp?$PW&pid=-1&v=%5B1,127,0,%5B0,-1,-1,-1%5D,%5B0,0,0,0,0,0,0,120%5D%5D&name=mqtt" > /dev/null
+pub opensprinkler/program/1/run 0	# no such program
+sleep 1
+check "invalid program" "$(js 7)" 0
+pub opensprinkler/program/0/run 0
+check "program run" "$(wait_for "js 7" 1)" ok
+pub opensprinkler/station/7/set 0
+check "program station off" "$(wait_for "js 7" 0)" ok
+
+# rain delay, as /cv?rd
+pub opensprinkler/raindelay/set 2
+check "rain delay" "$(wait_for "jc rd" 1)" ok
+check "rain delay state" "$(wait_for "retained opensprinkler/raindelay/state" 1)" ok
+pub opensprinkler/raindelay/set 0
+check "rain delay off" "$(wait_for "jc rd" 0)" ok
+
+# enable, as /cv?en
+pub opensprinkler/enable/set 0
+check "disable" "$(wait_for "jc en" 0)" ok
+check "enable state" "$(wait_for "retained opensprinkler/enable/state" 0)" ok
+pub opensprinkler/enable/set 2
+sleep 1
+check "invalid enable" "$(jc en)" 0
+pub opensprinkler/enable/set 1
+check "enable" "$(wait_for "jc en" 1)" ok
+
+if [ $failed -ne 0 ]; then
+	echo "mqtt_test: $failed of $checks checks failed"
+	exit 1
+fi
+echo "mqtt_test: $checks checks passed"
@@ -0,0 +1,66 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Unit test and benchmark helpers
+ * Feb 2015 @ OpenSprinkler.com
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TEST_H
+#define _TEST_H
+
+#include <stdio.h>
+#include <time.h>
+
+/* Tests are plain programs, built and run by 'build.sh test'.
+ * Each one exits with a non-zero status if a check failed.
+ */
+static int test_checks = 0;
+static int test_failures = 0;
+
+#define CHECK(cond) do { \
+	test_checks++; \
+	if(!(cond)) { \
+		test_failures++; \
+		printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+	} \
+} while(0)
+
+#define CHECK_EQ(a, b) do { \
+	long long _a = (long long)(a), _b = (long long)(b); \
+	test_checks++; \
+	if(_a!=_b) { \
+		test_failures++; \
+		printf("%s:%d: check failed: %s == %s (%lld != %lld)\n", __FILE__, __LINE__, #a, #b, _a, _b); \
+	} \
+} while(0)
+
+/** Print the result, and return the exit status */
+static inline int test_result(const char *name) {
+	printf("%s: %d checks, %d failed\n", name, test_checks, test_failures);
+	return test_failures ? 1 : 0;
+}
+
+/** Current time in nanoseconds, for benchmarks */
+static inline double test_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+#endif // _TEST_H
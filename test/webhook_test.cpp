@@ -0,0 +1,334 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Webhook template and delivery test
+ * Feb 2015 @ OpenSprinkler.com
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "test.h"
+
+// the template compiler and renderer are static
+#include "webhook.cpp"
+
+/* Controller stand-ins
+ * Station and program names come from here instead of the stored
+ * settings; notify_register() and notify_done() record their calls.
+ */
+OpenSprinkler os;
+ProgramData pd;
+byte OpenSprinkler::nstations = 8;
+byte ProgramData::nprograms = 1;
+
+static const char *station_names[] = {"S01", "S02", "Front \"lawn\"\\", "Line\nbreak"};
+
+void OpenSprinkler::get_station_name(byte sid, char buf[]) {
+	strcpy(buf, sid<sizeof(station_names)/sizeof(station_names[0]) ? station_names[sid] : "");
+}
+
+void ProgramData::read(byte pid, ProgramStruct *buf) {
+	memset(buf, 0, sizeof(ProgramStruct));
+	strcpy(buf->name, "Morning");
+}
+
+static char event_text[NOTIFY_TEXT_SIZE] = "Station S01 closed.";
+
+void notify_format_text(const NotifyEvent *ev, char *buf) {
+	strcpy(buf, event_text);
+}
+
+static NotifySink *sinks[NOTIFY_MAX_SINKS];
+static byte nsinks = 0;
+static int done_calls = 0;
+static bool done_success = false;
+
+void notify_register(NotifySink *sink) {
+	if(nsinks<NOTIFY_MAX_SINKS) sinks[nsinks++] = sink;
+}
+
+void notify_done(NotifySink *sink, bool success) {
+	done_calls++;
+	done_success = success;
+}
+
+/* Local HTTP receiver
+ * Accepts one request per connection on 127.0.0.1, keeps the last one
+ * in recv_request, and answers with recv_status.
+ */
+static int recv_fd = -1;
+static uint16_t recv_port = 0;
+static char recv_request[4096];
+static volatile int recv_count = 0;
+static const char *recv_status = "200 OK";
+
+static void *recv_thread(void *) {
+	while(true) {
+		int fd = accept(recv_fd, NULL, NULL);
+		if(fd<0) break;	// shut down
+		char buf[sizeof(recv_request)];
+		int len = 0, n;
+		// read the headers, then the content
+		while(len<(int)sizeof(buf)-1 && (n=read(fd, buf+len, sizeof(buf)-1-len))>0) {
+			len += n;
+			buf[len] = 0;
+			char *body = strstr(buf, "\r\n\r\n");
+			char *cl = strstr(buf, "Content-Length: ");
+			if(body && cl && body+4+atoi(cl+16)<=buf+len) break;
+		}
+		buf[len] = 0;
+		char resp[128];
+		snprintf(resp, sizeof(resp), "HTTP/1.0 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", recv_status);
+		if(write(fd, resp, strlen(resp))<0) {}
+		close(fd);
+		strcpy(recv_request, buf);
+		recv_count++;
+	}
+	return NULL;
+}
+
+static bool recv_start() {
+	struct sockaddr_in a;
+	socklen_t alen = sizeof(a);
+	memset(&a, 0, sizeof(a));
+	a.sin_family = AF_INET;
+	a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	recv_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if(recv_fd<0 || bind(recv_fd, (struct sockaddr*)&a, sizeof(a)) || listen(recv_fd, 4)) return false;
+	getsockname(recv_fd, (struct sockaddr*)&a, &alen);
+	recv_port = ntohs(a.sin_port);
+	pthread_t t;
+	return pthread_create(&t, NULL, recv_thread, NULL)==0;
+}
+
+/** Compile and render a template, returns the payload */
+static const char *render(const char *tmpl, const NotifyEvent *ev) {
+	static char body[WEBHOOK_BODY_SIZE];
+	WebhookTemplate t;
+	body[0] = 0;
+	if(!webhook_compile(tmpl, &t)) return NULL;
+	BufferFiller bf = body;
+	webhook_render(&t, ev, bf);
+	return body;
+}
+
+static bool compiles(const char *tmpl) {
+	WebhookTemplate t;
+	return webhook_compile(tmpl, &t);
+}
+
+static bool same(const char *a, const char *b) {
+	if(a && b && !strcmp(a, b)) return true;
+	printf("  got '%s', expected '%s'\n", a ? a : "(null)", b);
+	return false;
+}
+
+static NotifyEvent station_event(byte sid) {
+	NotifyEvent ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.type = NOTIFY_STATION_ON;
+	ev.lval = sid;
+	ev.fval = 600;
+	ev.flow = 1.5;
+	ev.time = 1700000000;
+	return ev;
+}
+
+static void test_compile() {
+	NotifyEvent ev = station_event(0);
+	CHECK(same(render("", &ev), ""));
+	CHECK(same(render("plain text", &ev), "plain text"));
+	CHECK(same(render("$$", &ev), "$"));
+	CHECK(same(render("a$$b", &ev), "a$b"));
+	CHECK(same(render("$$$s", &ev), "$0"));
+	CHECK(same(render("$s$$", &ev), "0$"));
+	CHECK(same(render("cost: $$$$5", &ev), "cost: $$5"));
+	// unknown variables and a trailing $ are rejected
+	CHECK(!compiles("$"));
+	CHECK(!compiles("text$"));
+	CHECK(!compiles("$$$"));
+	CHECK(!compiles("$x"));
+	CHECK(!compiles("${e}"));
+
+	// at most WEBHOOK_MAX_OPS literals and variables
+	char tmpl[WEBHOOK_TEMPLATE_SIZE];
+	tmpl[0] = 0;
+	for(int i=0;i<WEBHOOK_MAX_OPS;i++) strcat(tmpl, "$s");
+	CHECK(compiles(tmpl));
+	strcat(tmpl, "$s");
+	CHECK(!compiles(tmpl));
+	tmpl[0] = 0;
+	for(int i=0;i<WEBHOOK_MAX_OPS/2;i++) strcat(tmpl, "a$s");
+	CHECK(compiles(tmpl));
+	strcat(tmpl, "a");
+	CHECK(!compiles(tmpl));
+	// $$ does not start a new literal
+	tmpl[0] = 0;
+	for(int i=0;i<WEBHOOK_MAX_OPS*2;i++) strcat(tmpl, "$$");
+	CHECK(compiles(tmpl));
+
+	// the longest template is one literal
+	memset(tmpl, 'x', sizeof(tmpl)-1);
+	tmpl[sizeof(tmpl)-1] = 0;
+	CHECK(same(render(tmpl, &ev), tmpl));
+}
+
+static void test_render() {
+	NotifyEvent ev = station_event(2);
+	CHECK(same(render("$e $t $s $v $w $T", &ev), "station_on 256 2 600 1.50 1700000000"));
+	// names and texts are escaped for JSON strings
+	CHECK(same(render("{\"name\":\"$n\"}", &ev), "{\"name\":\"Front \\\"lawn\\\"\\\\\"}"));
+	ev.lval = 3;
+	CHECK(same(render("$n", &ev), "Line\\u000abreak"));
+	ev.lval = 200;	// no such station
+	CHECK(same(render("[$n]", &ev), "[]"));
+	CHECK(same(render("$m", &ev), "Station S01 closed."));
+
+	ev.type = NOTIFY_PROGRAM_SCHED;
+	ev.lval = 0;
+	CHECK(same(render("$e:$n", &ev), "program:Morning"));
+	ev.type = NOTIFY_SENSOR1;
+	ev.fval = 1;
+	CHECK(same(render("$e=$v [$n]", &ev), "sensor1=1 []"));
+	ev.type = 0;
+	CHECK(same(render("[$e]", &ev), "[]"));
+}
+
+static void test_truncate() {
+	// the payload is cut at the last variable or literal that fits
+	NotifyEvent ev = station_event(0);
+	memset(event_text, 'm', 150);
+	event_text[150] = 0;
+	char tmpl[WEBHOOK_TEMPLATE_SIZE];
+	tmpl[0] = 0;
+	for(int i=0;i<WEBHOOK_MAX_OPS;i++) strcat(tmpl, "$m");
+	const char *body = render(tmpl, &ev);
+	CHECK(body!=NULL);
+	CHECK(strlen(body)<WEBHOOK_BODY_SIZE);
+	CHECK_EQ(strlen(body)%150, 0);
+	CHECK(strlen(body)+2*NOTIFY_TEXT_SIZE>=WEBHOOK_BODY_SIZE);
+
+	// escaping doubles the text, up to its limit
+	memset(event_text, '"', NOTIFY_TEXT_SIZE-1);
+	event_text[NOTIFY_TEXT_SIZE-1] = 0;
+	body = render(tmpl, &ev);
+	CHECK(body!=NULL);
+	CHECK(strlen(body)<WEBHOOK_BODY_SIZE);
+	CHECK(strlen(body)>0);
+	strcpy(event_text, "Station S01 closed.");
+}
+
+static void test_url() {
+	char host[HTTPCLIENT_HOST_SIZE], path[WEBHOOK_URL_SIZE];
+	uint16_t port;
+	CHECK(webhook_parse_url("http://example.com:8080/a/b?c=1", host, &port, path));
+	CHECK(same(host, "example.com"));
+	CHECK_EQ(port, 8080);
+	CHECK(same(path, "/a/b?c=1"));
+	CHECK(webhook_parse_url("http://10.0.0.5", host, &port, path));
+	CHECK_EQ(port, 80);
+	CHECK(same(path, "/"));
+	CHECK(!webhook_parse_url("https://example.com/", host, &port, path));
+	CHECK(!webhook_parse_url("http:///path", host, &port, path));
+	CHECK(!webhook_parse_url("http://host:0/", host, &port, path));
+	CHECK(!webhook_parse_url("http://host:70000/", host, &port, path));
+	CHECK(!webhook_parse_url("http://host:80x", host, &port, path));
+}
+
+/** Send an event through webhook i, and wait for the result */
+static bool deliver(byte i, const NotifyEvent *ev) {
+	const NotifyEvent *evs[] = {ev};
+	int calls = done_calls;
+	NotifySink *s = &webhooks[i].sink;
+	if(s->send(s, evs, 1)!=NOTIFY_QUEUED) return false;
+	ulong start = millis();
+	while(done_calls==calls && millis()-start<5000) {
+		httpclient_poll();
+		delay(1);
+	}
+	return done_calls==calls+1 && done_success;
+}
+
+static void test_delivery() {
+	unlink(get_filename_fullpath(WEBHOOK_FILENAME));
+	webhook_begin();
+	CHECK_EQ(nsinks, WEBHOOK_MAX);
+	CHECK_EQ(webhooks[0].sink.types(&webhooks[0].sink), 0);
+
+	char url[WEBHOOK_URL_SIZE];
+	snprintf(url, sizeof(url), "http://127.0.0.1:%d/hook", recv_port);
+	CHECK(webhook_set(0, url, NOTIFY_STATION_ON|NOTIFY_STATION_OFF, "{\"event\":\"$e\",\"station\":$s,\"name\":\"$n\",\"run\":$v}"));
+	CHECK_EQ(webhooks[0].sink.types(&webhooks[0].sink), NOTIFY_STATION_ON|NOTIFY_STATION_OFF);
+	CHECK(!webhook_set(1, url, 0, "$q"));
+	CHECK(!webhook_set(1, "ftp://127.0.0.1/", 0, ""));
+
+	NotifyEvent ev = station_event(0);
+	CHECK(deliver(0, &ev));
+	CHECK_EQ(recv_count, 1);
+	CHECK(!strncmp(recv_request, "POST /hook HTTP/1.0\r\n", 21));
+	CHECK(strstr(recv_request, "Content-Type: application/json\r\n")!=NULL);
+	const char *expected = "{\"event\":\"station_on\",\"station\":0,\"name\":\"S01\",\"run\":600}";
+	char header[32];
+	snprintf(header, sizeof(header), "Content-Length: %d\r\n", (int)strlen(expected));
+	CHECK(strstr(recv_request, header)!=NULL);
+	const char *body = strstr(recv_request, "\r\n\r\n");
+	CHECK(body && same(body+4, expected));
+
+	// text templates are sent as text
+	CHECK(webhook_set(1, url, NOTIFY_STATION_ON, "$m"));
+	CHECK(deliver(1, &ev));
+	CHECK(strstr(recv_request, "Content-Type: text/plain\r\n")!=NULL);
+
+	// an error status or an unreachable endpoint fails the delivery, to be retried
+	recv_status = "500 Internal Server Error";
+	CHECK(!deliver(0, &ev));
+	CHECK_EQ(recv_count, 3);
+	recv_status = "200 OK";
+	CHECK(deliver(0, &ev));
+
+	// the settings are kept across a restart
+	CHECK(webhook_set(1, "", 0, ""));
+	memset(webhooks, 0, sizeof(webhooks));
+	nsinks = 0;
+	webhook_begin();
+	CHECK(same(webhook_get(0)->url, url));
+	CHECK_EQ(webhook_get(0)->types, NOTIFY_STATION_ON|NOTIFY_STATION_OFF);
+	CHECK_EQ(webhooks[1].sink.types(&webhooks[1].sink), 0);
+	CHECK(deliver(0, &ev));
+	unlink(get_filename_fullpath(WEBHOOK_FILENAME));
+
+	// nothing listens on the port after the receiver is closed
+	shutdown(recv_fd, SHUT_RDWR);
+	close(recv_fd);
+	CHECK(!deliver(0, &ev));
+}
+
+int main() {
+	initialiseEpoch();
+	test_compile();
+	test_render();
+	test_truncate();
+	test_url();
+	if(recv_start()) test_delivery();
+	else CHECK(!"no local receiver");
+	return test_result("webhook_test");
+}
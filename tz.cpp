@@ -0,0 +1,320 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Time zone engine
+ * Feb 2015 @ OpenSprinkler.com
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(ARDUINO)
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <stdint.h>
+#include "utils.h"
+#include "tz.h"
+
+#define TZ_MAX_FILE_SIZE	65536
+
+/** Offset (seconds east of UTC) in effect from a UTC time on */
+struct TZTransition {
+	int64_t at;
+	int32_t offset;
+};
+
+/** Date of a rule transition (POSIX TZ string) */
+struct TZRuleDate {
+	char type;			// 'M': month.week.day, 'J': Julian day (1-365, no Feb 29), 0: day of the year (0-365)
+	uint16_t n;
+	byte m, w, d;		// month (1-12), week (1-5, 5 is the last), day (0 is Sunday)
+	int32_t time;		// local time of the transition (seconds)
+};
+
+struct TZRule {
+	int32_t std_off, dst_off;
+	bool dst;
+	TZRuleDate start, end;
+};
+
+static TZTransition tz_trans[TZ_MAX_TRANSITIONS];	// tz_trans[0] is in effect before the first transition
+static uint16_t tz_ntrans = 0;
+static char tz_zone[TZ_NAME_SIZE];
+
+// cached offset, valid from tz_from (included) to tz_until (excluded)
+static int64_t tz_from = 0, tz_until = 0;
+static int32_t tz_cur = 0;
+
+static int32_t tz_be32(const byte *p) {
+	return (int32_t)(((uint32_t)p[0]<<24) | ((uint32_t)p[1]<<16) | ((uint32_t)p[2]<<8) | p[3]);
+}
+
+static int64_t tz_be64(const byte *p) {
+	return (int64_t)(((uint64_t)(uint32_t)tz_be32(p)<<32) | (uint32_t)tz_be32(p+4));
+}
+
+/** ====== POSIX TZ string ====== */
+static const char *tz_parse_name(const char *s) {
+	if(*s=='<') {
+		s = strchr(s, '>');
+		return s ? s+1 : NULL;
+	}
+	const char *p = s;
+	while(isalpha(*p)) p++;
+	return (p-s>=3) ? p : NULL;
+}
+
+/** [+|-]hh[:mm[:ss]] in seconds */
+static const char *tz_parse_time(const char *s, int32_t *secs) {
+	int sign = 1;
+	if(*s=='+' || *s=='-') sign = (*s++=='-') ? -1 : 1;
+	if(!isdigit(*s)) return NULL;
+	int32_t v = strtol(s, (char**)&s, 10)*3600;
+	if(*s==':') {
+		v += strtol(s+1, (char**)&s, 10)*60;
+		if(*s==':') v += strtol(s+1, (char**)&s, 10);
+	}
+	*secs = sign*v;
+	return s;
+}
+
+static const char *tz_parse_date(const char *s, TZRuleDate *r) {
+	if(*s!=',') return NULL;
+	s++;
+	r->type = 0;
+	if(*s=='M') {
+		r->type = 'M';
+		r->m = strtol(s+1, (char**)&s, 10);
+		if(*s!='.') return NULL;
+		r->w = strtol(s+1, (char**)&s, 10);
+		if(*s!='.') return NULL;
+		r->d = strtol(s+1, (char**)&s, 10);
+		if(r->m<1 || r->m>12 || r->w<1 || r->w>5 || r->d>6) return NULL;
+	} else {
+		if(*s=='J') r->type = *s++;
+		if(!isdigit(*s)) return NULL;
+		r->n = strtol(s, (char**)&s, 10);
+		if(r->n>365 || (r->type=='J' && !r->n)) return NULL;
+	}
+	r->time = 7200;
+	if(*s=='/') s = tz_parse_time(s+1, &r->time);
+	return s;
+}
+
+/** Parse a TZ string such as CET-1CEST,M3.5.0,M10.5.0/3 */
+static bool tz_parse_rule(const char *s, TZRule *rule) {
+	int32_t v;
+	if(!(s = tz_parse_name(s)) || !(s = tz_parse_time(s, &v))) return false;
+	rule->std_off = -v;
+	rule->dst = false;
+	if(!*s) return true;
+	if(!(s = tz_parse_name(s))) return false;
+	rule->dst_off = rule->std_off+3600;
+	if(*s && *s!=',') {
+		if(!(s = tz_parse_time(s, &v))) return false;
+		rule->dst_off = -v;
+	}
+	if(!(s = tz_parse_date(s, &rule->start)) || !(s = tz_parse_date(s, &rule->end))) return false;
+	rule->dst = true;
+	return true;
+}
+
+/** Day (epoch time / 86400) of a rule date in a year */
+static ulong tz_rule_day(const TZRuleDate *r, uint16_t year) {
+	ulong jan1 = days_from_civil(year, 1, 1);
+	if(r->type=='M') {
+		ulong first = days_from_civil(year, r->m, 1);
+		byte dow = (weekday_from_days(first)+1)%7;	// Sunday is 0
+		ulong day = first + (r->d+7-dow)%7 + (r->w-1)*7;
+		while(day>=first+days_in_month(year, r->m)) day -= 7;
+		return day;
+	}
+	if(r->type=='J') return jan1 + r->n-1 + ((r->n>=60 && days_in_month(year, 2)==29) ? 1 : 0);
+	return jan1 + r->n;
+}
+
+static void tz_append(int64_t at, int32_t offset) {
+	if(tz_ntrans>=TZ_MAX_TRANSITIONS) return;
+	if(at<=0) {
+		tz_trans[0].offset = offset;	// in effect in 1970
+		return;
+	}
+	if(tz_trans[tz_ntrans-1].at>=at) return;
+	tz_trans[tz_ntrans].at = at;
+	tz_trans[tz_ntrans].offset = offset;
+	tz_ntrans++;
+}
+
+/** Add the transitions of a rule after the last transition */
+static void tz_extend(const TZRule *rule) {
+	if(!rule->dst) {
+		if(tz_ntrans==1) tz_trans[0].offset = rule->std_off;
+		return;
+	}
+	int64_t last = tz_trans[tz_ntrans-1].at;
+	CivilDate cd;
+	civil_from_days((last>0) ? (ulong)(last/86400) : 0, &cd);
+	for(uint16_t y=cd.year; y<=TZ_LAST_YEAR; y++) {
+		int64_t s = (int64_t)tz_rule_day(&rule->start, y)*86400 + rule->start.time - rule->std_off;
+		int64_t e = (int64_t)tz_rule_day(&rule->end, y)*86400 + rule->end.time - rule->dst_off;
+		// transitions of the same year are in order (southern zones end DST first)
+		if(s<e) {
+			if(s>last) tz_append(s, rule->dst_off);
+			if(e>last) tz_append(e, rule->std_off);
+		} else {
+			if(e>last) tz_append(e, rule->std_off);
+			if(s>last) tz_append(s, rule->dst_off);
+		}
+	}
+}
+
+/** ====== TZif file ====== */
+
+/** Size of the data block that follows a TZif header */
+static size_t tz_block_size(const byte *h, byte tsize) {
+	ulong isutcnt = tz_be32(h+20), isstdcnt = tz_be32(h+24), leapcnt = tz_be32(h+28);
+	ulong timecnt = tz_be32(h+32), typecnt = tz_be32(h+36), charcnt = tz_be32(h+40);
+	return timecnt*tsize + timecnt + typecnt*6 + charcnt + leapcnt*(tsize+4) + isstdcnt + isutcnt;
+}
+
+static bool tz_parse_file(const byte *buf, size_t len) {
+	if(len<44 || memcmp(buf, "TZif", 4)) return false;
+	const byte *h = buf;
+	byte tsize = 4;
+	size_t size = tz_block_size(h, 4);
+	if(buf[4]>='2') {
+		// skip the 32-bit data, use the 64-bit data
+		h = buf+44+size;
+		if(h+44>buf+len || memcmp(h, "TZif", 4)) return false;
+		tsize = 8;
+		size = tz_block_size(h, 8);
+	}
+	const byte *data = h+44;
+	if(data+size>buf+len) return false;
+	ulong timecnt = tz_be32(h+32), typecnt = tz_be32(h+36);
+	if(!typecnt) return false;
+	const byte *idx = data+timecnt*tsize;
+	const byte *types = idx+timecnt;
+
+	tz_ntrans = 1;
+	tz_trans[0].at = INT64_MIN;
+	tz_trans[0].offset = tz_be32(types);	// type 0 is in effect before the first transition
+	for(ulong i=0;i<timecnt;i++) {
+		byte t = idx[i];
+		if(t>=typecnt) return false;
+		int64_t at = (tsize==8) ? tz_be64(data+i*8) : tz_be32(data+i*4);
+		tz_append(at, tz_be32(types+t*6));
+	}
+
+	// TZ string of the times after the last transition
+	const char *footer = (const char*)(data+size);
+	if(tsize==8 && footer+1<(const char*)buf+len && *footer=='\n') {
+		char rule_str[TZ_NAME_SIZE];
+		size_t n = 0;
+		for(footer++; footer<(const char*)buf+len && *footer!='\n' && n<sizeof(rule_str)-1; footer++) rule_str[n++] = *footer;
+		rule_str[n] = 0;
+		TZRule rule;
+		if(n && tz_parse_rule(rule_str, &rule)) tz_extend(&rule);
+	}
+	return true;
+}
+
+static bool tz_load(const char *name) {
+	char path[TZ_NAME_SIZE+sizeof(TZ_ZONEINFO_PATH)];
+	if(!strcmp(name, "localtime")) strcpy(path, "/etc/localtime");
+	else {
+		// zone names are relative to the zoneinfo directory
+		if(name[0]=='/' || strstr(name, "..") || strlen(name)>=TZ_NAME_SIZE) return false;
+		strcpy(path, TZ_ZONEINFO_PATH);
+		strcat(path, name);
+	}
+	FILE *fp = fopen(path, "rb");
+	if(!fp) return false;
+	byte *buf = (byte*)malloc(TZ_MAX_FILE_SIZE);
+	bool ok = false;
+	if(buf) {
+		size_t len = fread(buf, 1, TZ_MAX_FILE_SIZE, fp);
+		ok = tz_parse_file(buf, len);
+		free(buf);
+	}
+	fclose(fp);
+	if(!ok) tz_ntrans = 0;
+	tz_from = tz_until = 0;
+	return ok;
+}
+
+/** Load the zone saved in TZ_FILENAME */
+void tz_begin() {
+	tz_zone[0] = 0;
+	tz_ntrans = 0;
+	FILE *fp = fopen(get_filename_fullpath(TZ_FILENAME), "r");
+	if(!fp) return;
+	char name[TZ_NAME_SIZE];
+	if(fgets(name, sizeof(name), fp)) {
+		name[strcspn(name, "\r\n")] = 0;
+		if(name[0] && tz_load(name)) strcpy(tz_zone, name);
+	}
+	fclose(fp);
+}
+
+/** Change the zone (empty to use IOPT_TIMEZONE)
+ * Returns false if the zone can't be loaded
+ */
+bool tz_set(const char *name) {
+	if(!name[0]) {
+		tz_zone[0] = 0;
+		tz_ntrans = 0;
+		remove_file(TZ_FILENAME);
+		return true;
+	}
+	if(!tz_load(name)) {
+		if(tz_zone[0]) tz_load(tz_zone);	// keep the current zone
+		return false;
+	}
+	strcpy(tz_zone, name);
+	write_to_file(TZ_FILENAME, tz_zone, strlen(tz_zone));
+	return true;
+}
+
+const char *tz_name() {
+	return tz_zone;
+}
+
+bool tz_active() {
+	return tz_ntrans>0;
+}
+
+/** Offset (seconds) of local time from UTC at a UTC time */
+long tz_offset(time_t utc) {
+	int64_t t = utc;
+	if(t>=tz_from && t<tz_until) return tz_cur;
+	// find the last transition at or before t
+	uint16_t lo = 0, hi = tz_ntrans-1;
+	while(lo<hi) {
+		uint16_t mid = (lo+hi+1)/2;
+		if(tz_trans[mid].at<=t) lo = mid;
+		else hi = mid-1;
+	}
+	tz_cur = tz_trans[lo].offset;
+	tz_from = tz_trans[lo].at;
+	tz_until = (lo+1<tz_ntrans) ? tz_trans[lo+1].at : INT64_MAX;
+	return tz_cur;
+}
+
+#endif // !ARDUINO
@@ -0,0 +1,58 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Time zone engine header file
+ * Feb 2015 @ OpenSprinkler.com
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _TZ_H
+#define _TZ_H
+
+#if !defined(ARDUINO)
+
+#include <time.h>
+#include "defines.h"
+
+/* On RPI/BBB, local time can follow a zoneinfo time zone (e.g.
+ * Europe/Berlin, or 'localtime' for the system zone) instead of the
+ * fixed offset of IOPT_TIMEZONE. The zone file is read once, and its
+ * transitions are kept in a table, extended with the transitions of
+ * the zone's rule (TZ string) up to TZ_LAST_YEAR. The offset in effect
+ * is cached together with the interval it is valid for, so looking
+ * up the current offset only searches the table at a transition.
+ */
+#define TZ_FILENAME						"tz.txt"	// name of the zone, empty or missing for IOPT_TIMEZONE
+#define TZ_ZONEINFO_PATH			"/usr/share/zoneinfo/"
+#define TZ_NAME_SIZE					64
+#ifndef TZ_MAX_TRANSITIONS
+#define TZ_MAX_TRANSITIONS		400		// transitions kept, after 1970
+#endif
+#ifndef TZ_LAST_YEAR
+#define TZ_LAST_YEAR					2100	// last year of transitions computed from the zone's rule
+#endif
+
+void tz_begin();
+bool tz_set(const char *name);
+const char *tz_name();
+bool tz_active();
+long tz_offset(time_t utc);
+
+#endif // !ARDUINO
+
+#endif // _TZ_H
@@ -80,15 +80,10 @@ void delay(ulong howLong)
 
 void delayMicrosecondsHard (ulong howLong)
 {
-	struct timeval tNow, tLong, tEnd ;
+	ulong start = micros() ;
 
-	gettimeofday (&tNow, NULL) ;
-	tLong.tv_sec	= howLong / 1000000 ;
-	tLong.tv_usec = howLong % 1000000 ;
-	timeradd (&tNow, &tLong, &tEnd) ;
-
-	while (timercmp (&tNow, &tEnd, <))
-		gettimeofday (&tNow, NULL) ;
+	while (micros() - start < howLong)
+		;
 }
 
 void delayMicroseconds (ulong howLong)
@@ -113,31 +108,32 @@ static uint64_t epochMilli, epochMicro ;
 
 void initialiseEpoch()
 {
-	struct timeval tv ;
+	struct timespec ts ;
 
-	gettimeofday (&tv, NULL) ;
-	epochMilli = (uint64_t)tv.tv_sec * (uint64_t)1000		 + (uint64_t)(tv.tv_usec / 1000) ;
-	epochMicro = (uint64_t)tv.tv_sec * (uint64_t)1000000 + (uint64_t)(tv.tv_usec) ;
+	clock_gettime (MILLIS_CLOCK, &ts) ;
+	epochMilli = (uint64_t)ts.tv_sec * (uint64_t)1000		 + (uint64_t)(ts.tv_nsec / 1000000) ;
+	clock_gettime (CLOCK_MONOTONIC, &ts) ;
+	epochMicro = (uint64_t)ts.tv_sec * (uint64_t)1000000 + (uint64_t)(ts.tv_nsec / 1000) ;
 }
 
 ulong millis (void)
 {
-	struct timeval tv ;
+	struct timespec ts ;
 	uint64_t now ;
 
-	gettimeofday (&tv, NULL) ;
-	now  = (uint64_t)tv.tv_sec * (uint64_t)1000 + (uint64_t)(tv.tv_usec / 1000) ;
+	clock_gettime (MILLIS_CLOCK, &ts) ;
+	now  = (uint64_t)ts.tv_sec * (uint64_t)1000 + (uint64_t)(ts.tv_nsec / 1000000) ;
 
 	return (ulong)(now - epochMilli) ;
 }
 
 ulong micros (void)
 {
-	struct timeval tv ;
+	struct timespec ts ;
 	uint64_t now ;
 
-	gettimeofday (&tv, NULL) ;
-	now  = (uint64_t)tv.tv_sec * (uint64_t)1000000 + (uint64_t)tv.tv_usec ;
+	clock_gettime (CLOCK_MONOTONIC, &ts) ;
+	now  = (uint64_t)ts.tv_sec * (uint64_t)1000000 + (uint64_t)(ts.tv_nsec / 1000) ;
 
 	return (ulong)(now - epochMicro) ;
 }
@@ -526,6 +522,42 @@ int16_t water_time_decode_signed(byte i) {
 	return ((int16_t)i-120)*5;
 }
 
+/* Calendar arithmetic on days since Jan 1, 1970 (H. Hinnant's
+ * civil_from_days / days_from_civil, restricted to dates after 1970).
+ * Years start on March 1 internally, so the leap day is the last
+ * day of the year, and a 400-year era has 146097 days.
+ */
+void civil_from_days(ulong days, CivilDate *cd) {
+	ulong z = days + 719468;	// days since Mar 1, 0000
+	ulong era = z / 146097;
+	ulong doe = z - era * 146097;										// day of era [0, 146096]
+	ulong yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;	// year of era [0, 399]
+	ulong doy = doe - (365*yoe + yoe/4 - yoe/100);	// day of year, from Mar 1 [0, 365]
+	ulong mp = (5*doy + 2) / 153;										// month, from March [0, 11]
+	cd->day = doy - (153*mp + 2)/5 + 1;
+	cd->month = (mp<10) ? mp+3 : mp-9;
+	cd->year = yoe + era*400 + (cd->month<=2);
+}
+
+ulong days_from_civil(uint16_t year, byte month, byte day) {
+	ulong y = year - (month<=2);
+	ulong era = y / 400;
+	ulong yoe = y - era * 400;
+	ulong doy = (153*((month>2) ? month-3 : month+9) + 2)/5 + day-1;
+	ulong doe = yoe*365 + yoe/4 - yoe/100 + doy;
+	return era * 146097 + doe - 719468;
+}
+
+// Jan 1, 1970 is a Thursday
+byte weekday_from_days(ulong days) {
+	return (days+3) % 7;
+}
+
+byte days_in_month(uint16_t year, byte month) {
+	if(month==2) return ((year%4==0 && year%100!=0) || year%400==0) ? 29 : 28;
+	return (month==4 || month==6 || month==9 || month==11) ? 30 : 31;
+}
+
 
 /** Convert a single hex digit character to its integer value */
 static unsigned char h2int(char c) {
@@ -30,6 +30,7 @@
 	#include <stdio.h>
 	#include <limits.h>
 	#include <sys/time.h>
+	#include <time.h>
 
 #endif
 #include "defines.h"
@@ -52,6 +53,17 @@ void strncpy_P0(char* dest, const char* src, int n);
 ulong water_time_resolve(uint16_t v);
 byte water_time_encode_signed(int16_t i);
 int16_t water_time_decode_signed(byte i);
+
+// calendar date of a day (epoch time / 86400), without gmtime()
+struct CivilDate {
+	uint16_t year;
+	byte month;		// 1-12
+	byte day;			// 1-31
+};
+void civil_from_days(ulong days, CivilDate *cd);
+ulong days_from_civil(uint16_t year, byte month, byte day);
+byte weekday_from_days(ulong days);		// Monday is 0
+byte days_in_month(uint16_t year, byte month);
 void urlDecode(char *);
 void peel_http_header(char*);
 
@@ -63,6 +75,13 @@ void peel_http_header(char*);
 	void delay(ulong ms);
 	void delayMicroseconds(ulong us);
 	void delayMicrosecondsHard(ulong us);
+	// millis() and micros() count from initialiseEpoch() on a monotonic
+	// clock, so they don't jump when the system time is set; like on
+	// Arduino they wrap around, so compare them by difference only,
+	// e.g. (long)(millis()-stoptime)>0
+	#ifndef MILLIS_CLOCK
+	#define MILLIS_CLOCK	CLOCK_MONOTONIC	// CLOCK_MONOTONIC_COARSE is cheaper, with a resolution of a few ms
+	#endif
 	ulong millis();
 	ulong micros();
 	void initialiseEpoch();
@@ -26,12 +26,16 @@
 #include "utils.h"
 #include "server.h"
 #include "weather.h"
+#if !defined(ARDUINO)
+#include "httpclient.h"
+#endif
 
 extern OpenSprinkler os; // OpenSprinkler object
 extern char tmp_buffer[];
 extern char ether_buffer[];
 char wt_rawData[TMP_BUFFER_SIZE];
 int wt_errCode = HTTP_RQT_NOT_RECEIVED;
+unsigned long wt_retryTime = 0;	// time to retry a failed weather call (0: no retry pending)
 
 byte findKeyVal (const char *str,char *strbuf, uint16_t maxlen,const char *key,bool key_in_pgm=false,uint8_t *keyfound=NULL);
 void write_log(byte type, ulong curr_time);
@@ -117,7 +121,8 @@ static void getweather_callback(char* buffer) {
 		}
 	}
 
-	if (findKeyVal(p, wt_rawData, TMP_BUFFER_SIZE, PSTR("rawData"), true)) {
+	// keep the last good raw data if the weather script returns an error
+	if (wt_errCode==0 && findKeyVal(p, wt_rawData, TMP_BUFFER_SIZE, PSTR("rawData"), true)) {
 		wt_rawData[TMP_BUFFER_SIZE-1]=0;	// make sure the buffer ends properly
 	}
 	
@@ -130,7 +135,44 @@ static void getweather_callback_with_peel_header(char* buffer) {
 	getweather_callback(buffer);
 }
 
+#if !defined(ARDUINO)
+static bool wt_pending = false;	// weather call in progress
+static byte wt_failures = 0;		// number of failed weather calls in a row
+static bool wt_again = false;		// weather call requested while one is in progress
+
+/** Result of a weather call
+ * On failure, the weather call is retried with exponential backoff
+ * and random jitter (so controllers do not retry in lockstep);
+ * the last good weather data stays in use in the meantime.
+ */
+static void getweather_result(int8_t ret) {
+	wt_pending = false;
+	if(ret!=HTTP_RQT_SUCCESS && wt_errCode<0) wt_errCode = ret;
+	if(wt_again) {	// e.g. weather options changed during the call
+		wt_again = false;
+		wt_retryTime = os.now_tz();
+		return;
+	}
+	if(ret==HTTP_RQT_SUCCESS && wt_errCode==0) {
+		wt_failures = 0;
+		wt_retryTime = 0;
+		return;
+	}
+	ulong backoff = (ulong)WEATHER_RETRY_MIN << (wt_failures<6 ? wt_failures : 6);
+	if(backoff > WEATHER_RETRY_MAX) backoff = WEATHER_RETRY_MAX;
+	if(wt_failures<255) wt_failures++;
+	backoff = backoff*3/4 + random()%(backoff/2+1);	// +/-25% jitter
+	wt_retryTime = os.now_tz() + backoff;
+}
+#endif
+
 void GetWeather() {
+#if !defined(ARDUINO)
+	if(wt_pending) {
+		wt_again = true;
+		return;
+	}
+#endif
 #if defined(ESP8266)
 	if(!m_server) {
 		if (os.state!=OS_STATE_CONNECTED || WiFi.status()!=WL_CONNECTED) return;
@@ -176,10 +218,25 @@ void GetWeather() {
 	strcat(ether_buffer, host);
 	strcat(ether_buffer, "\r\n\r\n");
 
+#if defined(ARDUINO)
 	wt_errCode = HTTP_RQT_NOT_RECEIVED;
 	int ret = os.send_http_request(host, ether_buffer, getweather_callback_with_peel_header);
 	if(ret!=HTTP_RQT_SUCCESS) {
 		if(wt_errCode < 0) wt_errCode = ret;
 		// if wt_errCode > 0, the call is successful but weather script may return error
 	}
+#else
+	// the weather call is processed by the asynchronous http client,
+	// getweather_result is called when it completes
+	wt_retryTime = 0;
+	char *port = strchr(host, ':');
+	if(port) *port++ = 0;
+	wt_errCode = HTTP_RQT_NOT_RECEIVED;
+	if(httpclient_queue(host, port?atoi(port):80, ether_buffer, getweather_callback_with_peel_header,
+										  WEATHER_TIMEOUT, getweather_result)) {
+		wt_pending = true;
+	} else {
+		getweather_result(HTTP_RQT_CONNECT_ERR);
+	}
+#endif
 }
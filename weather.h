@@ -32,8 +32,15 @@
 #define WEATHER_UPDATE_TZ				0x10
 #define WEATHER_UPDATE_RD				0x20
 
+#define WEATHER_METHOD_LOCAL_ET	4			// water percentage computed on the controller (RPI/BBB)
+
+#define WEATHER_RETRY_MIN				60		// seconds before retrying a failed weather call
+#define WEATHER_RETRY_MAX				3600	// maximum seconds between retries (doubles after each failure)
+#define WEATHER_TIMEOUT					10000	// weather call timeout (in milliseconds) on RPI/BBB
+
 void GetWeather();
 
 extern char wt_rawData[];
 extern int wt_errCode;
+extern unsigned long wt_retryTime;
 #endif	// _WEATHER_H
@@ -0,0 +1,321 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Webhook notifications
+ * Feb 2015 @ OpenSprinkler.com
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#if !defined(ARDUINO)
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "OpenSprinkler.h"
+#include "program.h"
+#include "server.h"
+#include "httpclient.h"
+#include "notify.h"
+#include "webhook.h"
+
+extern OpenSprinkler os;
+extern ProgramData pd;
+
+/** Compiled template: a list of literals and variables */
+struct WebhookOp {
+	char var;				// variable name, 0 for a literal
+	uint16_t pos;		// literal: offset of its null-terminated text in code
+};
+
+struct WebhookTemplate {
+	WebhookOp ops[WEBHOOK_MAX_OPS];
+	byte nops;
+	char code[WEBHOOK_TEMPLATE_SIZE+WEBHOOK_MAX_OPS];	// literals
+};
+
+struct Webhook {
+	NotifySink sink;	// must be first: sink pointers are cast to Webhook
+	WebhookConfig cfg;
+	char name[10];
+	char host[HTTPCLIENT_HOST_SIZE];
+	uint16_t port;
+	char path[WEBHOOK_URL_SIZE];
+	WebhookTemplate tmpl;
+	bool json;				// payload is JSON
+	bool accepted;		// the endpoint answered 2xx
+};
+
+static Webhook webhooks[WEBHOOK_MAX];
+
+static const char webhook_vars[] = "etsnvwTm";
+
+/** Event names, by NOTIFY_xxx bit */
+static const char *webhook_event_names[] = {
+	"program", "sensor1", "flow", "weather", "reboot",
+	"station_off", "sensor2", "raindelay", "station_on"
+};
+
+/** Split http://host[:port]/path */
+static bool webhook_parse_url(const char *url, char *host, uint16_t *port, char *path) {
+	if(strncmp(url, "http://", 7)) return false;	// no TLS support
+	url += 7;
+	const char *end = strpbrk(url, ":/");
+	size_t len = end ? (size_t)(end-url) : strlen(url);
+	if(!len || len>=HTTPCLIENT_HOST_SIZE) return false;
+	strncpy(host, url, len);
+	host[len] = 0;
+	url += len;
+	*port = 80;
+	if(*url==':') {
+		long p = strtol(url+1, (char**)&url, 10);
+		if(p<=0 || p>65535) return false;
+		*port = p;
+	}
+	if(*url && *url!='/') return false;
+	strcpy(path, *url ? url : "/");
+	return true;
+}
+
+/** Compile a template
+ * Returns false if it uses an unknown variable or is too long
+ */
+static bool webhook_compile(const char *s, WebhookTemplate *t) {
+	uint16_t len = 0;
+	bool literal = false;	// a literal is open
+	t->nops = 0;
+	for(;*s;s++) {
+		if(*s=='$' && s[1]!='$') {
+			s++;
+			if(!*s || !strchr(webhook_vars, *s) || t->nops==WEBHOOK_MAX_OPS) return false;
+			if(literal) { t->code[len++] = 0; literal = false; }
+			t->ops[t->nops].var = *s;
+			t->ops[t->nops++].pos = 0;
+			continue;
+		}
+		if(*s=='$') s++;	// $$
+		if(!literal) {
+			if(t->nops==WEBHOOK_MAX_OPS) return false;
+			t->ops[t->nops].var = 0;
+			t->ops[t->nops++].pos = len;
+			literal = true;
+		}
+		if(len>=WEBHOOK_TEMPLATE_SIZE+WEBHOOK_MAX_OPS-2) return false;
+		t->code[len++] = *s;
+	}
+	if(literal) t->code[len++] = 0;
+	return true;
+}
+
+/** Escape a string for use in a JSON string */
+void webhook_json_escape(const char *src, char *dst, uint16_t size) {
+	uint16_t n = 0;
+	for(;*src && n+7<size;src++) {
+		unsigned char c = *src;
+		if(c=='"' || c=='\\') { dst[n++] = '\\'; dst[n++] = c; }
+		else if(c<0x20) n += sprintf(dst+n, "\\u%04x", c);
+		else dst[n++] = c;
+	}
+	dst[n] = 0;
+}
+
+/** Render the payload of an event */
+static void webhook_render(const WebhookTemplate *t, const NotifyEvent *ev, BufferFiller &bf) {
+	char text[NOTIFY_TEXT_SIZE*2];
+	char buf[NOTIFY_TEXT_SIZE*2];
+	for(byte i=0;i<t->nops;i++) {
+		const WebhookOp *op = &t->ops[i];
+		const char *lit = op->var ? NULL : t->code+op->pos;
+		if(bf.position()+(lit ? strlen(lit) : sizeof(buf))>=WEBHOOK_BODY_SIZE) break;	// truncate
+		switch(op->var) {
+		case 0:
+			bf.emit_p(PSTR("$S"), lit);
+			break;
+		case 'e': {
+			byte b = 0;
+			while(b<sizeof(webhook_event_names)/sizeof(webhook_event_names[0]) && !(ev->type&(1<<b))) b++;
+			bf.emit_p(PSTR("$S"), (b<sizeof(webhook_event_names)/sizeof(webhook_event_names[0])) ? webhook_event_names[b] : "");
+			break;
+		}
+		case 't':
+			bf.emit_p(PSTR("$D"), ev->type);
+			break;
+		case 's':
+			bf.emit_p(PSTR("$L"), ev->lval);
+			break;
+		case 'n':
+			text[0] = 0;
+			if(ev->type==NOTIFY_STATION_ON || ev->type==NOTIFY_STATION_OFF) {
+				if(ev->lval<os.nstations) os.get_station_name(ev->lval, text);
+			} else if(ev->type==NOTIFY_PROGRAM_SCHED && ev->lval<pd.nprograms) {
+				ProgramStruct prog;
+				pd.read(ev->lval, &prog);
+				strcpy(text, prog.name);
+			}
+			webhook_json_escape(text, buf, sizeof(buf));
+			bf.emit_p(PSTR("$S"), buf);
+			break;
+		case 'v':
+			bf.emit_p(PSTR("$D"), (int)ev->fval);
+			break;
+		case 'w':
+			sprintf(buf, "%.2f", ev->flow);
+			bf.emit_p(PSTR("$S"), buf);
+			break;
+		case 'T':
+			bf.emit_p(PSTR("$L"), ev->time);
+			break;
+		case 'm':
+			text[0] = 0;
+			notify_format_text(ev, text);
+			text[NOTIFY_TEXT_SIZE-1] = 0;
+			webhook_json_escape(text, buf, sizeof(buf));
+			bf.emit_p(PSTR("$S"), buf);
+			break;
+		}
+	}
+}
+
+/** ====== Sink ====== */
+static void webhook_response(byte i, char *resp) {
+	webhooks[i].accepted = !strncmp(resp, "HTTP/1.", 7) && resp[8]==' ' && resp[9]=='2';
+}
+
+static void webhook_result(byte i, int8_t ret) {
+	notify_done(&webhooks[i].sink, ret==HTTP_RQT_SUCCESS && webhooks[i].accepted);
+}
+
+// HTTP client callbacks have no context: one pair per webhook
+#define WEBHOOK_CALLBACKS(i) \
+	static void webhook_response##i(char *resp) { webhook_response(i, resp); } \
+	static void webhook_result##i(int8_t ret) { webhook_result(i, ret); }
+WEBHOOK_CALLBACKS(0)
+WEBHOOK_CALLBACKS(1)
+WEBHOOK_CALLBACKS(2)
+WEBHOOK_CALLBACKS(3)
+
+static void (*const webhook_responses[WEBHOOK_MAX])(char*) = {
+	webhook_response0, webhook_response1, webhook_response2, webhook_response3
+};
+static void (*const webhook_results[WEBHOOK_MAX])(int8_t) = {
+	webhook_result0, webhook_result1, webhook_result2, webhook_result3
+};
+
+static uint16_t webhook_types(NotifySink *s) {
+	Webhook *w = (Webhook*)s;
+	return w->cfg.url[0] ? w->cfg.types : 0;
+}
+
+/** Events are sent one per request */
+static byte webhook_send(NotifySink *s, const NotifyEvent **evs, byte n) {
+	static char body[WEBHOOK_BODY_SIZE];
+	static char request[WEBHOOK_BODY_SIZE+WEBHOOK_URL_SIZE+HTTPCLIENT_HOST_SIZE+128];
+	Webhook *w = (Webhook*)s;
+	byte i = w-webhooks;
+
+	BufferFiller bf = body;
+	body[0] = 0;
+	webhook_render(&w->tmpl, evs[0], bf);
+
+	bf = request;
+	bf.emit_p(PSTR("POST $S HTTP/1.0\r\n"
+					"Host: $S\r\n"
+					"Accept: */*\r\n"
+					"Content-Length: $D\r\n"
+					"Content-Type: $S\r\n\r\n$S"),
+					w->path, w->host, strlen(body), w->json ? "application/json" : "text/plain", body);
+
+	w->accepted = false;
+	if(!httpclient_queue(w->host, w->port, request, webhook_responses[i], 3000, webhook_results[i])) return NOTIFY_BUSY;
+	return NOTIFY_QUEUED;
+}
+
+/** ====== Settings ====== */
+
+/** Apply the settings of a webhook
+ * Returns false if the URL or the template is invalid
+ */
+static bool webhook_apply(Webhook *w, const WebhookConfig *cfg) {
+	if(!cfg->url[0]) {
+		memset(&w->cfg, 0, sizeof(w->cfg));
+		return true;
+	}
+	WebhookTemplate t;
+	char host[HTTPCLIENT_HOST_SIZE], path[WEBHOOK_URL_SIZE];
+	uint16_t port;
+	if(!webhook_parse_url(cfg->url, host, &port, path) || !webhook_compile(cfg->tmpl, &t)) return false;
+	strcpy(w->host, host);
+	w->port = port;
+	strcpy(w->path, path);
+	w->tmpl = t;
+	w->cfg = *cfg;
+	const char *p = cfg->tmpl;
+	while(*p==' ') p++;
+	w->json = (*p=='{' || *p=='[');
+	return true;
+}
+
+static void webhook_save() {
+	FILE *fp = fopen(get_filename_fullpath(WEBHOOK_FILENAME), "wb");
+	if(!fp) return;
+	for(byte i=0;i<WEBHOOK_MAX;i++) fwrite(&webhooks[i].cfg, sizeof(WebhookConfig), 1, fp);
+	fclose(fp);
+}
+
+/** Load the webhooks and add them to the notification sinks */
+void webhook_begin() {
+	FILE *fp = fopen(get_filename_fullpath(WEBHOOK_FILENAME), "rb");
+	for(byte i=0;i<WEBHOOK_MAX;i++) {
+		Webhook *w = &webhooks[i];
+		WebhookConfig cfg;
+		memset(&cfg, 0, sizeof(cfg));
+		if(fp && fread(&cfg, sizeof(cfg), 1, fp)==1) {
+			cfg.url[WEBHOOK_URL_SIZE-1] = 0;
+			cfg.tmpl[WEBHOOK_TEMPLATE_SIZE-1] = 0;
+		}
+		if(!webhook_apply(w, &cfg)) memset(&w->cfg, 0, sizeof(w->cfg));
+
+		sprintf(w->name, "webhook%d", i);
+		w->sink.name = w->name;
+		w->sink.types = webhook_types;
+		w->sink.send = webhook_send;
+		w->sink.window = 0;
+		w->sink.batch = 1;
+		w->sink.coalesce = false;
+		notify_register(&w->sink);
+	}
+	if(fp) fclose(fp);
+}
+
+/** Change a webhook (an empty url removes it) */
+bool webhook_set(byte i, const char *url, uint16_t types, const char *tmpl) {
+	if(i>=WEBHOOK_MAX || strlen(url)>=WEBHOOK_URL_SIZE || strlen(tmpl)>=WEBHOOK_TEMPLATE_SIZE) return false;
+	WebhookConfig cfg;
+	memset(&cfg, 0, sizeof(cfg));
+	strcpy(cfg.url, url);
+	cfg.types = types;
+	strcpy(cfg.tmpl, tmpl);
+	if(!webhook_apply(&webhooks[i], &cfg)) return false;
+	webhook_save();
+	return true;
+}
+
+const WebhookConfig *webhook_get(byte i) {
+	return (i<WEBHOOK_MAX) ? &webhooks[i].cfg : NULL;
+}
+
+#endif // !ARDUINO
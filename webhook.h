@@ -0,0 +1,69 @@
+/* OpenSprinkler Unified (RPI/BBB/LINUX) Firmware
+ * Copyright (C) 2015 by Ray Wang (ray@opensprinkler.com)
+ *
+ * Webhook notifications header file
+ * Feb 2015 @ OpenSprinkler.com
+ *
+ * This file is part of the OpenSprinkler library
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see
+ * <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WEBHOOK_H
+#define _WEBHOOK_H
+
+#if !defined(ARDUINO)
+
+#include "defines.h"
+
+/* On RPI/BBB, events can be POSTed to user-defined HTTP endpoints
+ * (http://host[:port]/path), each with its own event filter (NOTIFY_xxx
+ * bits) and payload template. The template is the payload text with
+ * variables in the BufferFiller style:
+ *   $e  event name (station_on, station_off, program, sensor1, ...)
+ *   $t  event type (NOTIFY_xxx bit)
+ *   $s  station or program index
+ *   $n  station or program name
+ *   $v  event value (run time in seconds, sensor state, water level...)
+ *   $w  flow rate of the last station run
+ *   $T  local time of the event (epoch time)
+ *   $m  event text, as sent to IFTTT
+ *   $$  a $ character
+ * Names and texts are escaped for use in JSON strings. Templates are
+ * compiled once, when they are loaded or changed. Events are delivered
+ * one per request, through the notification queue (see notify.h).
+ */
+#define WEBHOOK_FILENAME			"webhooks.dat"
+#define WEBHOOK_MAX						4			// number of webhooks
+#define WEBHOOK_URL_SIZE			128
+#define WEBHOOK_TEMPLATE_SIZE	256
+#define WEBHOOK_MAX_OPS				32		// maximum number of literals and variables in a template
+#define WEBHOOK_BODY_SIZE			1024	// maximum size of a rendered payload
+
+/** Webhook settings, as stored in WEBHOOK_FILENAME */
+struct WebhookConfig {
+	char url[WEBHOOK_URL_SIZE];		// empty: unused
+	uint16_t types;								// NOTIFY_xxx bits of the events to send
+	char tmpl[WEBHOOK_TEMPLATE_SIZE];
+};
+
+void webhook_begin();
+bool webhook_set(byte i, const char *url, uint16_t types, const char *tmpl);
+const WebhookConfig *webhook_get(byte i);
+void webhook_json_escape(const char *src, char *dst, uint16_t size);
+
+#endif // !ARDUINO
+
+#endif // _WEBHOOK_H